@@ -0,0 +1,87 @@
+// Compares HttpResponse::serializeHeaders() against the previous
+// std::map + ostringstream serialization for a typical static-file reply.
+//
+//   make bench
+
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "HttpResponse.hpp"
+
+static const int ITERATIONS = 1000000;
+
+static std::string legacySerialize(int statusCode, const std::string &statusMessage,
+                                   const std::map<std::string, std::string> &headers)
+{
+    std::ostringstream response;
+
+    response << "HTTP/1.1 " << statusCode << " " << statusMessage << "\r\n";
+
+    std::time_t now = std::time(0);
+    char timeStr[100];
+    std::strftime(timeStr, sizeof(timeStr), "%a, %d %b %Y %H:%M:%S GMT", std::gmtime(&now));
+    response << "Date: " << timeStr << "\r\n";
+
+    for (std::map<std::string, std::string>::const_iterator it = headers.begin();
+         it != headers.end(); ++it)
+    {
+        response << it->first << ": " << it->second << "\r\n";
+    }
+
+    response << "\r\n";
+    return response.str();
+}
+
+static double elapsedSeconds(const struct timespec &start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main()
+{
+    std::map<std::string, std::string> legacyHeaders;
+    legacyHeaders["Server"] = HttpResponse::serverName;
+    legacyHeaders["Connection"] = "close";
+    legacyHeaders["Content-Type"] = "text/html";
+    legacyHeaders["Content-Length"] = "5271";
+    legacyHeaders["ETag"] = "\"ce805e-1497-6ad46d1e\"";
+    legacyHeaders["Last-Modified"] = "Sun, 18 Oct 2026 06:54:22 GMT";
+
+    HttpResponse response;
+    response.setHeader("Content-Type", "text/html");
+    response.setHeader("Content-Length", "5271");
+    response.setHeader("ETag", "\"ce805e-1497-6ad46d1e\"");
+    response.setHeader("Last-Modified", "Sun, 18 Oct 2026 06:54:22 GMT");
+
+    size_t checksum = 0;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        std::string headers = legacySerialize(200, "OK", legacyHeaders);
+        checksum += headers.size();
+    }
+    double legacyTime = elapsedSeconds(start);
+
+    std::string buffer;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        buffer.clear();
+        response.serializeHeaders(buffer);
+        checksum += buffer.size();
+    }
+    double builderTime = elapsedSeconds(start);
+
+    std::cout << "legacy map + ostringstream: " << legacyTime * 1e9 / ITERATIONS << " ns/response" << std::endl;
+    std::cout << "serializeHeaders():         " << builderTime * 1e9 / ITERATIONS << " ns/response" << std::endl;
+    std::cout << "speedup:                    " << legacyTime / builderTime << "x" << std::endl;
+    std::cout << "(checksum " << checksum << ")" << std::endl;
+    return 0;
+}
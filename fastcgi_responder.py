@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+"""Stand-in FastCGI responder for testing fastcgi_pass.
+
+Behaves like a small php-fpm pool: a fixed number of pre-forked workers
+accept connections on one socket, serve requests until the server closes
+the connection (FCGI_KEEP_CONN) and handle one request at a time.
+
+Requests for an existing *.py SCRIPT_FILENAME run that script in-process
+with the CGI environment, stdin and stdout redirected, so the same scripts
+work under cgi_pass and fastcgi_pass. Anything else gets a plain-text echo
+of the parameters and the body size.
+
+Started without arguments on a connected socket (how cgi_pool launches
+its cgi_worker), it serves that one connection on stdin instead and exits
+when webserv closes it.
+
+Usage: fastcgi_responder.py [unix:/path | host:port] [workers]
+"""
+
+import io
+import os
+import runpy
+import signal
+import socket
+import stat
+import struct
+import sys
+
+FCGI_VERSION_1 = 1
+FCGI_BEGIN_REQUEST = 1
+FCGI_ABORT_REQUEST = 2
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_STDERR = 7
+FCGI_GET_VALUES = 9
+FCGI_GET_VALUES_RESULT = 10
+FCGI_UNKNOWN_TYPE = 11
+
+FCGI_RESPONDER = 1
+FCGI_KEEP_CONN = 1
+FCGI_REQUEST_COMPLETE = 0
+FCGI_UNKNOWN_ROLE = 3
+
+HEADER = struct.Struct("!BBHHBx")
+
+
+def read_exact(conn, size):
+    data = b""
+    while len(data) < size:
+        chunk = conn.recv(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def read_record(conn):
+    header = read_exact(conn, HEADER.size)
+    if header is None:
+        return None
+    version, rtype, request_id, length, padding = HEADER.unpack(header)
+    if version != FCGI_VERSION_1:
+        raise ValueError("unsupported FastCGI version %d" % version)
+    content = read_exact(conn, length + padding)
+    if content is None:
+        return None
+    return rtype, request_id, content[:length]
+
+
+def encode_records(rtype, request_id, content=b""):
+    parts = []
+    for offset in range(0, max(len(content), 1), 65535):
+        chunk = content[offset:offset + 65535]
+        parts.append(HEADER.pack(FCGI_VERSION_1, rtype, request_id, len(chunk), 0))
+        parts.append(chunk)
+    return b"".join(parts)
+
+
+def write_record(conn, rtype, request_id, content=b""):
+    conn.sendall(encode_records(rtype, request_id, content))
+
+
+def decode_length(data, pos):
+    if data[pos] < 128:
+        return data[pos], pos + 1
+    return struct.unpack("!I", data[pos:pos + 4])[0] & 0x7FFFFFFF, pos + 4
+
+
+def decode_pairs(data):
+    pairs = {}
+    pos = 0
+    while pos < len(data):
+        name_length, pos = decode_length(data, pos)
+        value_length, pos = decode_length(data, pos)
+        name = data[pos:pos + name_length].decode("latin-1")
+        pos += name_length
+        pairs[name] = data[pos:pos + value_length].decode("latin-1")
+        pos += value_length
+    return pairs
+
+
+def encode_pairs(pairs):
+    out = b""
+    for name, value in pairs.items():
+        name, value = name.encode(), value.encode()
+        for item in (name, value):
+            out += bytes([len(item)]) if len(item) < 128 else struct.pack("!I", len(item) | 0x80000000)
+        out += name + value
+    return out
+
+
+def run_script(path, params, body):
+    """Runs a CGI script in this process; returns (stdout bytes, exit status)."""
+    saved = (os.environ.copy(), sys.stdin, sys.stdout, sys.argv, os.getcwd())
+    output = io.BytesIO()
+    stdout = io.TextIOWrapper(output, encoding="utf-8", write_through=True)
+    status = 0
+    os.environ.clear()
+    os.environ.update(params)
+    sys.stdin = io.TextIOWrapper(io.BytesIO(body), encoding="utf-8")
+    sys.stdout = stdout
+    sys.argv = [path]
+    try:
+        os.chdir(os.path.dirname(path))
+        runpy.run_path(path, run_name="__main__")
+    except SystemExit as e:
+        status = e.code if isinstance(e.code, int) else (0 if e.code is None else 1)
+    except Exception as e:
+        print("%s: %s" % (type(e).__name__, e), file=sys.stderr)
+        status = 1
+    finally:
+        stdout.flush()
+        stdout.detach()  # Keeps output open when the wrapper is collected
+        env, sys.stdin, sys.stdout, sys.argv, cwd = saved
+        os.environ.clear()
+        os.environ.update(env)
+        os.chdir(cwd)
+    return output.getvalue(), status
+
+
+def echo(params, body):
+    lines = ["%s=%s" % item for item in sorted(params.items())]
+    lines.append("BODY_BYTES=%d" % len(body))
+    text = "\n".join(lines) + "\n"
+    return ("Status: 200 OK\r\nContent-Type: text/plain\r\n\r\n" + text).encode(), 0
+
+
+def respond(conn, request_id, params, body):
+    script = params.get("SCRIPT_FILENAME", "")
+    if script.endswith(".py") and os.path.isfile(script):
+        output, status = run_script(script, params, body)
+    else:
+        output, status = echo(params, body)
+    # One write for the whole response, so Nagle never holds back its tail
+    end = struct.pack("!IB3x", status & 0xFFFFFFFF, FCGI_REQUEST_COMPLETE)
+    conn.sendall(b"".join([encode_records(FCGI_STDOUT, request_id, output) if output else b"",
+                           encode_records(FCGI_STDOUT, request_id),
+                           encode_records(FCGI_END_REQUEST, request_id, end)]))
+
+
+def serve_connection(conn):
+    requests = {}
+    while True:
+        record = read_record(conn)
+        if record is None:
+            return
+        rtype, request_id, content = record
+
+        if request_id == 0:
+            if rtype == FCGI_GET_VALUES:
+                values = {"FCGI_MAX_CONNS": "1", "FCGI_MAX_REQS": "1", "FCGI_MPXS_CONNS": "0"}
+                wanted = decode_pairs(content)
+                write_record(conn, FCGI_GET_VALUES_RESULT, 0,
+                             encode_pairs(dict((k, values[k]) for k in wanted if k in values)))
+            else:
+                write_record(conn, FCGI_UNKNOWN_TYPE, 0, struct.pack("!B7x", rtype))
+            continue
+
+        if rtype == FCGI_BEGIN_REQUEST:
+            role, flags = struct.unpack("!HB5x", content)
+            if role != FCGI_RESPONDER:
+                write_record(conn, FCGI_END_REQUEST, request_id, struct.pack("!IB3x", 0, FCGI_UNKNOWN_ROLE))
+                continue
+            requests[request_id] = {"keep": flags & FCGI_KEEP_CONN, "params": b"", "stdin": b""}
+        elif request_id not in requests:
+            continue
+        elif rtype == FCGI_ABORT_REQUEST:
+            keep = requests.pop(request_id)["keep"]
+            write_record(conn, FCGI_END_REQUEST, request_id, struct.pack("!IB3x", 0, FCGI_REQUEST_COMPLETE))
+            if not keep:
+                return
+        elif rtype == FCGI_PARAMS:
+            requests[request_id]["params"] += content
+        elif rtype == FCGI_STDIN and content:
+            requests[request_id]["stdin"] += content
+        elif rtype == FCGI_STDIN:
+            request = requests.pop(request_id)
+            respond(conn, request_id, decode_pairs(request["params"]), request["stdin"])
+            if not request["keep"]:
+                return
+
+
+def listen(address):
+    if address.startswith("unix:"):
+        path = address[5:]
+        if os.path.exists(path):
+            os.unlink(path)
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.bind(path)
+    else:
+        host, port = address.rsplit(":", 1)
+        sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        sock.bind((host, int(port)))
+    sock.listen(128)
+    return sock
+
+
+def worker(sock):
+    signal.signal(signal.SIGTERM, signal.SIG_DFL)
+    while True:
+        conn, _ = sock.accept()
+        try:
+            serve_connection(conn)
+        except (OSError, ValueError) as e:
+            print("fastcgi_responder: %s" % e, file=sys.stderr)
+        finally:
+            conn.close()
+
+
+def main():
+    if len(sys.argv) == 1 and stat.S_ISSOCK(os.fstat(0).st_mode):
+        serve_connection(socket.socket(fileno=0))
+        return
+
+    address = sys.argv[1] if len(sys.argv) > 1 else "unix:/tmp/webserv-fcgi.sock"
+    workers = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+    sock = listen(address)
+
+    children = []
+    for _ in range(workers):
+        pid = os.fork()
+        if pid == 0:
+            worker(sock)
+            os._exit(0)
+        children.append(pid)
+
+    def shutdown(signum, frame):
+        for pid in children:
+            os.kill(pid, signal.SIGTERM)
+        if address.startswith("unix:"):
+            os.unlink(address[5:])
+        sys.exit(0)
+
+    signal.signal(signal.SIGTERM, shutdown)
+    signal.signal(signal.SIGINT, shutdown)
+    print("FastCGI responder on %s with %d workers" % (address, workers))
+    for pid in children:
+        os.waitpid(pid, 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -17,6 +17,29 @@ public:
     
     virtual void handleData() = 0;
     
+    // Output gathered so far; a consumer streaming it removes what it has
+    // forwarded. Once the buffer is full the producer stops reading and
+    // should not be polled until there is room again.
+    virtual std::string &getOutput() = 0;
+    virtual bool hasOutputRoom() const = 0;
+    
+    // Hands the rest of the output over as a pipe the consumer moves to
+    // the client with splice(), once getOutput() has been drained. From
+    // then on the operation no longer reads it, and hasOutputRoom() is
+    // true only while the pipe is empty. -1 when output must be read.
+    virtual int spliceOutput() { return -1; }
+    
+    // Whether the monitor fd should also be polled for writability, e.g.
+    // while a request is still being sent over it
+    virtual bool needsWrite() const { return false; }
+    
+    // The writer hung up; ends an operation that has nothing left to read
+    virtual void forceCompletion() {}
+    
+    // Finished without a response: the request should be handled again
+    // (a cache waiter whose fill produced nothing)
+    virtual bool shouldRetry() const { return false; }
+    
     virtual bool hasError() const = 0;
     virtual std::string getError() const = 0;
     
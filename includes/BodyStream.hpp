@@ -0,0 +1,35 @@
+#ifndef BODYSTREAM_HPP
+#define BODYSTREAM_HPP
+
+#include <cstddef>
+#include <string>
+
+// Response body produced piece by piece instead of being built up front.
+// The connection pulls from it whenever the socket has room, so the first
+// bytes go out before the rest exists and memory stays bounded.
+class BodyStream
+{
+public:
+    virtual ~BodyStream() {}
+
+    // Appends up to about maxBytes of body to out; false means the body
+    // cannot be completed and the connection has to be dropped
+    virtual bool read(std::string &out, size_t maxBytes) = 0;
+
+    virtual bool isFinished() const = 0;
+
+    // False while the producer has nothing buffered; the connection then
+    // stops polling the socket until it is told that data has arrived
+    virtual bool isReady() const { return true; }
+
+    // A pipe holding the next bytes of the body, which the connection
+    // splices to the socket instead of calling read(); available is set to
+    // what the pipe holds now. -1 while the body has to be read.
+    virtual int getSplicePipe(size_t &available)
+    {
+        available = 0;
+        return -1;
+    }
+};
+
+#endif
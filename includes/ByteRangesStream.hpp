@@ -0,0 +1,54 @@
+#ifndef BYTERANGESSTREAM_HPP
+#define BYTERANGESSTREAM_HPP
+
+#include <sys/types.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BodyStream.hpp"
+
+// multipart/byteranges body of a 206 with several ranges of one file. The
+// part headers are read() as usual; the file bytes of each part are spliced
+// into a pipe and from there to the socket, so they are never copied
+// through user space.
+class ByteRangesStream : public BodyStream
+{
+public:
+    typedef std::vector<std::pair<off_t, size_t> > Ranges;  // Offset and length
+
+    // Takes ownership of fd
+    ByteRangesStream(int fd, off_t fileSize, const Ranges &ranges,
+                     const std::string &contentType, const std::string &boundary);
+    ~ByteRangesStream();
+
+    bool read(std::string &out, size_t maxBytes);
+    bool isFinished() const;
+    int getSplicePipe(size_t &available);
+
+    // Exact body length, for the Content-Length header
+    size_t getLength() const;
+
+private:
+    int fd;
+    off_t fileSize;
+    Ranges ranges;
+    std::string contentType;
+    std::string boundary;
+    size_t current;         // Part being sent; ranges.size() once the closing boundary is next
+    bool inPart;            // Part header sent, file bytes of the part in progress
+    off_t partOffset;
+    size_t partRemaining;   // Bytes of the part not yet in the pipe
+    bool finished;
+    int pipeFds[2];
+
+    std::string partHeader(size_t index) const;
+    std::string closingBoundary() const;
+    size_t pipeBytes() const;
+
+    ByteRangesStream(const ByteRangesStream &other);
+    ByteRangesStream &operator=(const ByteRangesStream &other);
+};
+
+#endif
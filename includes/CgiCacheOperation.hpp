@@ -0,0 +1,82 @@
+#ifndef CGICACHEOPERATION_HPP
+#define CGICACHEOPERATION_HPP
+
+#include <string>
+
+#include "AsyncOperation.hpp"
+#include "CgiResponseCache.hpp"
+
+// Runs the CGI operation of a cache miss and records its output on the
+// way through. The output is offered to the cache once the script ends;
+// a response whose header block already rules storing out, or that grows
+// past the cache size, is passed on untouched (and spliced again).
+class CgiCacheFillOperation : public AsyncOperation
+{
+public:
+    // Takes ownership of operation; authorized as for CgiResponseCache::finishFill
+    CgiCacheFillOperation(CgiResponseCache &cache, const std::string &key, bool authorized,
+                          AsyncOperation *operation);
+    virtual ~CgiCacheFillOperation();
+
+    bool isComplete() const;
+    std::string getResult() const;
+    int getMonitorFd() const;
+    void handleData();
+    std::string &getOutput();
+    bool hasOutputRoom() const;
+    int spliceOutput();
+    bool needsWrite() const;
+    void forceCompletion();
+    bool hasError() const;
+    std::string getError() const;
+    void cleanup();
+
+private:
+    CgiResponseCache &cache;
+    std::string key;
+    bool authorized;
+    AsyncOperation *operation;
+    bool recording;        // Still collecting output for the cache
+    bool headersChecked;
+    std::string recorded;
+
+    void record(size_t outputBefore);
+    void finish(const std::string *output);
+
+    CgiCacheFillOperation(const CgiCacheFillOperation &other);
+    CgiCacheFillOperation &operator=(const CgiCacheFillOperation &other);
+};
+
+// Waits for another request's fill of the same key and answers with the
+// stored output, or asks to be handled again if nothing was stored
+class CgiCacheWaitOperation : public AsyncOperation
+{
+public:
+    CgiCacheWaitOperation(CgiResponseCache &cache, const std::string &key);
+    virtual ~CgiCacheWaitOperation();
+
+    bool isComplete() const;
+    std::string getResult() const;
+    int getMonitorFd() const;
+    void handleData();
+    std::string &getOutput();
+    bool hasOutputRoom() const;
+    bool shouldRetry() const;
+    bool hasError() const;
+    std::string getError() const;
+    void cleanup();
+
+private:
+    CgiResponseCache &cache;
+    std::string key;
+    int eventFd;
+    bool completed;
+    bool retry;
+    std::string result;
+    std::string errorMessage;
+
+    CgiCacheWaitOperation(const CgiCacheWaitOperation &other);
+    CgiCacheWaitOperation &operator=(const CgiCacheWaitOperation &other);
+};
+
+#endif
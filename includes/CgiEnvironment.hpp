@@ -0,0 +1,20 @@
+#ifndef CGIENVIRONMENT_HPP
+#define CGIENVIRONMENT_HPP
+
+#include <string>
+#include <vector>
+
+#include "HttpRequest.hpp"
+
+// Request meta-variables (RFC 3875) as "NAME=value" strings. CGI scripts get
+// them as their environment, FastCGI applications as FCGI_PARAMS.
+
+// The variables that only depend on the location, built once per location
+std::vector<std::string> buildCgiEnvironmentTemplate(const std::string &documentRoot, size_t clientMaxBodySize);
+
+// Appends the variables of one request to a copy of the template
+void appendRequestEnvironment(std::vector<std::string> &envVars, const HttpRequest &request,
+                              const std::string &scriptPath, const std::string &serverPort,
+                              const std::string &clientAddress, size_t bodyLength);
+
+#endif
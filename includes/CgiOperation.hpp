@@ -4,6 +4,7 @@
 #include "AsyncOperation.hpp"
 #include "HttpRequest.hpp"
 #include <string>
+#include <vector>
 #include <sys/types.h>
 
 
@@ -11,15 +12,16 @@ class CgiOperation : public AsyncOperation
 {
 public:
     CgiOperation(const std::string& scriptPath, const std::string& interpreterPath, 
-                 const HttpRequest& request, const std::string& documentRoot = "./www",
-                 const std::string& serverPort = "8080", const std::string& clientAddr = "127.0.0.1",
-                 size_t clientMaxBodySize = 0);
+                 const HttpRequest& request, const std::vector<std::string>& environment);
     virtual ~CgiOperation();
     
     bool isComplete() const;
     std::string getResult() const;
     int getMonitorFd() const;
     void handleData();
+    std::string &getOutput();
+    bool hasOutputRoom() const;
+    int spliceOutput();
     bool hasError() const;
     std::string getError() const;
     void cleanup();
@@ -34,26 +36,25 @@ private:
     
     bool completed;
     bool error;
+    bool outputEof;
+    bool outputSpliced;  // The consumer reads stdout itself from now on
     std::string result;
     std::string errorMessage;
     std::string postData;
+    size_t postDataOffset;
+    std::string bodyFilePath;
     
     std::string scriptPath;
     std::string interpreterPath;
-    std::string documentRoot;
-    std::string serverPort;
-    std::string clientAddress;
-    size_t clientMaxBodySize;
     
-    bool startCgiProcess(const HttpRequest& request);
-    char** createCgiEnvironment(const HttpRequest& request);
-    void freeCgiEnvironment(char** env);
+    bool startCgiProcess(const std::vector<std::string>& environment);
     bool setNonBlocking(int fd);
     void readFromProcess();
     void writePostData();
     bool checkProcessStatus();
     
     static const size_t BUFFER_SIZE = 4096;
+    static const size_t OUTPUT_BUFFER_LIMIT = 65536;
     char readBuffer[BUFFER_SIZE];
 };
 
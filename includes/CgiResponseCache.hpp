@@ -0,0 +1,74 @@
+#ifndef CGIRESPONSECACHE_HPP
+#define CGIRESPONSECACHE_HPP
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HttpRequest.hpp"
+
+// Size-bounded LRU cache of complete CGI output for a cgi_cache location,
+// keyed by method, host, URI and query. A response is stored only when its
+// Cache-Control or Expires header makes it fresh, and served until then.
+// The key holds no other request header, so responses with Vary are never
+// stored, nor answers to requests with credentials unless marked shared.
+// While one request fills an entry, identical ones wait on an eventfd for
+// it instead of starting the script as well.
+class CgiResponseCache
+{
+public:
+    explicit CgiResponseCache(size_t maxBytes);
+    ~CgiResponseCache();
+
+    static std::string makeKey(const HttpRequest &request);
+
+    // Raw CGI output (header block and body) of a fresh entry, or NULL.
+    // passed is set instead when the last response for the key could not
+    // be stored, so the request should run uncached and uncollapsed.
+    const std::string *lookup(const std::string &key, bool &passed);
+    void clear();
+
+    // A fill is the one running request for a key; waiters register an
+    // eventfd that is signalled when it finishes, stored or not
+    bool isFilling(const std::string &key) const;
+    void beginFill(const std::string &key);
+    void addWaiter(const std::string &key, int eventFd);
+    void removeWaiter(const std::string &key, int eventFd);
+    // output is the complete CGI output, or NULL if the fill failed;
+    // authorized tells whether the request carried an Authorization header
+    void finishFill(const std::string &key, const std::string *output, bool authorized);
+
+    // Seconds the header block allows the response to be reused for; 0 if
+    // it must not be stored
+    static long freshnessLifetime(const std::string &headers, time_t now, bool authorized);
+    size_t getMaxBytes() const;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string output;
+        bool pass;  // Uncacheable response: requests go straight to the script
+        time_t expires;
+    };
+    typedef std::list<Entry> EntryList;
+
+    EntryList entries;  // Most recently used first
+    std::map<std::string, EntryList::iterator> index;
+    std::map<std::string, std::vector<int> > fills;
+    size_t maxBytes;
+    size_t usedBytes;
+
+    // How long a key that produced an uncacheable response skips collapsing
+    static const int PASS_SECONDS = 30;
+
+    void store(const std::string &key, const std::string &output, bool pass, time_t expires);
+    void evict(std::map<std::string, EntryList::iterator>::iterator it);
+
+    CgiResponseCache(const CgiResponseCache &other);
+    CgiResponseCache &operator=(const CgiResponseCache &other);
+};
+
+#endif
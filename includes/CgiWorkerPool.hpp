@@ -0,0 +1,70 @@
+#ifndef CGIWORKERPOOL_HPP
+#define CGIWORKERPOOL_HPP
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "UpstreamPool.hpp"
+
+// Pre-spawned interpreters for cgi_pool locations. Each worker is the
+// cgi_pass interpreter running the cgi_worker script with one end of a
+// socketpair as its stdin; it serves one FastCGI request at a time over
+// it, so a request skips fork, exec and interpreter startup. Pools are
+// keyed by "interpreter worker" and belong to one webserv worker process.
+class CgiWorkerPool : public UpstreamPool
+{
+public:
+    CgiWorkerPool();
+    virtual ~CgiWorkerPool();
+
+    // Locations sharing an interpreter and worker script share a pool
+    static std::string makeKey(const std::string &interpreter, const std::string &worker);
+    void configure(const std::string &interpreter, const std::string &worker,
+                   size_t minIdle, size_t maxIdle);
+    // Spawns min_idle workers per pool; only called in webserv workers,
+    // since the master process never serves requests
+    void warmUp();
+    // Replaces workers leased since the last call, off the request path
+    void refill();
+
+    int acquire(const std::string &key, bool &connecting);
+    void responded(const std::string &key);
+    void release(const std::string &key, int fd, bool reusable);
+    void clear();
+
+private:
+    struct Worker
+    {
+        int fd;
+        pid_t pid;
+    };
+
+    struct Pool
+    {
+        std::string interpreter;
+        std::string worker;
+        size_t minIdle;
+        size_t maxIdle;
+        std::vector<Worker> idle;
+
+        Pool() : minIdle(0), maxIdle(0) {}
+    };
+
+    std::map<std::string, Pool> pools;
+    std::map<int, pid_t> leased;  // Socket of each busy worker to its process
+    std::vector<pid_t> exiting;   // Retired workers not reaped yet
+    bool depleted;                // A pool fell below min_idle
+
+    bool spawn(const Pool &pool, Worker &worker);
+    void fill(Pool &pool);
+    void retire(const Worker &worker, bool force);
+    void reap();
+
+    CgiWorkerPool(const CgiWorkerPool &other);
+    CgiWorkerPool &operator=(const CgiWorkerPool &other);
+};
+
+#endif
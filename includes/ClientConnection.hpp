@@ -1,5 +1,7 @@
 #pragma once
 
+#include <sys/types.h>
+
 #include <ctime>
 #include <string>
 
@@ -7,6 +9,7 @@
 #include "HttpResponse.hpp"
 #include "RequestHandler.hpp"
 #include "AsyncOperation.hpp"
+#include "TimerWheel.hpp"
 
 // Connection state machine
 enum ConnectionState {
@@ -38,6 +41,17 @@ struct RequestContext {
 class ClientConnection
 {
    public:
+    // Which timeout limits the connection in its current state
+    enum TimeoutPhase
+    {
+        TIMEOUT_NONE,
+        TIMEOUT_HEADER,
+        TIMEOUT_BODY,
+        TIMEOUT_SEND,
+        TIMEOUT_KEEPALIVE,
+        TIMEOUT_CGI
+    };
+
     ClientConnection(int socketFd, const struct sockaddr_in &clientAddr, RequestHandler &handler);
     ~ClientConnection();
 
@@ -48,6 +62,8 @@ class ClientConnection
     bool isConnected() const;
     void setServerFd(int serverFd);
     int getServerFd() const;
+    void setEdgeTriggered(bool edgeTriggered);
+    void setMaxRequests(int maxRequests);
 
     // Request/Response handling
     bool hasCompleteRequest() const;
@@ -57,12 +73,20 @@ class ClientConnection
     // Connection state
     bool isKeepAlive() const;
     void setKeepAlive(bool keepAlive);
+    void startNextRequest();
     bool isReadyToWrite() const;
     bool isReadyToRead() const;
+    // The last writeData() stopped on its stream budget with the socket
+    // still writable
+    bool hasYieldedWrite() const;
 
     // Timeout management
     void updateLastActivity();
     bool isTimedOut(int timeoutSeconds) const;
+    TimeoutPhase getTimeoutPhase() const;
+    TimeoutPhase getArmedPhase() const;
+    void setArmedPhase(TimeoutPhase phase);
+    TimerWheel::Timer &getTimer();
 
     // Socket operations
     int getSocketFd() const;
@@ -81,8 +105,10 @@ class ClientConnection
     // Async operation support
     void setPendingOperation(AsyncOperation* operation);
     void completePendingOperation();
+    void pumpPendingOperation();
     bool hasPendingOperation() const;
     AsyncOperation* getPendingOperation() const;
+    void abortPendingOperation(int statusCode);
     
     // State queries for event loop
     bool canRead() const;
@@ -97,23 +123,64 @@ class ClientConnection
     std::string readBuffer;
     std::string writeBuffer;
 
+    // File-backed response body, streamed with sendfile() after writeBuffer
+    int bodyFileFd;
+    off_t bodyFileOffset;
+    size_t bodyFileRemaining;
+
+    // Streamed response body, pulled into writeBuffer as the socket drains
+    BodyStream *bodyStream;
+    bool bodyChunked;
+    std::string streamBuffer;
+    bool streamLengthKnown;   // Content-Length given by the producer
+    size_t streamRemaining;
+
+    // Chunk of a streamed body still in the producer's pipe, moved to the
+    // socket with splice(); the pipe belongs to the operation
+    int bodyPipeFd;
+    size_t bodyPipeRemaining;
+
+    // Operation whose output is being streamed; it may outlive
+    // context.pendingOperation while its buffered output drains
+    AsyncOperation *streamedOperation;
+
     RequestContext context;  // Contains request, response, and state
     RequestHandler &handleRequest;
 
     bool connected;
     bool keepAlive;
+    bool edgeTriggered;
+    int maxRequests;      // Responses allowed on this connection; 0 disables keep-alive
+    int requestsServed;
     time_t lastActivity;
+    TimerWheel::Timer timer;
+    TimeoutPhase armedPhase;
 
     size_t bytesRead;
     size_t bytesWritten;
+    size_t readOffset;   // Start of the bytes in readBuffer not parsed yet
     size_t writeOffset;
+    bool writeYielded;
 
     static const size_t MAX_BUFFER_SIZE = 8192;
+    static const size_t SENDFILE_CHUNK_SIZE = 524288;
+    static const size_t STREAM_CHUNK_SIZE = 16384;
+    // Stream reads (each one bounded, compression included) per writeData,
+    // as in level-triggered mode, so in edge-triggered mode a fast reader
+    // cannot keep the loop compressing for it alone
+    static const size_t MAX_STREAM_PULLS_PER_WRITE = 1;
+    // Unparsed input held while a response is in flight
+    static const size_t MAX_PIPELINED_BYTES = 32768;  // One full header block
 
     // Helper methods
     bool processReadBuffer();
+    void queueResponse();
+    bool shouldKeepAlive() const;
+    void closeBodyFile();
+    bool pullBodyStream();
+    void closeBodyStream();
+    bool hasPendingOutput() const;
     void serveStaticFile(const std::string &requestPath);
     std::string getContentType(const std::string &filePath);
     void serve404();
-    void parseCgiOutput(const std::string& output);  // Parse CGI output into headers/body
 };
@@ -0,0 +1,76 @@
+#ifndef COMPRESSEDBODYSTREAM_HPP
+#define COMPRESSEDBODYSTREAM_HPP
+
+#include <sys/types.h>
+
+#include <string>
+
+#include <brotli/encode.h>
+#include <zlib.h>
+
+#include "BodyStream.hpp"
+
+// Response body compressed with gzip or brotli while it is sent. Each read()
+// compresses at most one chunk of input, so a large body is spread over many
+// socket writes instead of holding up the event loop. The input is another
+// stream, a range of an open file or a string.
+class CompressedBodyStream : public BodyStream
+{
+public:
+    enum Coding
+    {
+        GZIP,
+        BROTLI
+    };
+
+    // Each constructor takes ownership of source / fd
+    CompressedBodyStream(Coding coding, int level, BodyStream *source);
+    CompressedBodyStream(Coding coding, int level, int fd, off_t offset, size_t length);
+    CompressedBodyStream(Coding coding, int level, const std::string &body);
+    ~CompressedBodyStream();
+
+    bool read(std::string &out, size_t maxBytes);
+    bool isFinished() const;
+    bool isReady() const;
+
+    // Content-Encoding token of a coding
+    static const char *codingName(Coding coding);
+    // Whether an Accept-Encoding value allows the coding (q=0 refuses it)
+    static bool accepts(const std::string &acceptEncoding, Coding coding);
+    // Compresses a whole body at once; false if the encoder fails
+    static bool compress(Coding coding, int level, const std::string &body, std::string &out);
+
+private:
+    enum Flush
+    {
+        FLUSH_NONE,
+        FLUSH_SYNC,  // Everything so far goes out; the stream stays open
+        FLUSH_FINISH
+    };
+
+    Coding coding;
+    z_stream zstream;
+    BrotliEncoderState *brotli;
+    bool initialized;
+    bool finished;
+    bool unflushed;  // Input went in since the last flush
+
+    BodyStream *source;
+    int fd;
+    off_t offset;
+    size_t remaining;
+    std::string body;
+    size_t bodyOffset;
+    std::string input;
+
+    static const size_t INPUT_CHUNK_SIZE = 65536;
+
+    void init(int level);
+    bool readInput(size_t maxBytes, bool &sourceDone);
+    bool encode(const char *data, size_t length, Flush flush, std::string &out);
+
+    CompressedBodyStream(const CompressedBodyStream &other);
+    CompressedBodyStream &operator=(const CompressedBodyStream &other);
+};
+
+#endif
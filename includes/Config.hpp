@@ -5,6 +5,8 @@
 #include <string>
 #include <vector>
 
+#include "LocationIndex.hpp"
+
 class Config
 {
    public:
@@ -32,8 +34,15 @@ class Config
         std::string root;
         std::string index;
         bool autoindex;
+        std::string autoindexFormat;  // "html" or "json"; empty inherits the server's
         size_t clientMaxBodySize;
+        size_t clientBodyBufferSize;
         std::string cgiPass;
+        std::string cgiWorker;    // Script the cgi_pass interpreter runs as a pooled worker
+        size_t cgiPoolMinIdle;    // Warm workers kept ready per webserv worker
+        size_t cgiPoolMaxIdle;    // 0 when cgi_pool is off
+        std::string fastcgiPass;  // "unix:/path" or "host:port"
+        size_t cgiCacheSize;      // Bytes of CGI responses kept per webserv worker; 0 when off
         std::string returnUrl;
         std::vector<ErrorPageConfig> errorPages;
     };
@@ -51,18 +60,56 @@ class Config
         std::string index;
         std::set<std::string> allowedMethods;
         bool autoindex;
+        std::string autoindexFormat;  // "html" or "json"
         size_t clientMaxBodySize;
+        size_t clientBodyBufferSize;
         std::vector<ErrorPageConfig> errorPages;
+        LocationIndex locationIndex;
     };
 
+    // Raw directives from the main (top-level) context
+    std::map<std::string, std::vector<std::string> > directives;
     std::vector<ServerConfig> servers;
 
+    // Parsed/validated main context data
+    int workerProcesses;
+    bool edgeTriggered;
+    size_t openFileCacheMax;  // 0 disables the cache
+    int openFileCacheValid;   // Seconds before a cached entry is re-stat'ed
+
+    // Connection timeouts in seconds; 0 disables the corresponding timer
+    int clientHeaderTimeout;  // Whole request line + headers
+    int clientBodyTimeout;    // Between two reads of the body
+    int sendTimeout;          // Between two writes of the response
+    int keepaliveTimeout;     // Idle time between requests
+    int cgiTimeout;           // Whole CGI run
+
+    // Requests served on one connection before it is closed; 0 disables keep-alive
+    int keepaliveRequests;
+
+    // Idle connections kept per fastcgi_pass address in each worker; 0 closes
+    // them after every request. A parked connection occupies an application
+    // worker, so this times worker_processes should stay below the size of
+    // the application's pool.
+    int fastcgiKeepalive;
+
+    // Response compression: gzip and brotli compress matching bodies on the
+    // fly, gzip_static sends prebuilt .br/.gz siblings of static files
+    bool gzip;
+    bool brotli;
+    bool gzipStatic;
+    std::set<std::string> gzipTypes;  // MIME types without parameters; "*" matches all
+    int gzipCompLevel;                // 1-9
+    int brotliCompLevel;              // 0-11
+    size_t gzipMinLength;             // Smaller bodies of known length are sent as is
+
     Config();
     ~Config();
 
     void validateAndParseConfig();
 
    private:
+    void parseGlobalConfig();
     void parseServerConfig(ServerConfig &server);
     void parseLocationConfig(LocationConfig &location);
 
@@ -79,12 +126,23 @@ class Config
     void validateAutoindexValue(const std::string &value);
     void validateReturnValue(const std::string &value);
     void validateCgiPath(const std::string &path);
+    void validateFastCgiAddress(const std::string &address);
+    void validateWorkerProcesses(const std::string &value);
+    void validateOnOffValue(const std::string &directive, const std::string &value);
+    void validateOpenFileCache(const std::vector<std::string> &values);
+    void validateSeconds(const std::string &directive, const std::string &value);
+    void validateNumber(const std::string &directive, const std::string &value, long min, long max);
 
     // Helper parsing methods
     ListenConfig parseListenDirective(const std::string &value);
     std::set<std::string> parseMethodsDirective(const std::vector<std::string> &values);
     size_t parseClientSizeDirective(const std::string &value);
     bool parseAutoindexDirective(const std::string &value);
+    bool parseOnOffDirective(const std::string &directive, const std::string &value);
+    int parseWorkerProcessesDirective(const std::string &value);
+    void parseOpenFileCacheDirective(const std::vector<std::string> &values);
+    int parseSecondsDirective(const std::string &value);
+    long parseNumberDirective(const std::string &value);
     std::vector<ErrorPageConfig> parseErrorPageDirective(const std::vector<std::string> &values);
 
     // Validation helpers
@@ -0,0 +1,136 @@
+#ifndef DIRECTORYLISTING_HPP
+#define DIRECTORYLISTING_HPP
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BodyStream.hpp"
+
+// Entries of a directory (name, kind and size) as read at one point in
+// time. Shared by the cache and every stream sending it, so it is
+// reference counted: whoever holds a pointer has retained it.
+class DirectoryListing
+{
+public:
+    struct Entry
+    {
+        std::string name;
+        bool isDirectory;
+        off_t size;
+    };
+
+    explicit DirectoryListing(const struct stat &dirStat);
+
+    void retain();
+    void release();
+
+    // Complete and read after the directory's last change. A change in the
+    // second the listing was started may have been missed, so such a
+    // listing is never reused.
+    bool isCurrent(const struct stat &dirStat) const;
+    void add(const Entry &entry);
+    void markComplete();
+    const std::vector<Entry> &getEntries() const;
+
+private:
+    std::vector<Entry> entries;
+    dev_t device;
+    ino_t inode;
+    struct timespec mtime;
+    time_t startedAt;
+    bool complete;
+    int references;
+
+    ~DirectoryListing();
+
+    DirectoryListing(const DirectoryListing &other);
+    DirectoryListing &operator=(const DirectoryListing &other);
+};
+
+// Listings of recently served directories, keyed by path. A directory's
+// mtime changes with every entry added, removed or renamed, so one stat()
+// tells whether its listing still holds; sizes of files changed in place
+// are only picked up with the next change to the directory itself.
+class DirectoryListingCache
+{
+public:
+    DirectoryListingCache();
+    ~DirectoryListingCache();
+
+    // A current listing, retained for the caller, or NULL
+    DirectoryListing *lookup(const std::string &path, const struct stat &dirStat);
+    // Keeps listing (which may still be filling) in place of any older one
+    void store(const std::string &path, DirectoryListing *listing);
+    void clear();
+
+private:
+    typedef std::list<std::pair<std::string, DirectoryListing *> > EntryList;
+
+    EntryList entries;  // Most recently used first
+    std::map<std::string, EntryList::iterator> index;
+
+    static const size_t MAX_DIRECTORIES = 64;
+
+    void evict(std::map<std::string, EntryList::iterator>::iterator it);
+
+    DirectoryListingCache(const DirectoryListingCache &other);
+    DirectoryListingCache &operator=(const DirectoryListingCache &other);
+};
+
+// Autoindex page (HTML, or JSON for autoindex_format json) sent a page of
+// entries at a time. A cached listing is replayed as is; otherwise entries
+// are read from the directory only as the socket drains, so a huge
+// directory neither delays the first byte nor stalls other connections,
+// and are recorded into a new listing for the requests after this one.
+class DirectoryListingStream : public BodyStream
+{
+public:
+    enum Format
+    {
+        FORMAT_HTML,
+        FORMAT_JSON
+    };
+
+    // Replays listing, which the stream retains
+    DirectoryListingStream(const std::string &dirPath, Format format, DirectoryListing *listing);
+    // Reads dir (which the stream takes ownership of) into listing
+    DirectoryListingStream(const std::string &dirPath, Format format, DirectoryListing *listing, DIR *dir);
+    ~DirectoryListingStream();
+
+    bool read(std::string &out, size_t maxBytes);
+    bool isFinished() const;
+
+private:
+    enum Stage
+    {
+        STAGE_HEADER,
+        STAGE_ENTRIES,
+        STAGE_DONE
+    };
+
+    std::string dirPath;
+    Format format;
+    DirectoryListing *listing;
+    DIR *dir;
+    size_t next;  // Next entry of a replayed listing
+    size_t sent;  // Entries written so far
+    Stage stage;
+
+    bool readEntry(DirectoryListing::Entry &entry);
+    void appendHeader(std::string &out) const;
+    void appendEntry(std::string &out, const DirectoryListing::Entry &entry);
+    void appendFooter(std::string &out) const;
+    static void appendJsonString(std::string &out, const std::string &value);
+
+    DirectoryListingStream(const DirectoryListingStream &other);
+    DirectoryListingStream &operator=(const DirectoryListingStream &other);
+};
+
+#endif
@@ -3,6 +3,10 @@
 #include <stdint.h>
 #include <sys/epoll.h>
 
+#include <vector>
+
+#include "TimerWheel.hpp"
+
 class EventLoop
 {
    public:
@@ -16,8 +20,21 @@ class EventLoop
     bool remove(int fd);
     bool modify(int fd, uint32_t events);
 
+    // In edge-triggered mode every registration carries EPOLLET and callers
+    // must drain their fds until EAGAIN.
+    void setEdgeTriggered(bool enabled);
+    bool isEdgeTriggered() const;
+
+    // Second-resolution timers driven by the monotonic clock
+    void addTimer(TimerWheel::Timer &timer, int seconds);
+    void expireTimers(std::vector<TimerWheel::Timer *> &expired);
+
    private:
     int epollFd;
     bool isInitialized;
+    bool edgeTriggered;
+    TimerWheel timers;
     static const int MAX_EVENTS = 64;
+
+    static unsigned long monotonicSeconds();
 };
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef FASTCGIOPERATION_HPP
+#define FASTCGIOPERATION_HPP
+
+#include <string>
+#include <vector>
+
+#include "AsyncOperation.hpp"
+#include "HttpRequest.hpp"
+#include "UpstreamPool.hpp"
+
+// One request to a FastCGI responder over a pooled connection, either to a
+// fastcgi_pass application or to a cgi_pool worker. The request
+// (FCGI_BEGIN_REQUEST, FCGI_PARAMS, FCGI_STDIN) is written as the socket
+// accepts it; FCGI_STDOUT content becomes the output, which the connection
+// parses like CGI output. After FCGI_END_REQUEST the connection goes back
+// to the pool.
+class FastCgiOperation : public AsyncOperation
+{
+public:
+    FastCgiOperation(UpstreamPool &pool, const std::string &address,
+                     const std::vector<std::string> &params, const HttpRequest &request);
+    virtual ~FastCgiOperation();
+
+    bool isComplete() const;
+    std::string getResult() const;
+    int getMonitorFd() const;
+    void handleData();
+    std::string &getOutput();
+    bool hasOutputRoom() const;
+    bool needsWrite() const;
+    bool hasError() const;
+    std::string getError() const;
+    void cleanup();
+
+private:
+    UpstreamPool &pool;
+    std::string address;
+    int socketFd;
+    bool connecting;
+    bool awaitingResponse;  // Counted as waiting by the pool
+
+    bool completed;
+    bool error;
+    bool ended;  // FCGI_END_REQUEST received
+    std::string errorMessage;
+
+    std::string outgoing;  // Encoded records not yet written
+    size_t outgoingOffset;
+    int bodyFd;            // Spooled request body, sent as it is read
+    std::string incoming;  // Received bytes not yet forming a whole record
+    std::string result;
+
+    static const size_t BUFFER_SIZE = 16384;
+    static const size_t OUTPUT_BUFFER_LIMIT = 65536;
+    static const size_t MAX_RECORD_CONTENT = 65535;
+    char readBuffer[BUFFER_SIZE];
+
+    void appendRecord(unsigned char type, const char *content, size_t length);
+    void appendStream(unsigned char type, const std::string &content);
+    void appendParams(const std::vector<std::string> &params);
+    bool refillOutgoing();
+    bool flushOutgoing();
+    void readFromApplication();
+    void parseRecords();
+    void fail(const std::string &message);
+
+    FastCgiOperation(const FastCgiOperation &other);
+    FastCgiOperation &operator=(const FastCgiOperation &other);
+};
+
+#endif
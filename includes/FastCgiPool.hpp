@@ -0,0 +1,55 @@
+#ifndef FASTCGIPOOL_HPP
+#define FASTCGIPOOL_HPP
+
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "UpstreamPool.hpp"
+
+// Persistent connections to FastCGI applications, keyed by the fastcgi_pass
+// address ("unix:/path" or "host:port"). A connection carries one request
+// at a time; between requests it is parked here instead of being closed, so
+// a request normally costs no connect and no interpreter startup.
+class FastCgiPool : public UpstreamPool
+{
+public:
+    FastCgiPool();
+    virtual ~FastCgiPool();
+
+    void configure(size_t maxIdle);
+
+    // The lease counts as waiting until responded() is called for it
+    int acquire(const std::string &address, bool &connecting);
+    void responded(const std::string &address);
+    void release(const std::string &address, int fd, bool reusable);
+    void clear();
+
+    // True while a parked socket has nothing readable: no EOF, no error
+    static bool isAlive(int fd);
+
+private:
+    struct Upstream
+    {
+        struct sockaddr_storage addr;
+        socklen_t addrLength;
+        bool resolved;
+        std::vector<int> idle;
+        size_t waiting;  // Leases with no response yet, possibly queued behind parked ones
+
+        Upstream() : addrLength(0), resolved(false), waiting(0) {}
+    };
+
+    std::map<std::string, Upstream> upstreams;
+    size_t maxIdle;
+
+    static bool resolve(const std::string &address, Upstream &upstream);
+    static int connectTo(const Upstream &upstream, bool &connecting);
+
+    FastCgiPool(const FastCgiPool &other);
+    FastCgiPool &operator=(const FastCgiPool &other);
+};
+
+#endif
@@ -1,28 +1,55 @@
 #pragma once
 
-#include <map>
 #include <string>
 #include <vector>
 
 class HttpRequest
 {
        public:
+	enum ParseState
+	{
+		PARSE_REQUEST_LINE,
+		PARSE_HEADERS,
+		PARSE_BODY,
+		PARSE_COMPLETE,
+		PARSE_ERROR
+	};
+
 	HttpRequest();
 	~HttpRequest();
 
 	// Request parsing
-	bool parseRequest(const std::string &rawRequest);
+	size_t feed(const char *data, size_t length);
 	bool isComplete() const;
+	bool hasError() const;
+	int getErrorCode() const;
+	ParseState getParseState() const;
 	void reset();
 
+	// Body setup, required once the headers are parsed and before the body
+	// is consumed: rejects bodies over maxBodySize and spools bodies larger
+	// than spoolThreshold to a temporary file instead of keeping them in memory
+	bool needsBodySetup() const;
+	void setupBody(size_t maxBodySize, size_t spoolThreshold);
+
 	// Getters
 	const std::string &getMethod() const;
 	const std::string &getUri() const;
 	const std::string &getVersion() const;
 	const std::string &getQuery() const;
-	const std::map<std::string, std::string> &getHeaders() const;
+	size_t getHeaderCount() const;
+	std::string getHeaderName(size_t index) const;
+	std::string getHeaderValue(size_t index) const;
 	const std::string &getBody() const;
 
+	// Spooled body access
+	bool isBodySpooled() const;
+	const std::string &getBodyFilePath() const;
+	size_t getBodySize() const;
+	std::string readBody() const;
+	std::string releaseBodyFile();
+	bool moveBodyFile(const std::string &path);
+
 	// Header operations
 	std::string getHeader(const std::string &name) const;
 	bool hasHeader(const std::string &name) const;
@@ -41,17 +68,72 @@ class HttpRequest
 	std::string uri;
 	std::string version;
 	std::string query;
-	std::map<std::string, std::string> headers;
 	std::string body;
 
+	// Per-request arena: lowercased names and values are packed into one
+	// buffer and fields only hold offsets, so reset() is two clear() calls
+	// and the storage is reused by the next request on the connection.
+	struct HeaderField
+	{
+		size_t nameOffset;
+		size_t nameLength;
+		size_t valueOffset;
+		size_t valueLength;
+	};
+
+	std::string headerArena;
+	std::vector<HeaderField> headerFields;
+
 	bool requestComplete;
 	bool headersParsed;
 
+	// Incremental parser state, kept between feed() calls
+	ParseState parseState;
+	std::string lineBuffer;
+	size_t headerBytes;
+	size_t bodyRemaining;
+	int errorCode;
+	bool bodySetupDone;
+
+	// Transfer-Encoding: chunked decoding; bodyRemaining is then the rest
+	// of the current chunk
+	enum ChunkState
+	{
+		CHUNK_SIZE,
+		CHUNK_DATA,
+		CHUNK_DATA_END,
+		CHUNK_TRAILER
+	};
+
+	bool chunkedBody;
+	ChunkState chunkState;
+	size_t bodyLimit;
+	size_t bodySpoolThreshold;
+
+	// Body spooled to disk (bodyFd >= 0)
+	int bodyFd;
+	std::string bodyFilePath;
+	size_t bodySize;
+
+	static const size_t MAX_HEADER_SIZE = 32768;
+	static const size_t MAX_CHUNK_LINE_SIZE = 4096;
+
+	// Owns the spool file, so copying is not allowed
+	HttpRequest(const HttpRequest &other);
+	HttpRequest &operator=(const HttpRequest &other);
+
 	// Parsing helpers
-	bool parseRequestLine(const std::string &rawRequest);
-	bool parseHeaders(const std::string &rawRequest);
-	bool parseBody(const std::string &rawRequest);
+	bool parseLine(const std::string &line);
+	bool parseRequestLine(const std::string &line);
+	bool finishHeaders();
+	size_t feedChunked(const char *data, size_t length);
+	bool parseChunkLine(const std::string &line);
+	bool appendBody(const char *data, size_t length);
+	bool startSpool();
+	bool writeSpool(const char *data, size_t length);
+	void discardBodyFile();
 	bool parseHeader(const std::string &line);
+	static bool parseContentLength(const std::string &value, size_t &length);
 	void parseUri(const std::string &fullUri);
-	std::string toLower(const std::string &str) const;
+	int findHeader(const char *name, size_t length) const;
 };
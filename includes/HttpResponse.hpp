@@ -2,16 +2,52 @@
 #define HTTPRESPONSE_HPP
 
 #include <string>
-#include <map>
+#include <vector>
+#include <utility>
+#include <sys/types.h>
+
+#include "BodyStream.hpp"
 
 class HttpResponse
 {
 private:
+    // Headers set on nearly every response get a fixed slot; anything else
+    // (CGI output, mostly) goes to extraHeaders in insertion order.
+    enum HeaderSlot
+    {
+        HEADER_SERVER,
+        HEADER_CONNECTION,
+        HEADER_CONTENT_TYPE,
+        HEADER_LOCATION,
+        HEADER_LAST_MODIFIED,
+        HEADER_ETAG,
+        HEADER_SLOT_COUNT
+    };
+
+    static const char *const slotNames[HEADER_SLOT_COUNT];
+
     int statusCode;
     std::string statusMessage;
-    std::map<std::string, std::string> headers;
+    std::string slotValues[HEADER_SLOT_COUNT];
+    bool slotSet[HEADER_SLOT_COUNT];
+    size_t contentLength;
+    bool hasContentLength;
+    std::vector<std::pair<std::string, std::string> > extraHeaders;
     std::string body;
 
+    // File-backed body: sent with sendfile() instead of being buffered
+    int bodyFd;
+    off_t bodyOffset;
+    size_t bodyLength;
+
+    // Streamed body of unknown length, sent chunked (or close-delimited)
+    BodyStream *bodyStream;
+    bool chunked;
+
+    // Owns bodyFd and bodyStream, so copying is not allowed
+    HttpResponse(const HttpResponse &other);
+    HttpResponse &operator=(const HttpResponse &other);
+
 public:
     static std::string serverName;
 
@@ -36,7 +72,31 @@ public:
     void clearBody();
     const std::string& getBody() const;
 
+    // File-backed body methods (the response takes ownership of fd)
+    void setBodyFile(int fd, off_t offset, size_t length);
+    bool hasBodyFile() const;
+    int releaseBodyFile(off_t &offset, size_t &length);
+    void closeBodyFile();
+
+    // Streamed body methods (the response takes ownership of stream)
+    void setBodyStream(BodyStream *stream);
+    bool hasBodyStream() const;
+    BodyStream *releaseBodyStream();
+    void setChunked(bool chunked);
+    bool isChunked() const;
+
+    // Chunked transfer coding framing
+    static void appendChunk(std::string &out, const char *data, size_t length);
+    static void appendChunkHeader(std::string &out, size_t length);
+    static void appendLastChunk(std::string &out);
+
+    // CGI output: a header block (Status and other fields) and the body
+    static size_t findCgiHeaderEnd(const std::string &output);
+    void setCgiHeaders(const std::string &headers);
+    void setCgiOutput(const std::string &output);
+
     // Utility methods
+    void serializeHeaders(std::string &out) const;
     std::string toString() const;
     void reset();
     bool isReady() const;
@@ -53,6 +113,9 @@ public:
 
 private:
     std::string getContentTypeFromPath(const std::string &filePath) const;
+    static int findSlot(const std::string &name);
+    void setContentLength(size_t length);
+    void discardBodyStream();
 };
 
 // Utility function for logging responses
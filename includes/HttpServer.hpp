@@ -1,11 +1,16 @@
 #pragma once
 
-#include <map>
+#include <sys/types.h>
+
+#include <csignal>
+#include <ctime>
+#include <vector>
 
 #include "ClientConnection.hpp"
 #include "Config.hpp"
 #include "EventLoop.hpp"
 #include "RequestHandler.hpp"
+#include "SlabPool.hpp"
 #include "SocketManager.hpp"
 
 class HttpServer
@@ -16,6 +21,7 @@ class HttpServer
 
     void run();
     void stop();
+    void reload();
 
    private:
     Config config;
@@ -24,21 +30,71 @@ class HttpServer
     RequestHandler requestHandler;
 
     bool running;
+    bool isMaster;
+    volatile bool workersSignaled;
+    volatile sig_atomic_t reloadRequested;
+
+    // Everything registered with the event loop, indexed directly by fd so
+    // event dispatch never searches. CGI entries point at the owning client.
+    enum FdType
+    {
+        FD_NONE,
+        FD_LISTENER,
+        FD_CLIENT,
+        FD_CGI
+    };
+
+    struct FdEntry
+    {
+        FdType type;
+        ClientConnection *conn;
+        bool paused;   // CGI pipe taken out of epoll while its output backs up
+        bool writing;  // CGI fd also polled for EPOLLOUT (FastCGI request being sent)
+
+        FdEntry() : type(FD_NONE), conn(NULL), paused(false), writing(false) {}
+    };
+
+    std::vector<FdEntry> fdTable;
+    SlabPool connectionPool;  // Backing store for every ClientConnection
+    std::vector<TimerWheel::Timer *> expiredTimers;
 
-    std::map<int, ClientConnection *> connections;
-    std::map<int, ClientConnection *> cgiConnections;
+    // Master process bookkeeping (worker_processes > 1)
+    std::vector<pid_t> workerPids;
+    std::vector<time_t> workerStartTimes;
+
+    static const int WORKER_STARTUP_GRACE = 2;
+    static const size_t CONNECTION_SLAB_SIZE = 256;
 
     bool initializeServers();
 
+    void runMaster();
+    void runWorker();
+    pid_t spawnWorker(size_t slot);
+    void signalWorkers();
+    void stopWorkers();
+
     void handleNewConnection(int serverFd);
     void handleClientRead(int clientFd);
     void handleClientWrite(int clientFd);
     void handleClientError(int clientFd);
     void handleCgiRead(int cgiFd);
     void handleCgiError(int cgiFd);
+    void scheduleConnection(ClientConnection *conn);
+    void serviceCgi(ClientConnection *conn, bool hangup);
+    void resumeCgi(ClientConnection *conn);
+    static uint32_t cgiEvents(const AsyncOperation *op);
+    static uint32_t clientEvents(const ClientConnection *conn, bool writing);
 
     void closeConnection(int clientFd);
-    bool isServerSocket(int fd) const;
-    bool isCgiSocket(int fd) const;
+    ClientConnection *createConnection(int clientFd, const struct sockaddr_in &clientAddr);
+    void destroyConnection(ClientConnection *conn);
+
+    void registerFd(int fd, FdType type, ClientConnection *conn);
+    void unregisterFd(int fd);
+    const FdEntry &lookupFd(int fd) const;
+
+    void updateTimer(ClientConnection *conn);
+    int getTimeout(ClientConnection::TimeoutPhase phase) const;
+    void handleTimeouts();
 
 };
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Location matcher compiled once per server block. Prefix locations live in
+// a trie walked along the URI; suffix locations ("*.py") live in a second
+// trie walked backwards from the end of the URI. A match scores the length
+// of the location path, the longest one wins and ties go to the location
+// declared first, exactly like the linear scan it replaces.
+class LocationIndex
+{
+   public:
+        LocationIndex();
+
+        void clear();
+        void add(const std::string &locationPath, size_t locationIndex);
+
+        // Index of the best matching location, or -1 if none matches
+        int match(const std::string &uri) const;
+
+   private:
+        struct Node
+        {
+                std::map<char, size_t> children;
+                int location;
+
+                Node() : location(-1) {}
+        };
+
+        std::vector<Node> prefixNodes;
+        std::vector<Node> suffixNodes;
+
+        static void insert(std::vector<Node> &nodes, const std::string &key, bool reversed, size_t locationIndex);
+        static void consider(int candidate, size_t score, int &best, size_t &bestScore);
+};
@@ -0,0 +1,54 @@
+#ifndef MULTIPARTPARSER_HPP
+#define MULTIPARTPARSER_HPP
+
+#include <string>
+#include <vector>
+
+// Streaming multipart/form-data parser. Data can be fed in arbitrary chunks;
+// every part that carries a filename is written straight to uploadDir, so
+// memory use is bounded by the chunk size rather than by the body size.
+class MultipartParser
+{
+public:
+    MultipartParser(const std::string &boundary, const std::string &uploadDir,
+                    const std::string &fallbackName);
+    ~MultipartParser();
+
+    bool feed(const char *data, size_t length);
+    bool finish();
+
+    bool hasError() const;
+    const std::vector<std::string> &getSavedFiles() const;
+
+private:
+    enum State
+    {
+        PREAMBLE,
+        AFTER_BOUNDARY,
+        PART_HEADERS,
+        PART_BODY,
+        EPILOGUE,
+        FAILED
+    };
+
+    State state;
+    std::string delimiter;
+    std::string uploadDir;
+    std::string fallbackName;
+    std::string buffer;
+    int outputFd;
+    std::vector<std::string> savedFiles;
+
+    static const size_t MAX_PART_HEADER_SIZE = 8192;
+
+    bool process();
+    bool startPart(const std::string &headers);
+    bool writePartData(const char *data, size_t length);
+    void endPart();
+    std::string extractFilename(const std::string &headers) const;
+
+    MultipartParser(const MultipartParser &other);
+    MultipartParser &operator=(const MultipartParser &other);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef OPENFILECACHE_HPP
+#define OPENFILECACHE_HPP
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+
+// Bounded LRU cache of open descriptors and metadata for static files,
+// keyed by resolved path. Entries younger than the validity period are
+// returned without touching the filesystem; older ones are re-stat'ed.
+class OpenFileCache
+{
+public:
+    typedef std::string (*MimeResolver)(const std::string &path);
+
+    struct Entry
+    {
+        std::string path;
+        int fd;  // -1 for directories
+        bool isDirectory;
+        off_t size;
+        time_t mtime;
+        ino_t inode;
+        std::string mimeType;
+        std::string etag;
+        std::string lastModified;
+        time_t validatedAt;
+    };
+
+    OpenFileCache(MimeResolver mimeResolver);
+    ~OpenFileCache();
+
+    void configure(size_t maxEntries, int validSeconds);
+    bool isEnabled() const;
+
+    const Entry *lookup(const std::string &path);
+    void clear();
+
+    // Validators shared with uncached responses
+    static std::string makeETag(const struct stat &fileStat);
+    static std::string makeHttpDate(time_t when);
+    // Inverse of makeHttpDate; -1 for anything else
+    static time_t parseHttpDate(const std::string &date);
+
+private:
+    typedef std::list<Entry> EntryList;
+
+    EntryList entries;  // Most recently used first
+    std::map<std::string, EntryList::iterator> index;
+    MimeResolver mimeResolver;
+    size_t maxEntries;
+    int validSeconds;
+
+    bool load(Entry &entry, const struct stat &fileStat);
+    void release(Entry &entry);
+    void evict(std::map<std::string, EntryList::iterator>::iterator it);
+
+    OpenFileCache(const OpenFileCache &other);
+    OpenFileCache &operator=(const OpenFileCache &other);
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef OPERATIONBODYSTREAM_HPP
+#define OPERATIONBODYSTREAM_HPP
+
+#include "AsyncOperation.hpp"
+#include "BodyStream.hpp"
+
+// Forwards the output of a running AsyncOperation (a CGI script, say) as a
+// response body. The operation is owned by the connection, not the stream.
+class OperationBodyStream : public BodyStream
+{
+public:
+    explicit OperationBodyStream(AsyncOperation &operation);
+
+    bool read(std::string &out, size_t maxBytes);
+    bool isFinished() const;
+    bool isReady() const;
+    int getSplicePipe(size_t &available);
+
+private:
+    AsyncOperation &operation;
+    int spliceFd;  // The operation's output pipe once it has been handed over
+
+    size_t pipeBytes() const;
+
+    OperationBodyStream(const OperationBodyStream &other);
+    OperationBodyStream &operator=(const OperationBodyStream &other);
+};
+
+#endif
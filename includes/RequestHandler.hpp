@@ -3,9 +3,16 @@
 
 #include <string>
 #include <ctime>
+#include <map>
+#include "ByteRangesStream.hpp"
+#include "CgiResponseCache.hpp"
+#include "CgiWorkerPool.hpp"
 #include "Config.hpp"
+#include "DirectoryListing.hpp"
+#include "FastCgiPool.hpp"
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
+#include "OpenFileCache.hpp"
 #include "SocketManager.hpp"
 
 // Forward declaration to avoid circular dependency
@@ -21,9 +28,50 @@ public:
     
     void generateErrorPage(int errorCode, HttpResponse &response, int serverFd);
 
+    // Body limits for a request whose headers have been parsed
+    void getBodyLimits(const HttpRequest &request, int serverFd,
+                       size_t &maxBodySize, size_t &bufferSize) const;
+
+    // Re-reads error pages, drops cached file metadata, directory listings
+    // and CGI responses and restarts idle cgi_pool workers (SIGHUP)
+    void reloadCaches();
+
+    // Starts the cgi_pool workers of the calling worker process
+    void startCgiWorkers();
+    // Replaces the cgi_pool workers handed out to requests
+    void refillCgiWorkers();
+
+    // Applies gzip/brotli to a finished response the client accepts it for
+    void compressResponse(const HttpRequest &request, HttpResponse &response) const;
+
 private:
+    // Larger in-memory bodies are compressed a chunk at a time as they are sent
+    static const size_t INLINE_COMPRESS_MAX = 65536;
+    // More ranges than this in one request are answered with the whole file
+    static const size_t MAX_RANGES = 64;
+
+    struct CachedErrorPage
+    {
+        std::string body;
+        std::string contentType;
+    };
+
     const Config &config;
     SocketManager &socketManager;
+    OpenFileCache fileCache;
+    DirectoryListingCache listingCache;  // autoindex pages
+    FastCgiPool fastcgiPool;      // Connections to fastcgi_pass applications
+    CgiWorkerPool cgiWorkerPool;  // Pre-spawned interpreters for cgi_pool locations
+    std::map<const Config::LocationConfig*, CgiResponseCache*> cgiCaches;  // cgi_cache locations
+
+    // CGI variables that only depend on the location (the server matters for
+    // locations that inherit its root or body size)
+    std::map<std::pair<const Config::ServerConfig*, const Config::LocationConfig*>,
+             std::vector<std::string> > cgiEnvironmentTemplates;
+
+    // Configured error_page files keyed by path, and generated pages keyed by status
+    std::map<std::string, CachedErrorPage> errorPageCache;
+    std::map<int, std::string> defaultErrorPages;
 
     // Main request processing methods
     void processGetRequest(const HttpRequest &request, HttpResponse &response, 
@@ -37,14 +85,25 @@ private:
                              ClientConnection* connection = NULL);
 
     // Content serving methods
+    void serveFile(const HttpRequest &request, const std::string &filePath, HttpResponse &response);
+    void serveRanges(const HttpRequest &request, HttpResponse &response);
     void serveStaticFile(const std::string &filePath, HttpResponse &response);
-    void serveDirectoryListing(const std::string &dirPath, HttpResponse &response);
-    void serveErrorPage(int errorCode, HttpResponse &response, const Config::ServerConfig &server);
+    void serveCachedFile(const OpenFileCache::Entry &entry, HttpResponse &response);
+    bool servePrecompressed(const HttpRequest &request, const std::string &filePath, HttpResponse &response);
+    void serveDirectoryListing(const std::string &dirPath, const std::string &format, HttpResponse &response);
+    void serveErrorPage(int errorCode, HttpResponse &response, const Config::ServerConfig &server,
+                        const Config::LocationConfig *location = NULL);
+    bool useErrorPage(int errorCode, const std::vector<Config::ErrorPageConfig> &pages,
+                      HttpResponse &response) const;
+    void loadErrorPages();
+    void loadErrorPage(const std::string &path);
 
     // Special handling methods
     void executeCgi(const HttpRequest &request, HttpResponse &response, 
                    const Config::ServerConfig &server, const Config::LocationConfig &location,
                    ClientConnection* connection = NULL);
+    const std::vector<std::string> &getCgiEnvironmentTemplate(const Config::ServerConfig &server,
+                                                              const Config::LocationConfig &location);
     void handleRedirect(HttpResponse &response, const Config::LocationConfig &location);
     void handleFileUpload(const HttpRequest &request, HttpResponse &response, 
                          const Config::ServerConfig &server, const Config::LocationConfig &location);
@@ -53,9 +112,7 @@ private:
     // Configuration resolution methods
     const Config::ServerConfig &findServerConfig(const HttpRequest &request, int serverFd) const;
     const Config::LocationConfig &findLocationConfig(const Config::ServerConfig &server, const std::string &uri) const;
-    
-    // Helper methods
-    std::string toLower(const std::string &str) const;
+
 
     // Path resolution and file operations
     std::string resolveFilePath(const std::string &uri, const Config::LocationConfig &location, 
@@ -64,13 +121,18 @@ private:
     bool isDirectory(const std::string &path) const;
     bool hasPermission(const std::string &path) const;
     bool createFile(const std::string &path, const std::string &content) const;
+    bool storeRequestBody(const HttpRequest &request, const std::string &path) const;
 
     // Validation methods
     bool isMethodAllowed(const std::string &method, const Config::LocationConfig &location) const;
     bool isValidRequest(const HttpRequest &request) const;
+    static bool isNotModified(const HttpRequest &request, const std::string &etag, time_t mtime);
+    static bool parseRanges(const std::string &header, size_t size, ByteRangesStream::Ranges &ranges);
+    static bool parseRangeNumber(const std::string &text, size_t &value);
 
     // Utility methods
-    std::string getMimeType(const std::string &filePath) const;
+    static std::string getMimeType(const std::string &filePath);
+    static bool resolveInterpreter(const std::string &cgiPass, std::string &interpreterPath);
     void setErrorResponse(int statusCode, HttpResponse &response, const std::string &message);
     std::string getCurrentTimestamp() const;
 };
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Fixed-size object allocator. Memory is carved out of large slabs and
+// recycled through an intrusive free list, so allocating and releasing an
+// object is a pointer swap and slabs are only returned when the pool dies.
+// Callers construct with placement new and destroy explicitly.
+class SlabPool
+{
+   public:
+    SlabPool(size_t objectSize, size_t objectsPerSlab);
+    ~SlabPool();
+
+    void *allocate();
+    void release(void *object);
+
+   private:
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    size_t objectSize;
+    size_t objectsPerSlab;
+    FreeNode *freeList;
+    std::vector<char *> slabs;
+
+    void grow();
+
+    SlabPool(const SlabPool &other);
+    SlabPool &operator=(const SlabPool &other);
+};
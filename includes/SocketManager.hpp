@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "Config.hpp"
+#include "VirtualHostTable.hpp"
 
 class ServerSocket;
 class ClientConnection;
@@ -24,18 +25,22 @@ class SocketManager
 
 				// Socket operations
 				bool setNonBlocking(int fd);
+				void setReusePort(bool enabled);
 				bool bindAndListen(int fd, const std::string &host, const std::string &port);
 
 				// Getters
 				const std::vector<int> &getServerSockets() const;
 				const std::map<int, ClientConnection *> &getClientConnections() const;
 				const std::vector<const Config::ServerConfig *> *getServerConfigs(int serverFd) const;
+				const Config::ServerConfig *findServerConfig(int serverFd, const std::string &host) const;
 
 			 private:
 				std::vector<int> serverSockets;
 				std::map<int, ClientConnection *> clientConnections;
 				std::map<int, std::vector<const Config::ServerConfig *> > serverConfigs;
+				std::map<int, VirtualHostTable> virtualHosts;
 				std::map<std::string, int> listenAddressToSocket;
+				bool reusePort;
 
 				// Helper methods
 				int createSocket();
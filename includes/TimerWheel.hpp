@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+// Hierarchical timing wheel with one-second ticks. Timers are intrusive list
+// nodes embedded in their owner, so scheduling and cancelling are O(1) and
+// never allocate. Advancing the wheel only touches the slots that fall due
+// (plus the occasional cascade from a coarser level), so the cost is
+// proportional to the number of expiring timers, not of armed ones.
+class TimerWheel
+{
+   public:
+    struct Timer
+    {
+        Timer *prev;
+        Timer *next;
+        unsigned long expires;
+        int fd;  // Identifies the owner when the timer fires
+
+        Timer();
+        ~Timer();
+
+        bool isActive() const;
+        void cancel();
+
+       private:
+        Timer(const Timer &other);
+        Timer &operator=(const Timer &other);
+    };
+
+    TimerWheel();
+    ~TimerWheel();
+
+    void start(unsigned long now);
+    void schedule(Timer &timer, unsigned long now, unsigned long delay);
+
+    // Moves every timer due at or before now into expired (already unlinked)
+    void advance(unsigned long now, std::vector<Timer *> &expired);
+
+   private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const unsigned long SLOTS = 1UL << SLOT_BITS;
+    static const unsigned long SLOT_MASK = SLOTS - 1;
+
+    Timer slots[LEVELS][SLOTS];  // List heads
+    unsigned long currentTick;
+
+    void insert(Timer &timer);
+    void cascade(int level);
+
+    TimerWheel(const TimerWheel &other);
+    TimerWheel &operator=(const TimerWheel &other);
+};
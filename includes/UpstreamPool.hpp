@@ -0,0 +1,23 @@
+#ifndef UPSTREAMPOOL_HPP
+#define UPSTREAMPOOL_HPP
+
+#include <string>
+
+// Where a FastCgiOperation gets its connection from and hands it back to:
+// sockets to a fastcgi_pass application, or pre-spawned cgi_pool workers.
+class UpstreamPool
+{
+public:
+    virtual ~UpstreamPool() {}
+
+    // Returns a non-blocking socket, or -1 if none is available.
+    // connecting is set while a fresh connect is still in progress.
+    virtual int acquire(const std::string &key, bool &connecting) = 0;
+    // The first response bytes arrived (or the request was abandoned)
+    virtual void responded(const std::string &key) = 0;
+    // reusable is false unless the last request ended cleanly on a record
+    // boundary; the pool then discards the connection
+    virtual void release(const std::string &key, int fd, bool reusable) = 0;
+};
+
+#endif
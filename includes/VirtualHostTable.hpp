@@ -0,0 +1,41 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+
+// server_name lookup for the server blocks sharing one listen socket. Exact
+// names are looked up in a map; "*.example.com" wildcards are kept in a trie
+// keyed by domain labels from right to left, and the most specific one wins.
+// When a name is claimed twice the server block declared first keeps it.
+class VirtualHostTable
+{
+   public:
+    VirtualHostTable();
+
+    void add(const Config::ServerConfig *server);
+
+    // Server for a raw Host header value, or the default (first) server
+    const Config::ServerConfig *find(const std::string &host) const;
+    const Config::ServerConfig *getDefault() const;
+
+    static std::string normalizeHost(const std::string &host);
+
+   private:
+    struct LabelNode
+    {
+        std::map<std::string, size_t> children;
+        const Config::ServerConfig *wildcard;
+
+        LabelNode() : wildcard(NULL) {}
+    };
+
+    std::map<std::string, const Config::ServerConfig *> exactNames;
+    std::vector<LabelNode> wildcardNodes;
+    const Config::ServerConfig *defaultServer;
+
+    void addWildcard(const std::string &domain, const Config::ServerConfig *server);
+    const Config::ServerConfig *findWildcard(const std::string &host) const;
+};
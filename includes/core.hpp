@@ -9,4 +9,5 @@ extern HttpServer* g_server;
 
 // Signal handler function
 void signalHandler(int signal);
+void reloadHandler(int signal);
 
@@ -0,0 +1,61 @@
+#include "SlabPool.hpp"
+
+namespace
+{
+    // Keeps every object suitably aligned for anything it may contain
+    const size_t SLAB_ALIGNMENT = 16;
+}
+
+SlabPool::SlabPool(size_t objectSize, size_t objectsPerSlab)
+    : objectSize(objectSize), objectsPerSlab(objectsPerSlab), freeList(NULL)
+{
+    if (this->objectSize < sizeof(FreeNode))
+        this->objectSize = sizeof(FreeNode);
+    this->objectSize = (this->objectSize + SLAB_ALIGNMENT - 1) & ~(SLAB_ALIGNMENT - 1);
+    if (this->objectsPerSlab == 0)
+        this->objectsPerSlab = 1;
+}
+
+SlabPool::~SlabPool()
+{
+    for (size_t i = 0; i < slabs.size(); ++i)
+    {
+        delete[] slabs[i];
+    }
+}
+
+void *SlabPool::allocate()
+{
+    if (!freeList)
+        grow();
+
+    FreeNode *node = freeList;
+    freeList = node->next;
+    return node;
+}
+
+void SlabPool::release(void *object)
+{
+    if (!object)
+        return;
+
+    FreeNode *node = static_cast<FreeNode *>(object);
+    node->next = freeList;
+    freeList = node;
+}
+
+// new[] of char returns memory aligned for any fundamental type, and every
+// object size is a multiple of the alignment, so all slots stay aligned.
+void SlabPool::grow()
+{
+    char *slab = new char[objectSize * objectsPerSlab];
+    slabs.push_back(slab);
+
+    // Thread the slots back to front so allocation walks the slab in order
+    for (size_t i = objectsPerSlab; i > 0; --i)
+    {
+        FreeNode *node = reinterpret_cast<FreeNode *>(slab + (i - 1) * objectSize);
+        node->next = freeList;
+        freeList = node;
+    }
+}
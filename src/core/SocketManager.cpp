@@ -13,7 +13,7 @@
 #include "ClientConnection.hpp"
 #include "utiles.hpp"
 
-SocketManager::SocketManager()
+SocketManager::SocketManager() : reusePort(false)
 {
 }
 
@@ -35,6 +35,7 @@ bool SocketManager::createServerSocket(const Config::ListenConfig &listenConfig,
     if (it != listenAddressToSocket.end())
     {
         serverConfigs[it->second].push_back(serverConfig);
+        virtualHosts[it->second].add(serverConfig);
         return true;
     }
     
@@ -50,6 +51,7 @@ bool SocketManager::createServerSocket(const Config::ListenConfig &listenConfig,
     }
     serverSockets.push_back(serverFd);
     serverConfigs[serverFd].push_back(serverConfig);
+    virtualHosts[serverFd].add(serverConfig);
     listenAddressToSocket[listenKey] = serverFd;
 
     return true;
@@ -72,6 +74,10 @@ int SocketManager::acceptConnection(int serverFd, struct sockaddr_in &outClientA
     int clientFd = accept(serverFd, (struct sockaddr *)&outClientAddr, &addrLen);
     if (clientFd < 0)
     {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return -1;
+        }
         std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
         return -1;
     }
@@ -119,6 +125,13 @@ bool SocketManager::setNonBlocking(int fd)
     return true;
 }
 
+// Worker processes each bind their own listening socket on the same address;
+// SO_REUSEPORT lets the kernel balance incoming connections between them.
+void SocketManager::setReusePort(bool enabled)
+{
+    reusePort = enabled;
+}
+
 bool SocketManager::bindAndListen(int fd, const std::string &host, const std::string &port)
 {
     struct addrinfo hints;
@@ -173,6 +186,17 @@ const std::vector<const Config::ServerConfig *> *SocketManager::getServerConfigs
     return NULL;
 }
 
+// Resolves the Host header against the server blocks sharing serverFd
+const Config::ServerConfig *SocketManager::findServerConfig(int serverFd, const std::string &host) const
+{
+    std::map<int, VirtualHostTable>::const_iterator it = virtualHosts.find(serverFd);
+    if (it != virtualHosts.end())
+    {
+        return it->second.find(host);
+    }
+    return NULL;
+}
+
 int SocketManager::createSocket()
 {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -204,6 +228,11 @@ bool SocketManager::setSocketOptions(int fd)
         std::cerr << "Failed to set SO_REUSEADDR: " << strerror(errno) << std::endl;
         return false;
     }
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        std::cerr << "Failed to set SO_REUSEPORT: " << strerror(errno) << std::endl;
+        return false;
+    }
     return true;
 }
 
@@ -225,6 +254,7 @@ void SocketManager::cleanup()
     }
     serverSockets.clear();
     serverConfigs.clear();
+    virtualHosts.clear();
     listenAddressToSocket.clear();
 
     // Close all client connections
@@ -0,0 +1,152 @@
+#include "VirtualHostTable.hpp"
+
+VirtualHostTable::VirtualHostTable() : wildcardNodes(1), defaultServer(NULL)
+{
+}
+
+void VirtualHostTable::add(const Config::ServerConfig *server)
+{
+    if (!defaultServer)
+    {
+        defaultServer = server;
+    }
+
+    for (size_t i = 0; i < server->serverNames.size(); ++i)
+    {
+        std::string name = normalizeHost(server->serverNames[i]);
+        if (name.compare(0, 2, "*.") == 0)
+        {
+            addWildcard(name.substr(2), server);
+        }
+        else if (!name.empty())
+        {
+            exactNames.insert(std::make_pair(name, server));
+        }
+    }
+}
+
+const Config::ServerConfig *VirtualHostTable::find(const std::string &host) const
+{
+    if (host.empty())
+    {
+        return defaultServer;
+    }
+
+    std::string name = normalizeHost(host);
+    std::map<std::string, const Config::ServerConfig *>::const_iterator it = exactNames.find(name);
+    if (it != exactNames.end())
+    {
+        return it->second;
+    }
+
+    if (wildcardNodes.size() > 1)
+    {
+        const Config::ServerConfig *server = findWildcard(name);
+        if (server)
+        {
+            return server;
+        }
+    }
+    return defaultServer;
+}
+
+const Config::ServerConfig *VirtualHostTable::getDefault() const
+{
+    return defaultServer;
+}
+
+// Lowercases and drops the port and any trailing dot: "WWW.Example.com.:8080"
+// becomes "www.example.com". Bracketed IPv6 literals keep their brackets.
+std::string VirtualHostTable::normalizeHost(const std::string &host)
+{
+    size_t end = host.length();
+    if (!host.empty() && host[0] == '[')
+    {
+        size_t bracket = host.find(']');
+        if (bracket != std::string::npos)
+        {
+            end = bracket + 1;
+        }
+    }
+    else
+    {
+        size_t colon = host.find(':');
+        if (colon != std::string::npos)
+        {
+            end = colon;
+        }
+    }
+    if (end > 0 && host[end - 1] == '.')
+    {
+        --end;
+    }
+
+    std::string name(host, 0, end);
+    for (size_t i = 0; i < name.length(); ++i)
+    {
+        if (name[i] >= 'A' && name[i] <= 'Z')
+        {
+            name[i] = name[i] + ('a' - 'A');
+        }
+    }
+    return name;
+}
+
+void VirtualHostTable::addWildcard(const std::string &domain, const Config::ServerConfig *server)
+{
+    size_t node = 0;
+    size_t end = domain.length();
+    while (end > 0)
+    {
+        size_t dot = domain.rfind('.', end - 1);
+        size_t start = (dot == std::string::npos) ? 0 : dot + 1;
+        std::string label = domain.substr(start, end - start);
+
+        std::map<std::string, size_t>::iterator child = wildcardNodes[node].children.find(label);
+        if (child != wildcardNodes[node].children.end())
+        {
+            node = child->second;
+        }
+        else
+        {
+            wildcardNodes.push_back(LabelNode());
+            wildcardNodes[node].children[label] = wildcardNodes.size() - 1;
+            node = wildcardNodes.size() - 1;
+        }
+        end = (dot == std::string::npos) ? 0 : dot;
+    }
+
+    if (!wildcardNodes[node].wildcard)
+    {
+        wildcardNodes[node].wildcard = server;
+    }
+}
+
+// "*.example.com" covers any name below example.com but not example.com itself
+const Config::ServerConfig *VirtualHostTable::findWildcard(const std::string &host) const
+{
+    const Config::ServerConfig *best = NULL;
+    size_t node = 0;
+    size_t end = host.length();
+    while (end > 0)
+    {
+        size_t dot = host.rfind('.', end - 1);
+        if (dot == std::string::npos)
+        {
+            break;
+        }
+        std::map<std::string, size_t>::const_iterator child =
+            wildcardNodes[node].children.find(host.substr(dot + 1, end - dot - 1));
+        if (child == wildcardNodes[node].children.end())
+        {
+            break;
+        }
+        node = child->second;
+        if (wildcardNodes[node].wildcard)
+        {
+            best = wildcardNodes[node].wildcard;
+        }
+        end = dot;
+    }
+    return best;
+}
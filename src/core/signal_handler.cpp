@@ -52,3 +52,11 @@ void signalHandler(int signal)
   }
   std::cout << "Server shutdown complete." << std::endl;
 }
+
+void reloadHandler(int /* signal */)
+{
+  if (g_server != NULL)
+  {
+    g_server->reload();
+  }
+}
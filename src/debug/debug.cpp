@@ -89,6 +89,7 @@ void printParsedConfig(const Config &config)
                 }
 
                 std::cout << "  Autoindex: " << (server.autoindex ? "on" : "off") << std::endl;
+                std::cout << "  Autoindex format: " << server.autoindexFormat << std::endl;
                 std::cout << "  Client Max Body Size: " << server.clientMaxBodySize << " bytes" << std::endl;
 
                 // Print error pages
@@ -126,10 +127,19 @@ void printParsedConfig(const Config &config)
                                 std::cout << "    Index: " << location.index << std::endl;
                         if (!location.cgiPass.empty())
                                 std::cout << "    CGI Pass: " << location.cgiPass << std::endl;
+                        if (location.cgiPoolMaxIdle > 0)
+                                std::cout << "    CGI Pool: " << location.cgiWorker << " (idle " << location.cgiPoolMinIdle
+                                          << "-" << location.cgiPoolMaxIdle << ")" << std::endl;
+                        if (!location.fastcgiPass.empty())
+                                std::cout << "    FastCGI Pass: " << location.fastcgiPass << std::endl;
+                        if (location.cgiCacheSize > 0)
+                                std::cout << "    CGI Cache: " << location.cgiCacheSize << " bytes" << std::endl;
                         if (!location.returnUrl.empty())
                                 std::cout << "    Return: " << location.returnUrl << std::endl;
 
                         std::cout << "    Autoindex: " << (location.autoindex ? "on" : "off") << std::endl;
+                        if (!location.autoindexFormat.empty())
+                                std::cout << "    Autoindex format: " << location.autoindexFormat << std::endl;
 
                         if (location.clientMaxBodySize > 0)
                                 std::cout << "    Client Max Body Size: " << location.clientMaxBodySize << " bytes" << std::endl;
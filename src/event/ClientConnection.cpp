@@ -2,66 +2,112 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 #include <cctype>
 #include <cstdlib>
 #include <iostream>
-#include <sstream>
 
+#include "OperationBodyStream.hpp"
 #include "RequestHandler.hpp"
 #include "utiles.hpp"
 
 ClientConnection::ClientConnection(int socketFd, const struct sockaddr_in &clientAddr, RequestHandler &handler)
     : socketFd(socketFd),
       clientAddress(parseClientAddress(clientAddr)),
+      bodyFileFd(-1),
+      bodyFileOffset(0),
+      bodyFileRemaining(0),
+      bodyStream(NULL),
+      bodyChunked(false),
+      streamLengthKnown(false),
+      streamRemaining(0),
+      bodyPipeFd(-1),
+      bodyPipeRemaining(0),
+      streamedOperation(NULL),
       handleRequest(handler),
       connected(true),
       keepAlive(false),
+      edgeTriggered(false),
+      maxRequests(0),
+      requestsServed(0),
       lastActivity(time(NULL)),
+      armedPhase(TIMEOUT_NONE),
       bytesRead(0),
       bytesWritten(0),
-      writeOffset(0)
+      readOffset(0),
+      writeOffset(0),
+      writeYielded(false)
 {
     context.state = READING_REQUEST;
+    timer.fd = socketFd;
 }
 
 ClientConnection::~ClientConnection()
 {
+    closeBodyStream();
     if (context.pendingOperation) {
         context.pendingOperation->cleanup();
         delete context.pendingOperation;
         context.pendingOperation = NULL;
     }
+    closeBodyFile();
     close();
 }
 
 bool ClientConnection::readData()
 {
     char buffer[MAX_BUFFER_SIZE];
+    bool received = false;
 
-    ssize_t bytesReadNow = recv(socketFd, buffer, sizeof(buffer), 0);
-
-    if (bytesReadNow <= 0)
+    // Level-triggered mode reads once per wakeup; edge-triggered mode must
+    // drain the socket until EAGAIN or it will not be notified again. Reads
+    // held back for a response in flight resume with a fresh registration.
+    while (isReadyToRead())
     {
-        if (bytesReadNow < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        ssize_t bytesReadNow = recv(socketFd, buffer, sizeof(buffer), 0);
+
+        if (bytesReadNow <= 0)
         {
-            return true;
+            if (bytesReadNow < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            if (bytesReadNow < 0)
+            {
+                std::cerr << "Error reading from socket: " << strerror(errno) << std::endl;
+                return false;
+            }
+            // bytesReadNow == 0 means client closed connection
+            std::cout << "Client closed connection" << std::endl;
+            return false;
         }
-        if (bytesReadNow < 0)
+
+        // Requests already parsed are dropped once per batch of reads rather
+        // than one at a time, which would shift the backlog again and again
+        if (readOffset > 0)
         {
-            std::cerr << "Error reading from socket: " << strerror(errno) << std::endl;
-            return false;
+            readBuffer.erase(0, readOffset);
+            readOffset = 0;
+        }
+        readBuffer.append(buffer, static_cast<size_t>(bytesReadNow));
+        bytesRead += bytesReadNow;
+        received = true;
+
+        if (!edgeTriggered)
+        {
+            break;
         }
-        // bytesReadNow == 0 means client closed connection
-        std::cout << "Client closed connection" << std::endl;
-        return false;
     }
 
-    readBuffer.append(buffer, static_cast<size_t>(bytesReadNow));
-    bytesRead += bytesReadNow;
+    if (!received)
+    {
+        return true;
+    }
     updateLastActivity();
 
 #ifdef VERBOSE_LOGGING
@@ -71,10 +117,8 @@ bool ClientConnection::readData()
     std::cout << "=== END RAW REQUEST DATA ===" << std::endl;
 #endif
 
-    if (processReadBuffer())
-    {
-        readBuffer.clear();
-    }
+    // Bytes past the end of the request stay in readBuffer for the next one
+    processReadBuffer();
 
     return true;
 }
@@ -83,30 +127,111 @@ bool ClientConnection::writeData()
 {
     if (!isReadyToWrite())
     {
-        std::cerr << "Connection not ready to write" << std::endl;
+        // A stream waiting for its producer is not an error
+        if (!bodyStream)
+        {
+            std::cerr << "Connection not ready to write" << std::endl;
+        }
         return false;
     }
 
-    ssize_t bytesWrittenNow = send(socketFd, writeBuffer.data() + writeOffset, writeBuffer.size() - writeOffset, 0);
-    if (bytesWrittenNow < 0)
+    size_t pulls = 0;
+    writeYielded = false;
+    do
     {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        // Top up from a streamed body before the buffer runs dry, so the
+        // header block and the first chunk leave in the same packet
+        if (bodyStream && bodyPipeRemaining == 0 && writeBuffer.size() - writeOffset < STREAM_CHUNK_SIZE)
         {
-            return true;
+            if (pulls++ == MAX_STREAM_PULLS_PER_WRITE)
+            {
+                writeYielded = true;  // The rest is produced on a later event
+                break;
+            }
+            writeBuffer.erase(0, writeOffset);
+            writeOffset = 0;
+            if (!pullBodyStream())
+            {
+                std::cerr << "Failed to produce response body" << std::endl;
+                close();
+                return false;
+            }
+        }
+        if (writeOffset == writeBuffer.size() && bodyFileRemaining == 0 && bodyPipeRemaining == 0)
+        {
+            break;  // The stream has nothing to send yet
         }
-        std::cerr << "Error writing to socket: " << strerror(errno) << std::endl;
-        return false;
-    }
 
-    bytesWritten += bytesWrittenNow;
-    writeOffset += bytesWrittenNow;
-    updateLastActivity();
+        ssize_t bytesWrittenNow;
+        bool sendingHeaders = writeOffset < writeBuffer.size();
+
+        if (sendingHeaders)
+        {
+            // MSG_MORE keeps the header block from going out as its own small packet
+            int flags = bodyFileRemaining > 0 || bodyPipeRemaining > 0 ? MSG_MORE : 0;
+            bytesWrittenNow = send(socketFd, writeBuffer.data() + writeOffset, writeBuffer.size() - writeOffset, flags);
+        }
+        else if (bodyPipeRemaining > 0)
+        {
+            // Only bytes already in the pipe are spliced, so EAGAIN means the socket is full
+            bytesWrittenNow = splice(bodyPipeFd, NULL, socketFd, NULL, bodyPipeRemaining,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (bytesWrittenNow == 0)
+            {
+                std::cerr << "Pipe emptied while splicing response body" << std::endl;
+                close();
+                return false;
+            }
+        }
+        else
+        {
+            size_t chunk = bodyFileRemaining < SENDFILE_CHUNK_SIZE ? bodyFileRemaining : SENDFILE_CHUNK_SIZE;
+            bytesWrittenNow = sendfile(socketFd, bodyFileFd, &bodyFileOffset, chunk);
+            if (bytesWrittenNow == 0)
+            {
+                std::cerr << "File truncated while sending response body" << std::endl;
+                close();
+                return false;
+            }
+        }
+
+        if (bytesWrittenNow < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return false;  // Socket buffer full, wait for the next EPOLLOUT
+            }
+            std::cerr << "Error writing to socket: " << strerror(errno) << std::endl;
+            close();
+            return false;
+        }
+
+        bytesWritten += bytesWrittenNow;
+        if (sendingHeaders)
+        {
+            writeOffset += bytesWrittenNow;
+        }
+        else if (bodyPipeRemaining > 0)
+        {
+            bodyPipeRemaining -= bytesWrittenNow;
+            if (bodyPipeRemaining == 0 && bodyChunked)
+            {
+                writeBuffer.append("\r\n", 2);
+            }
+        }
+        else
+        {
+            bodyFileRemaining -= bytesWrittenNow;
+        }
+        updateLastActivity();
+    } while (edgeTriggered && hasPendingOutput());
 
     // Check if we've sent everything
-    if (writeOffset >= writeBuffer.size())
+    if (!hasPendingOutput())
     {
         writeBuffer.clear();
         writeOffset = 0;
+        closeBodyFile();
         return true;  // Complete response sent
     }
 
@@ -142,39 +267,19 @@ int ClientConnection::getServerFd() const
     return serverFd;
 }
 
+void ClientConnection::setEdgeTriggered(bool edgeTriggered)
+{
+    this->edgeTriggered = edgeTriggered;
+}
+
+void ClientConnection::setMaxRequests(int maxRequests)
+{
+    this->maxRequests = maxRequests;
+}
+
 bool ClientConnection::hasCompleteRequest() const
 {
-    // Check for complete HTTP headers (ends with \r\n\r\n)
-    size_t headerEnd = readBuffer.find("\r\n\r\n");
-    if (headerEnd == std::string::npos)
-        return false;
-    
-    // For POST/PUT requests, check if we have the complete body based on Content-Length
-    size_t contentLengthPos = readBuffer.find("Content-Length:");
-    if (contentLengthPos != std::string::npos && contentLengthPos < headerEnd)
-    {
-        // Extract Content-Length value
-        size_t valueStart = contentLengthPos + 15; // Length of "Content-Length:"
-        while (valueStart < headerEnd && (readBuffer[valueStart] == ' ' || readBuffer[valueStart] == '\t'))
-            valueStart++;
-        
-        size_t valueEnd = readBuffer.find("\r\n", valueStart);
-        if (valueEnd != std::string::npos)
-        {
-            std::string contentLengthStr = readBuffer.substr(valueStart, valueEnd - valueStart);
-            size_t contentLength = static_cast<size_t>(atoi(contentLengthStr.c_str()));
-            
-            // Calculate actual body length
-            size_t bodyStart = headerEnd + 4; // After \r\n\r\n
-            size_t bodyLength = readBuffer.length() - bodyStart;
-            
-            // Check if we have received the complete body
-            if (bodyLength < contentLength)
-                return false;
-        }
-    }
-    
-    return true;
+    return context.request.isComplete();
 }
 
 HttpRequest &ClientConnection::getCurrentRequest()
@@ -197,14 +302,42 @@ void ClientConnection::setKeepAlive(bool keepAlive)
     this->keepAlive = keepAlive;
 }
 
+// Called once a keep-alive response is fully written. Pipelined requests
+// that arrived meanwhile are already in readBuffer and are handled right
+// away, in the order they were sent.
+void ClientConnection::startNextRequest()
+{
+    context.response.reset();
+    setState(KEEP_ALIVE);
+    if (readOffset < readBuffer.size())
+    {
+        processReadBuffer();
+    }
+}
+
+bool ClientConnection::hasYieldedWrite() const
+{
+    return writeYielded;
+}
+
 bool ClientConnection::isReadyToWrite() const
 {
-    return !writeBuffer.empty();
+    return writeOffset < writeBuffer.size() || bodyFileRemaining > 0 ||
+           (bodyStream != NULL && bodyStream->isReady());
 }
 
+// While a response is in flight, pipelined bytes are only parsed once it
+// is done. Past one header block's worth they are left in the socket, so a
+// client that sends without reading is held back by TCP flow control
+// instead of growing readBuffer.
 bool ClientConnection::isReadyToRead() const
 {
-    return connected;
+    if (!connected)
+    {
+        return false;
+    }
+    bool responsePending = context.state != READING_REQUEST && context.state != KEEP_ALIVE;
+    return !responsePending || readBuffer.size() - readOffset < MAX_PIPELINED_BYTES;
 }
 
 void ClientConnection::updateLastActivity()
@@ -217,6 +350,48 @@ bool ClientConnection::isTimedOut(int timeoutSeconds) const
     return (time(NULL) - lastActivity) > timeoutSeconds;
 }
 
+ClientConnection::TimeoutPhase ClientConnection::getTimeoutPhase() const
+{
+    switch (context.state)
+    {
+    case WAITING_ASYNC:
+        return TIMEOUT_CGI;
+    case PROCESSING_REQUEST:
+    case WRITING_RESPONSE:
+    case CLOSING:
+        return TIMEOUT_SEND;
+    default:
+        break;
+    }
+
+    if (context.request.getParseState() == HttpRequest::PARSE_BODY)
+    {
+        return TIMEOUT_BODY;
+    }
+    // Idle until the first byte of the next request arrives
+    if (context.state == KEEP_ALIVE && readOffset == readBuffer.size() &&
+        (context.request.isComplete() || context.request.hasError()))
+    {
+        return TIMEOUT_KEEPALIVE;
+    }
+    return TIMEOUT_HEADER;
+}
+
+ClientConnection::TimeoutPhase ClientConnection::getArmedPhase() const
+{
+    return armedPhase;
+}
+
+void ClientConnection::setArmedPhase(TimeoutPhase phase)
+{
+    armedPhase = phase;
+}
+
+TimerWheel::Timer &ClientConnection::getTimer()
+{
+    return timer;
+}
+
 int ClientConnection::getSocketFd() const
 {
     return socketFd;
@@ -230,8 +405,11 @@ std::string ClientConnection::getClientAddress() const
 void ClientConnection::clearBuffers()
 {
     readBuffer.clear();
+    readOffset = 0;
     writeBuffer.clear();
     writeOffset = 0;
+    closeBodyFile();
+    closeBodyStream();
 }
 
 size_t ClientConnection::getBytesRead() const
@@ -246,12 +424,46 @@ size_t ClientConnection::getBytesWritten() const
 
 bool ClientConnection::processReadBuffer()
 {
-    if (!hasCompleteRequest())
+    // Bytes that arrive while a response is still in flight wait in readBuffer,
+    // up to MAX_PIPELINED_BYTES (see isReadyToRead)
+    if (context.state != READING_REQUEST && context.state != KEEP_ALIVE)
+    {
+        return false;
+    }
+
+    if (context.request.isComplete() || context.request.hasError())
+    {
+        context.request.reset();
+    }
+
+    // The parser keeps its position between calls, so only new bytes are scanned
+    const char *pending = readBuffer.data() + readOffset;
+    size_t pendingSize = readBuffer.size() - readOffset;
+    size_t consumed = context.request.feed(pending, pendingSize);
+
+    // Once the headers are known, decide whether the body fits the limits and
+    // whether it is kept in memory or spooled to disk as it arrives
+    if (context.request.needsBodySetup())
+    {
+        size_t maxBodySize;
+        size_t bufferSize;
+        handleRequest.getBodyLimits(context.request, serverFd, maxBodySize, bufferSize);
+        context.request.setupBody(maxBodySize, bufferSize);
+        consumed += context.request.feed(pending + consumed, pendingSize - consumed);
+    }
+    readOffset += consumed;
+    if (readOffset == readBuffer.size())
+    {
+        readBuffer.clear();
+        readOffset = 0;
+    }
+
+    if (!context.request.hasError() && !hasCompleteRequest())
     {
         return false;
     }
 
-    if (context.request.parseRequest(readBuffer))
+    if (context.request.isComplete())
     {
         context.response.reset();
         setState(PROCESSING_REQUEST);
@@ -262,9 +474,7 @@ bool ClientConnection::processReadBuffer()
             return true; 
         }
         
-        writeBuffer = context.response.toString();
-        writeOffset = 0;
-        setState(WRITING_RESPONSE);
+        queueResponse();
         
 #ifdef VERBOSE_LOGGING
         std::cout << "=== RESPONSE GENERATED ===" << std::endl;
@@ -279,18 +489,226 @@ bool ClientConnection::processReadBuffer()
     {
         std::cerr << "Failed to parse request" << std::endl;
         
-        // Use RequestHandler to generate proper 400 error page from config
+        // Use RequestHandler to generate the proper error page from config
         context.response.reset();
-        handleRequest.generateErrorPage(400, context.response, serverFd);
+        handleRequest.generateErrorPage(context.request.getErrorCode(), context.response, serverFd);
         
-        writeBuffer = context.response.toString();
-        writeOffset = 0;
-        setState(WRITING_RESPONSE);
+        queueResponse();
         
         return true;
     }
 }
 
+// Serializes the current response into writeBuffer; a file-backed body is
+// taken over from the response and streamed with sendfile() by writeData.
+void ClientConnection::queueResponse()
+{
+    ++requestsServed;
+    keepAlive = shouldKeepAlive();
+    handleRequest.compressResponse(context.request, context.response);
+
+    // A streamed body without a length from its producer is sent chunked
+    // to HTTP/1.1 clients; HTTP/1.0 ones read it until the connection closes
+    bool streamed = context.response.hasBodyStream();
+    streamLengthKnown = streamed && context.response.hasHeader("Content-Length");
+    streamRemaining = streamLengthKnown ? std::strtoul(context.response.getHeader("Content-Length").c_str(), NULL, 10) : 0;
+    if (streamed && !streamLengthKnown)
+    {
+        if (context.request.getVersion() == "HTTP/1.1")
+        {
+            context.response.setChunked(true);
+        }
+        else
+        {
+            keepAlive = false;
+        }
+    }
+
+    context.response.setHeader("Connection", keepAlive ? "keep-alive" : "close");
+    // Without a length the client could only find the end of the body by EOF;
+    // a 304 has no body and no length of its own
+    if (keepAlive && !streamed && !context.response.hasBodyFile() &&
+        !context.response.hasHeader("Content-Length") && context.response.getStatusCode() != 304)
+    {
+        context.response.setHeader("Content-Length", itoa(context.response.getBody().size()));
+    }
+
+    closeBodyFile();
+    closeBodyStream();
+    // writeBuffer keeps its capacity across keep-alive responses
+    writeBuffer.clear();
+    context.response.serializeHeaders(writeBuffer);
+    writeBuffer += context.response.getBody();
+    writeOffset = 0;
+    if (context.response.hasBodyFile())
+    {
+        bodyFileFd = context.response.releaseBodyFile(bodyFileOffset, bodyFileRemaining);
+    }
+    if (streamed)
+    {
+        bodyChunked = context.response.isChunked();
+        bodyStream = context.response.releaseBodyStream();
+    }
+    setState(WRITING_RESPONSE);
+}
+
+// Appends the next piece of the streamed body to writeBuffer, framed as a
+// chunk when the response is chunked, and ends the body once the stream is done
+bool ClientConnection::pullBodyStream()
+{
+    // Once the producer hands over its pipe, whatever it holds is spliced
+    // to the socket as the next chunk; only the framing is buffered here
+    size_t available;
+    int pipeFd = bodyStream->getSplicePipe(available);
+    if (pipeFd >= 0 && available > 0)
+    {
+        if (streamLengthKnown && available > streamRemaining)
+        {
+            available = streamRemaining;
+        }
+        if (available == 0)
+        {
+            // Output past the announced length is dropped
+            char discard[4096];
+            while (::read(pipeFd, discard, sizeof(discard)) > 0)
+            {
+            }
+            return true;
+        }
+        if (streamLengthKnown)
+        {
+            streamRemaining -= available;
+        }
+        if (bodyChunked)
+        {
+            HttpResponse::appendChunkHeader(writeBuffer, available);
+        }
+        bodyPipeFd = pipeFd;
+        bodyPipeRemaining = available;
+        return true;
+    }
+
+    streamBuffer.clear();
+    if (!bodyStream->read(streamBuffer, STREAM_CHUNK_SIZE))
+    {
+        return false;
+    }
+
+    // Hold a producer to the length it announced so the framing stays intact
+    if (streamLengthKnown)
+    {
+        if (streamBuffer.size() > streamRemaining)
+        {
+            streamBuffer.resize(streamRemaining);
+        }
+        streamRemaining -= streamBuffer.size();
+        if (bodyStream->isFinished() && streamRemaining > 0)
+        {
+            return false;
+        }
+    }
+
+    if (bodyChunked)
+    {
+        HttpResponse::appendChunk(writeBuffer, streamBuffer.data(), streamBuffer.size());
+    }
+    else
+    {
+        writeBuffer += streamBuffer;
+    }
+
+    if (bodyStream->isFinished())
+    {
+        if (bodyChunked)
+        {
+            HttpResponse::appendLastChunk(writeBuffer);
+        }
+        closeBodyStream();
+    }
+    return true;
+}
+
+void ClientConnection::closeBodyStream()
+{
+    delete bodyStream;
+    bodyStream = NULL;
+    bodyChunked = false;
+    streamLengthKnown = false;
+    streamRemaining = 0;
+    bodyPipeFd = -1;
+    bodyPipeRemaining = 0;
+
+    if (streamedOperation)
+    {
+        if (context.pendingOperation == streamedOperation)
+        {
+            context.pendingOperation = NULL;
+        }
+        streamedOperation->cleanup();
+        delete streamedOperation;
+        streamedOperation = NULL;
+    }
+}
+
+// HTTP/1.1 connections persist unless either side says "close"; HTTP/1.0
+// ones only when the client asks for keep-alive. After a parse error the
+// framing of whatever follows is unknown, so the connection is dropped.
+bool ClientConnection::shouldKeepAlive() const
+{
+    if (requestsServed >= maxRequests || !context.request.isComplete())
+    {
+        return false;
+    }
+
+    std::string connection = context.request.getHeader("Connection");
+    for (size_t i = 0; i < connection.size(); ++i)
+    {
+        connection[i] = std::tolower(static_cast<unsigned char>(connection[i]));
+    }
+    bool hasClose = false;
+    bool hasKeepAlive = false;
+    size_t pos = 0;
+    while (pos < connection.size())
+    {
+        size_t end = connection.find(',', pos);
+        if (end == std::string::npos)
+        {
+            end = connection.size();
+        }
+        size_t first = connection.find_first_not_of(" \t", pos);
+        size_t last = connection.find_last_not_of(" \t", end - 1);
+        if (first != std::string::npos && first < end && last >= first)
+        {
+            std::string token = connection.substr(first, last - first + 1);
+            hasClose = hasClose || token == "close";
+            hasKeepAlive = hasKeepAlive || token == "keep-alive";
+        }
+        pos = end + 1;
+    }
+
+    if (hasClose)
+    {
+        return false;
+    }
+    return context.request.getVersion() == "HTTP/1.1" || hasKeepAlive;
+}
+
+void ClientConnection::closeBodyFile()
+{
+    if (bodyFileFd >= 0)
+    {
+        ::close(bodyFileFd);
+    }
+    bodyFileFd = -1;
+    bodyFileOffset = 0;
+    bodyFileRemaining = 0;
+}
+
+bool ClientConnection::hasPendingOutput() const
+{
+    return writeOffset < writeBuffer.size() || bodyFileRemaining > 0 || bodyStream != NULL;
+}
+
 ConnectionState ClientConnection::getState() const
 {
     return context.state;
@@ -330,6 +748,27 @@ void ClientConnection::completePendingOperation()
         return;
     }
     
+    // A streamed operation stays alive until the stream has drained its output
+    if (context.pendingOperation == streamedOperation) {
+        context.pendingOperation = NULL;
+        return;
+    }
+    
+    // Run the request again, e.g. a cache waiter whose fill stored nothing
+    if (context.pendingOperation->isComplete() && context.pendingOperation->shouldRetry()) {
+        context.pendingOperation->cleanup();
+        delete context.pendingOperation;
+        context.pendingOperation = NULL;
+        
+        context.response.reset();
+        setState(PROCESSING_REQUEST);
+        handleRequest.handleRequest(context.request, context.response, this);
+        if (context.state != WAITING_ASYNC) {
+            queueResponse();
+        }
+        return;
+    }
+    
     if (context.pendingOperation->isComplete()) {
         if (context.pendingOperation->hasError()) {
             std::cerr << "Async operation failed: " << context.pendingOperation->getError() << std::endl;
@@ -342,21 +781,79 @@ void ClientConnection::completePendingOperation()
 
            
             context.response.reset();
-            parseCgiOutput(result);
+            context.response.setCgiOutput(result);
         }
         
         context.pendingOperation->cleanup();
         delete context.pendingOperation;
         context.pendingOperation = NULL;
         
-        writeBuffer = context.response.toString();
-        writeOffset = 0;
-        setState(WRITING_RESPONSE);
+        queueResponse();
     } else {
         std::cerr << "ClientConnection: Operation not complete, cannot finish!" << std::endl;
     }
 }
 
+// Starts sending the response of a running operation as soon as its header
+// block is in. The body then follows as the operation produces it; output
+// without any header block is sent as an HTML body once the buffer fills.
+// An operation that finishes before this happens is answered from its
+// complete output by completePendingOperation instead.
+void ClientConnection::pumpPendingOperation()
+{
+    AsyncOperation *operation = context.pendingOperation;
+    if (!operation || context.state != WAITING_ASYNC || operation->isComplete())
+    {
+        return;
+    }
+
+    std::string &output = operation->getOutput();
+    size_t headerEnd = HttpResponse::findCgiHeaderEnd(output);
+    if (headerEnd == std::string::npos && operation->hasOutputRoom())
+    {
+        return;
+    }
+
+    context.response.reset();
+    if (headerEnd != std::string::npos)
+    {
+        context.response.setCgiHeaders(output.substr(0, headerEnd));
+        output.erase(0, headerEnd);
+    }
+    else
+    {
+        context.response.setStatus(200, "OK");
+        context.response.setHeader("Content-Type", "text/html");
+    }
+
+    std::string contentLength = context.response.getHeader("Content-Length");
+    context.response.setBodyStream(new OperationBodyStream(*operation));
+    if (!contentLength.empty())
+    {
+        context.response.setHeader("Content-Length", contentLength);
+    }
+    queueResponse();
+    streamedOperation = operation;
+}
+
+// Gives up on a running operation (e.g. a CGI past its deadline) and answers
+// with an error page instead
+void ClientConnection::abortPendingOperation(int statusCode)
+{
+    if (!context.pendingOperation)
+    {
+        return;
+    }
+
+    context.pendingOperation->cleanup();
+    delete context.pendingOperation;
+    context.pendingOperation = NULL;
+
+    context.response.reset();
+    handleRequest.generateErrorPage(statusCode, context.response, serverFd);
+    queueResponse();
+}
+
 bool ClientConnection::hasPendingOperation() const
 {
     return context.pendingOperation != NULL;
@@ -375,72 +872,10 @@ bool ClientConnection::canRead() const
 
 bool ClientConnection::canWrite() const
 {
-    return connected && context.state == WRITING_RESPONSE && !writeBuffer.empty();
+    return connected && context.state == WRITING_RESPONSE && isReadyToWrite();
 }
 
 bool ClientConnection::isReadyForCleanup() const
 {
     return !connected || context.state == CLOSING;
 }
-
-void ClientConnection::parseCgiOutput(const std::string& output)
-{
-    size_t headerEnd = output.find("\r\n\r\n");
-    if (headerEnd == std::string::npos) {
-        headerEnd = output.find("\n\n");
-        if (headerEnd != std::string::npos) {
-            headerEnd += 2;
-        }
-    } else {
-        headerEnd += 4;
-    }
-    
-    if (headerEnd != std::string::npos) {
-        std::string headers = output.substr(0, headerEnd);
-        std::string body = output.substr(headerEnd);
-        
-        std::istringstream headerStream(headers);
-        std::string line;
-        bool statusSet = false;
-        
-        while (std::getline(headerStream, line)) {
-            if (line.empty() || line == "\r") continue;
-            
-            if (!line.empty() && line[line.length() - 1] == '\r') {
-                line.erase(line.length() - 1);
-            }
-            
-            size_t colonPos = line.find(':');
-            if (colonPos != std::string::npos) {
-                std::string name = line.substr(0, colonPos);
-                std::string value = line.substr(colonPos + 1);
-                
-                while (!value.empty() && (value[0] == ' ' || value[0] == '\t')) {
-                    value.erase(0, 1);
-                }
-                
-                if (name == "Status" && !statusSet) {
-                    size_t spacePos = value.find(' ');
-                    if (spacePos != std::string::npos) {
-                        int statusCode = atoi(value.substr(0, spacePos).c_str());
-                        std::string statusMessage = value.substr(spacePos + 1);
-                        context.response.setStatus(statusCode, statusMessage);
-                        statusSet = true;
-                    }
-                } else {
-                    context.response.setHeader(name, value);
-                }
-            }
-        }
-        
-        if (!statusSet) {
-            context.response.setStatus(200, "OK");
-        }
-        
-        context.response.setBody(body);
-    } else {
-        context.response.setStatus(200, "OK");
-        context.response.setHeader("Content-Type", "text/html");
-        context.response.setBody(output);
-    }
-}
\ No newline at end of file
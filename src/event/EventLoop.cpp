@@ -1,12 +1,13 @@
 #include "EventLoop.hpp"
 
+#include <time.h>
 #include <unistd.h>  // For close()
 
 #include <cerrno>
 #include <cstring>
 #include <iostream>
 
-EventLoop::EventLoop() : epollFd(-1), isInitialized(false)
+EventLoop::EventLoop() : epollFd(-1), isInitialized(false), edgeTriggered(false)
 {
 }
 
@@ -31,6 +32,7 @@ bool EventLoop::initialize()
         std::cerr << "Failed to create epoll instance: " << strerror(errno) << std::endl;
         return false;
     }
+    timers.start(monotonicSeconds());
     isInitialized = true;
     return true;
 }
@@ -43,7 +45,7 @@ int EventLoop::wait(epoll_event *events, int maxEvents, int timeout)
 bool EventLoop::add(int fd, uint32_t events)
 {
     epoll_event event;
-    event.events = events;
+    event.events = edgeTriggered ? (events | EPOLLET) : events;
     event.data.fd = fd;
     if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
     {
@@ -69,7 +71,7 @@ bool EventLoop::remove(int fd)
 bool EventLoop::modify(int fd, uint32_t events)
 {
     epoll_event event;
-    event.events = events;
+    event.events = edgeTriggered ? (events | EPOLLET) : events;
     event.data.fd = fd;
     if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) < 0)
     {
@@ -78,3 +80,31 @@ bool EventLoop::modify(int fd, uint32_t events)
     }
     return true;
 }
+
+
+void EventLoop::setEdgeTriggered(bool enabled)
+{
+    edgeTriggered = enabled;
+}
+
+bool EventLoop::isEdgeTriggered() const
+{
+    return edgeTriggered;
+}
+
+void EventLoop::addTimer(TimerWheel::Timer &timer, int seconds)
+{
+    timers.schedule(timer, monotonicSeconds(), static_cast<unsigned long>(seconds));
+}
+
+void EventLoop::expireTimers(std::vector<TimerWheel::Timer *> &expired)
+{
+    timers.advance(monotonicSeconds(), expired);
+}
+
+unsigned long EventLoop::monotonicSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<unsigned long>(now.tv_sec);
+}
@@ -0,0 +1,55 @@
+#include "OperationBodyStream.hpp"
+
+#include <sys/ioctl.h>
+
+OperationBodyStream::OperationBodyStream(AsyncOperation &operation)
+    : operation(operation), spliceFd(-1)
+{
+}
+
+// The headers are already out, so a failed operation can only be reported
+// by cutting the body short
+bool OperationBodyStream::read(std::string &out, size_t maxBytes)
+{
+    std::string &output = operation.getOutput();
+    size_t length = output.size() < maxBytes ? output.size() : maxBytes;
+
+    out.append(output, 0, length);
+    output.erase(0, length);
+    return !(output.empty() && operation.isComplete() && operation.hasError());
+}
+
+bool OperationBodyStream::isFinished() const
+{
+    return operation.isComplete() && operation.getOutput().empty() && pipeBytes() == 0;
+}
+
+bool OperationBodyStream::isReady() const
+{
+    return operation.isComplete() || !operation.getOutput().empty() || pipeBytes() > 0;
+}
+
+// Output the operation buffered before the hand-over is read first
+int OperationBodyStream::getSplicePipe(size_t &available)
+{
+    available = 0;
+    if (spliceFd < 0 && operation.getOutput().empty() && !operation.isComplete())
+    {
+        spliceFd = operation.spliceOutput();
+    }
+    if (spliceFd >= 0)
+    {
+        available = pipeBytes();
+    }
+    return spliceFd;
+}
+
+size_t OperationBodyStream::pipeBytes() const
+{
+    int bytes = 0;
+    if (spliceFd < 0 || ioctl(spliceFd, FIONREAD, &bytes) < 0)
+    {
+        return 0;
+    }
+    return static_cast<size_t>(bytes);
+}
@@ -0,0 +1,132 @@
+#include "TimerWheel.hpp"
+
+#include <cstddef>
+
+TimerWheel::Timer::Timer() : prev(NULL), next(NULL), expires(0), fd(-1)
+{
+}
+
+TimerWheel::Timer::~Timer()
+{
+    cancel();
+}
+
+bool TimerWheel::Timer::isActive() const
+{
+    return prev != NULL;
+}
+
+void TimerWheel::Timer::cancel()
+{
+    if (prev)
+    {
+        prev->next = next;
+        next->prev = prev;
+        prev = NULL;
+        next = NULL;
+    }
+}
+
+TimerWheel::TimerWheel() : currentTick(0)
+{
+    for (int level = 0; level < LEVELS; ++level)
+    {
+        for (unsigned long slot = 0; slot < SLOTS; ++slot)
+        {
+            slots[level][slot].prev = &slots[level][slot];
+            slots[level][slot].next = &slots[level][slot];
+        }
+    }
+}
+
+TimerWheel::~TimerWheel()
+{
+    // Detach remaining timers so their owners do not unlink into freed heads
+    for (int level = 0; level < LEVELS; ++level)
+    {
+        for (unsigned long slot = 0; slot < SLOTS; ++slot)
+        {
+            Timer &head = slots[level][slot];
+            while (head.next != &head)
+            {
+                head.next->cancel();
+            }
+            head.prev = NULL;
+            head.next = NULL;
+        }
+    }
+}
+
+void TimerWheel::start(unsigned long now)
+{
+    currentTick = now;
+}
+
+void TimerWheel::schedule(Timer &timer, unsigned long now, unsigned long delay)
+{
+    timer.cancel();
+    if (now > currentTick)
+    {
+        // Not advanced yet this iteration; anchor to the wheel's own clock
+        delay += now - currentTick;
+    }
+    timer.expires = currentTick + (delay > 0 ? delay : 1);
+    insert(timer);
+}
+
+void TimerWheel::advance(unsigned long now, std::vector<Timer *> &expired)
+{
+    while (currentTick < now)
+    {
+        ++currentTick;
+
+        // Entering a new lap of a level pulls the matching coarser slot down
+        for (int level = 1; level < LEVELS; ++level)
+        {
+            if ((currentTick & ((1UL << (level * SLOT_BITS)) - 1)) != 0)
+            {
+                break;
+            }
+            cascade(level);
+        }
+
+        Timer &head = slots[0][currentTick & SLOT_MASK];
+        while (head.next != &head)
+        {
+            Timer *timer = head.next;
+            timer->cancel();
+            expired.push_back(timer);
+        }
+    }
+}
+
+void TimerWheel::insert(Timer &timer)
+{
+    unsigned long delta = timer.expires - currentTick;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1UL << ((level + 1) * SLOT_BITS)))
+    {
+        ++level;
+    }
+    if (level == LEVELS - 1 && delta >= (1UL << (LEVELS * SLOT_BITS)))
+    {
+        timer.expires = currentTick + (1UL << (LEVELS * SLOT_BITS)) - 1;
+    }
+
+    Timer &head = slots[level][(timer.expires >> (level * SLOT_BITS)) & SLOT_MASK];
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+void TimerWheel::cascade(int level)
+{
+    Timer &head = slots[level][(currentTick >> (level * SLOT_BITS)) & SLOT_MASK];
+    while (head.next != &head)
+    {
+        Timer *timer = head.next;
+        timer->cancel();
+        insert(*timer);
+    }
+}
@@ -0,0 +1,143 @@
+#include "ByteRangesStream.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <sstream>
+
+// Enough for the socket to take in one splice without holding a large pipe
+static const size_t SPLICE_CHUNK_SIZE = 65536;
+
+ByteRangesStream::ByteRangesStream(int fd, off_t fileSize, const Ranges &ranges,
+                                   const std::string &contentType, const std::string &boundary)
+    : fd(fd), fileSize(fileSize), ranges(ranges), contentType(contentType), boundary(boundary),
+      current(0), inPart(false), partOffset(0), partRemaining(0), finished(false)
+{
+    pipeFds[0] = -1;
+    pipeFds[1] = -1;
+}
+
+ByteRangesStream::~ByteRangesStream()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (pipeFds[0] >= 0)
+    {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+}
+
+// Only reached between parts: the header of the next part, or the closing
+// boundary. Inside a part it means the file could not be spliced.
+bool ByteRangesStream::read(std::string &out, size_t maxBytes)
+{
+    (void)maxBytes;
+    if (finished)
+    {
+        return true;
+    }
+    if (inPart)
+    {
+        return false;
+    }
+
+    if (current == ranges.size())
+    {
+        out += closingBoundary();
+        finished = true;
+        return true;
+    }
+
+    out += partHeader(current);
+    inPart = true;
+    partOffset = ranges[current].first;
+    partRemaining = ranges[current].second;
+    return true;
+}
+
+bool ByteRangesStream::isFinished() const
+{
+    return finished;
+}
+
+// Tops the pipe up from the file while a part is in progress; a part whose
+// bytes have all left the pipe hands over to read() for the next header
+int ByteRangesStream::getSplicePipe(size_t &available)
+{
+    available = 0;
+    if (!inPart)
+    {
+        return -1;
+    }
+
+    if (partRemaining == 0)
+    {
+        if (pipeBytes() > 0)
+        {
+            available = pipeBytes();
+            return pipeFds[0];
+        }
+        inPart = false;
+        ++current;
+        return -1;
+    }
+
+    if (pipeFds[0] < 0 && pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        pipeFds[0] = -1;
+        return -1;
+    }
+
+    size_t length = partRemaining < SPLICE_CHUNK_SIZE ? partRemaining : SPLICE_CHUNK_SIZE;
+    ssize_t spliced = splice(fd, &partOffset, pipeFds[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (spliced > 0)
+    {
+        partRemaining -= static_cast<size_t>(spliced);
+    }
+    else if (spliced == 0 || errno != EAGAIN)
+    {
+        return -1;  // The file shrank or failed under us; read() reports it
+    }
+    available = pipeBytes();
+    return pipeFds[0];
+}
+
+size_t ByteRangesStream::getLength() const
+{
+    size_t length = closingBoundary().size();
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        length += partHeader(i).size() + ranges[i].second;
+    }
+    return length;
+}
+
+std::string ByteRangesStream::partHeader(size_t index) const
+{
+    std::ostringstream header;
+    header << "\r\n--" << boundary << "\r\n"
+           << "Content-Type: " << contentType << "\r\n"
+           << "Content-Range: bytes " << ranges[index].first << "-"
+           << ranges[index].first + static_cast<off_t>(ranges[index].second) - 1 << "/" << fileSize << "\r\n\r\n";
+    return header.str();
+}
+
+std::string ByteRangesStream::closingBoundary() const
+{
+    return "\r\n--" + boundary + "--\r\n";
+}
+
+size_t ByteRangesStream::pipeBytes() const
+{
+    int bytes = 0;
+    if (pipeFds[0] < 0 || ioctl(pipeFds[0], FIONREAD, &bytes) < 0)
+    {
+        return 0;
+    }
+    return static_cast<size_t>(bytes);
+}
@@ -0,0 +1,232 @@
+#include "CgiCacheOperation.hpp"
+#include "HttpResponse.hpp"
+
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+CgiCacheFillOperation::CgiCacheFillOperation(CgiResponseCache &cache, const std::string &key, bool authorized,
+                                             AsyncOperation *operation)
+    : cache(cache), key(key), authorized(authorized), operation(operation), recording(true),
+      headersChecked(false)
+{
+    cache.beginFill(key);
+}
+
+CgiCacheFillOperation::~CgiCacheFillOperation()
+{
+    cleanup();
+    delete operation;
+}
+
+bool CgiCacheFillOperation::isComplete() const
+{
+    return operation->isComplete();
+}
+
+std::string CgiCacheFillOperation::getResult() const
+{
+    return operation->getResult();
+}
+
+int CgiCacheFillOperation::getMonitorFd() const
+{
+    return operation->getMonitorFd();
+}
+
+void CgiCacheFillOperation::handleData()
+{
+    size_t outputBefore = operation->getOutput().size();
+    operation->handleData();
+    record(outputBefore);
+}
+
+std::string &CgiCacheFillOperation::getOutput()
+{
+    return operation->getOutput();
+}
+
+bool CgiCacheFillOperation::hasOutputRoom() const
+{
+    return operation->hasOutputRoom();
+}
+
+// Spliced output would bypass the recording
+int CgiCacheFillOperation::spliceOutput()
+{
+    return recording ? -1 : operation->spliceOutput();
+}
+
+bool CgiCacheFillOperation::needsWrite() const
+{
+    return operation->needsWrite();
+}
+
+void CgiCacheFillOperation::forceCompletion()
+{
+    size_t outputBefore = operation->getOutput().size();
+    operation->forceCompletion();
+    record(outputBefore);
+}
+
+bool CgiCacheFillOperation::hasError() const
+{
+    return operation->hasError();
+}
+
+std::string CgiCacheFillOperation::getError() const
+{
+    return operation->getError();
+}
+
+// An operation cut short (timeout, client gone) stores nothing
+void CgiCacheFillOperation::cleanup()
+{
+    operation->cleanup();
+    if (recording)
+    {
+        finish(NULL);
+    }
+}
+
+// The consumer only ever removes output from the front, so whatever lies
+// past the size before handleData() is new
+void CgiCacheFillOperation::record(size_t outputBefore)
+{
+    if (!recording)
+    {
+        return;
+    }
+
+    const std::string &output = operation->getOutput();
+    if (output.size() > outputBefore)
+    {
+        recorded.append(output, outputBefore, std::string::npos);
+    }
+
+    if (operation->isComplete())
+    {
+        finish(operation->hasError() ? NULL : &recorded);
+        return;
+    }
+
+    // Too big or not cacheable: the cache records a pass for the key
+    if (recorded.size() > cache.getMaxBytes())
+    {
+        finish(&recorded);
+        return;
+    }
+    if (!headersChecked)
+    {
+        size_t headerEnd = HttpResponse::findCgiHeaderEnd(recorded);
+        if (headerEnd != std::string::npos)
+        {
+            headersChecked = true;
+            if (CgiResponseCache::freshnessLifetime(recorded.substr(0, headerEnd), time(NULL), authorized) == 0)
+            {
+                finish(&recorded);
+            }
+        }
+    }
+}
+
+void CgiCacheFillOperation::finish(const std::string *output)
+{
+    recording = false;
+    cache.finishFill(key, output, authorized);
+    std::string().swap(recorded);
+}
+
+CgiCacheWaitOperation::CgiCacheWaitOperation(CgiResponseCache &cache, const std::string &key)
+    : cache(cache), key(key), completed(false), retry(false)
+{
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd >= 0)
+    {
+        cache.addWaiter(key, eventFd);
+    }
+    else
+    {
+        completed = true;
+        errorMessage = std::string("eventfd failed: ") + strerror(errno);
+    }
+}
+
+CgiCacheWaitOperation::~CgiCacheWaitOperation()
+{
+    cleanup();
+}
+
+bool CgiCacheWaitOperation::isComplete() const
+{
+    return completed;
+}
+
+std::string CgiCacheWaitOperation::getResult() const
+{
+    return result;
+}
+
+int CgiCacheWaitOperation::getMonitorFd() const
+{
+    return eventFd;
+}
+
+void CgiCacheWaitOperation::handleData()
+{
+    uint64_t count;
+    if (completed || read(eventFd, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count)))
+    {
+        return;
+    }
+
+    completed = true;
+    bool passed;
+    const std::string *cached = cache.lookup(key, passed);
+    if (cached)
+    {
+        result = *cached;
+    }
+    else
+    {
+        retry = true;
+    }
+}
+
+std::string &CgiCacheWaitOperation::getOutput()
+{
+    return result;
+}
+
+bool CgiCacheWaitOperation::hasOutputRoom() const
+{
+    return true;
+}
+
+bool CgiCacheWaitOperation::shouldRetry() const
+{
+    return retry;
+}
+
+bool CgiCacheWaitOperation::hasError() const
+{
+    return !errorMessage.empty();
+}
+
+std::string CgiCacheWaitOperation::getError() const
+{
+    return errorMessage;
+}
+
+void CgiCacheWaitOperation::cleanup()
+{
+    if (eventFd >= 0)
+    {
+        cache.removeWaiter(key, eventFd);
+        close(eventFd);
+        eventFd = -1;
+    }
+}
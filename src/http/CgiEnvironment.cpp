@@ -0,0 +1,74 @@
+#include "CgiEnvironment.hpp"
+
+#include <cctype>
+#include <sstream>
+
+std::vector<std::string> buildCgiEnvironmentTemplate(const std::string &documentRoot, size_t clientMaxBodySize)
+{
+    std::vector<std::string> envVars;
+    
+    envVars.push_back("GATEWAY_INTERFACE=CGI/1.1");
+    envVars.push_back("SERVER_SOFTWARE=WebServ/1.0");
+    envVars.push_back("SERVER_PROTOCOL=HTTP/1.1");
+    envVars.push_back("SERVER_NAME=localhost");
+    envVars.push_back("PATH_INFO=");
+    envVars.push_back("PATH_TRANSLATED=");
+    envVars.push_back("DOCUMENT_ROOT=" + documentRoot);
+    envVars.push_back("REDIRECT_STATUS=CGI");
+    
+    // Pass client max body size to CGI scripts
+    std::ostringstream maxBodySize;
+    maxBodySize << clientMaxBodySize;
+    envVars.push_back("CLIENT_MAX_BODY_SIZE=" + maxBodySize.str());
+    
+    return envVars;
+}
+
+void appendRequestEnvironment(std::vector<std::string> &envVars, const HttpRequest &request,
+                              const std::string &scriptPath, const std::string &serverPort,
+                              const std::string &clientAddress, size_t bodyLength)
+{
+    envVars.reserve(envVars.size() + 12 + request.getHeaderCount());
+    envVars.push_back("SERVER_PORT=" + serverPort);
+    envVars.push_back("REQUEST_METHOD=" + request.getMethod());
+    envVars.push_back("SCRIPT_NAME=" + request.getUri());
+    envVars.push_back("SCRIPT_FILENAME=" + scriptPath);
+    envVars.push_back("QUERY_STRING=" + request.getQuery());
+    envVars.push_back("REMOTE_ADDR=" + clientAddress);
+    envVars.push_back("REMOTE_HOST=" + clientAddress);
+    envVars.push_back("REQUEST_URI=" + request.getUri());
+    
+    if (request.getMethod() == "POST") {
+        std::string contentType = request.getHeader("Content-Type");
+        if (contentType.empty()) {
+            contentType = "application/x-www-form-urlencoded";
+        }
+        envVars.push_back("CONTENT_TYPE=" + contentType);
+        
+        std::ostringstream contentLength;
+        contentLength << bodyLength;
+        envVars.push_back("CONTENT_LENGTH=" + contentLength.str());
+    }
+    
+    // Pass all HTTP headers as HTTP_* environment variables (CGI spec requirement)
+    for (size_t h = 0; h < request.getHeaderCount(); ++h) {
+        std::string headerName = request.getHeaderName(h);
+        std::string headerValue = request.getHeaderValue(h);
+        
+        // Convert header name to CGI format: "User-Agent" -> "HTTP_USER_AGENT"
+        for (size_t i = 0; i < headerName.length(); ++i) {
+            if (headerName[i] == '-') {
+                headerName[i] = '_';
+            } else {
+                headerName[i] = std::toupper(headerName[i]);
+            }
+        }
+        
+        // Skip Content-Type and Content-Length (already handled above); the
+        // script always gets a decoded body, so the transfer coding is dropped
+        if (headerName != "CONTENT_TYPE" && headerName != "CONTENT_LENGTH" &&
+            headerName != "TRANSFER_ENCODING") {
+            envVars.push_back("HTTP_" + headerName + "=" + headerValue);
+        }
+    }
+}
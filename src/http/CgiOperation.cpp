@@ -1,30 +1,44 @@
 #include "CgiOperation.hpp"
 #include <iostream>
-#include <sstream>
 #include <vector>
 #include <cstdlib>
 #include <cstring>
 #include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
 
+static void closePipe(int pipeFds[2])
+{
+    for (int i = 0; i < 2; ++i) {
+        if (pipeFds[i] >= 0) {
+            close(pipeFds[i]);
+            pipeFds[i] = -1;
+        }
+    }
+}
+
 CgiOperation::CgiOperation(const std::string& scriptPath, const std::string& interpreterPath, 
-                           const HttpRequest& request, const std::string& documentRoot,
-                           const std::string& serverPort, const std::string& clientAddr,
-                           size_t clientMaxBodySize)
+                           const HttpRequest& request, const std::vector<std::string>& environment)
     : childPid(-1), outputFd(-1), inputFd(-1), errorFd(-1),
-      completed(false), error(false), 
-      scriptPath(scriptPath), interpreterPath(interpreterPath), documentRoot(documentRoot),
-      serverPort(serverPort), clientAddress(clientAddr), clientMaxBodySize(clientMaxBodySize)
+      completed(false), error(false), outputEof(false), outputSpliced(false), postDataOffset(0),
+      scriptPath(scriptPath), interpreterPath(interpreterPath)
 {
     
+    // A spooled body is handed to the child as its stdin file directly
     if (request.getMethod() == "POST") {
-        postData = request.getBody();
+        if (request.isBodySpooled()) {
+            bodyFilePath = request.getBodyFilePath();
+        } else {
+            postData = request.getBody();
+        }
     }
     
-    if (!startCgiProcess(request)) {
+    if (!startCgiProcess(environment)) {
         error = true;
         completed = true;
         errorMessage = "Failed to start CGI process";
@@ -59,11 +73,44 @@ void CgiOperation::handleData()
         writePostData();
     }
 
-    readFromProcess();
+    if (!outputSpliced) {
+        readFromProcess();
+    }
     
-    if (checkProcessStatus()) {
+    // EOF on stdout ends the output even if the child has not been reaped
+    // yet. Without EOF, an exited child only counts as done once the pipe
+    // has been drained, which a full output buffer may have prevented.
+    if (outputEof) {
+        checkProcessStatus();
         completed = true;
+    } else if (hasOutputRoom() && checkProcessStatus()) {
+        completed = true;
+    }
+}
+
+std::string &CgiOperation::getOutput()
+{
+    return result;
+}
+
+bool CgiOperation::hasOutputRoom() const
+{
+    if (outputSpliced) {
+        int pending = 0;
+        return ioctl(outputFd, FIONREAD, &pending) < 0 || pending == 0;
+    }
+    return result.size() < OUTPUT_BUFFER_LIMIT;
+}
+
+// Past the header block the output only needs forwarding, so the pipe is
+// spliced straight into the client socket instead of being read here
+int CgiOperation::spliceOutput()
+{
+    if (outputFd < 0 || outputEof || !result.empty()) {
+        return -1;
     }
+    outputSpliced = true;
+    return outputFd;
 }
 
 bool CgiOperation::hasError() const
@@ -94,156 +141,114 @@ void CgiOperation::cleanup()
     if (childPid > 0) {
         int status;
         if (waitpid(childPid, &status, WNOHANG) == 0) {
-            kill(childPid, SIGTERM);
+            // SIGKILL: a stalled script may ignore SIGTERM and the wait below blocks
+            kill(childPid, SIGKILL);
             waitpid(childPid, &status, 0);
         }
         childPid = -1;
     }
 }
 
-bool CgiOperation::startCgiProcess(const HttpRequest& request)
+// posix_spawn() runs the child on the parent's memory until it execs
+// (CLONE_VFORK in glibc), so unlike fork() no page tables are copied and
+// the launch cost does not grow with the server's heap.
+bool CgiOperation::startCgiProcess(const std::vector<std::string>& environment)
 {
-    int pipeStdout[2], pipeStdin[2], pipeStderr[2];
+    int pipeStdout[2] = {-1, -1};
+    int pipeStdin[2] = {-1, -1};
+    int pipeStderr[2] = {-1, -1};
     
-    if (pipe(pipeStdout) == -1 || pipe(pipeStdin) == -1 || pipe(pipeStderr) == -1) {
+    // Every descriptor is close-on-exec; dup'ing the child's ends onto 0-2
+    // clears the flag on those copies only. Without a body to write, stdin
+    // is /dev/null instead of a pipe.
+    if (pipe2(pipeStdout, O_CLOEXEC) == -1 || pipe2(pipeStderr, O_CLOEXEC) == -1 ||
+        (!postData.empty() && pipe2(pipeStdin, O_CLOEXEC) == -1)) {
         std::cerr << "CgiOperation: Failed to create pipes: " << strerror(errno) << std::endl;
+        closePipe(pipeStdout);
+        closePipe(pipeStdin);
+        closePipe(pipeStderr);
         return false;
     }
+
+    int bodyFd = -1;
+    if (!bodyFilePath.empty()) {
+        bodyFd = open(bodyFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (bodyFd < 0) {
+            std::cerr << "CgiOperation: Failed to open request body: " << strerror(errno) << std::endl;
+            closePipe(pipeStdout);
+            closePipe(pipeStdin);
+            closePipe(pipeStderr);
+            return false;
+        }
+    }
     
-    childPid = fork();
-    if (childPid == -1) {
-        std::cerr << "CgiOperation: Fork failed: " << strerror(errno) << std::endl;
-        close(pipeStdout[0]); close(pipeStdout[1]);
-        close(pipeStdin[0]); close(pipeStdin[1]);
-        close(pipeStderr[0]); close(pipeStderr[1]);
-        return false;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeStdout[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipeStderr[1], STDERR_FILENO);
+    if (bodyFd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, bodyFd, STDIN_FILENO);
+    } else if (pipeStdin[0] >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, pipeStdin[0], STDIN_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
     }
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 34)
+    // Listening and client sockets are not close-on-exec
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+#endif
+
+    // The server ignores SIGPIPE; scripts get the default back
+    posix_spawnattr_t attributes;
+    sigset_t defaultSignals;
+    posix_spawnattr_init(&attributes);
+    sigemptyset(&defaultSignals);
+    sigaddset(&defaultSignals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaultSignals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
     
-    if (childPid == 0) {
-        
-        dup2(pipeStdout[1], STDOUT_FILENO);
-        dup2(pipeStdin[0], STDIN_FILENO);
-        dup2(pipeStderr[1], STDERR_FILENO);
-        
-        close(pipeStdout[0]); close(pipeStdout[1]);
-        close(pipeStdin[0]); close(pipeStdin[1]);
-        close(pipeStderr[0]); close(pipeStderr[1]);
-        
-        char** env = createCgiEnvironment(request);
-        
-        if (interpreterPath.empty()) {
-            char* argv[] = {const_cast<char*>(scriptPath.c_str()), NULL};
-            execve(scriptPath.c_str(), argv, env);
-        } else {
-            char* argv[] = {const_cast<char*>(interpreterPath.c_str()), const_cast<char*>(scriptPath.c_str()), NULL};
-            execve(interpreterPath.c_str(), argv, env);
-        }
-        
-        freeCgiEnvironment(env);
-        std::cerr << "CgiOperation: exec failed: " << strerror(errno) << std::endl;
-        exit(1);
+    std::vector<char*> env;
+    env.reserve(environment.size() + 1);
+    for (size_t i = 0; i < environment.size(); ++i) {
+        env.push_back(const_cast<char*>(environment[i].c_str()));
+    }
+    env.push_back(NULL);
+    
+    const std::string& program = interpreterPath.empty() ? scriptPath : interpreterPath;
+    char* argv[] = {const_cast<char*>(program.c_str()), const_cast<char*>(scriptPath.c_str()), NULL};
+    if (interpreterPath.empty()) {
+        argv[1] = NULL;
     }
     
+    int status = posix_spawn(&childPid, program.c_str(), &actions, &attributes, argv, &env[0]);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
     
     close(pipeStdout[1]);
-    close(pipeStdin[0]);
     close(pipeStderr[1]);
+    if (pipeStdin[0] >= 0) close(pipeStdin[0]);
+    if (bodyFd >= 0) close(bodyFd);
     
     outputFd = pipeStdout[0];
     inputFd = pipeStdin[1];
     errorFd = pipeStderr[0];
+
+    // glibc reports a failed exec here rather than through the exit status
+    if (status != 0) {
+        std::cerr << "CgiOperation: Failed to start " << program << ": " << strerror(status) << std::endl;
+        childPid = -1;
+        return false;
+    }
     
-    if (!setNonBlocking(outputFd) || !setNonBlocking(inputFd) || !setNonBlocking(errorFd)) {
+    if (!setNonBlocking(outputFd) || (inputFd >= 0 && !setNonBlocking(inputFd)) || !setNonBlocking(errorFd)) {
         std::cerr << "CgiOperation: Failed to set non-blocking mode" << std::endl;
         return false;
     }
     return true;
 }
 
-char** CgiOperation::createCgiEnvironment(const HttpRequest& request)
-{
-    std::vector<std::string> envVars;
-    
-    envVars.push_back("GATEWAY_INTERFACE=CGI/1.1");
-    envVars.push_back("SERVER_SOFTWARE=WebServ/1.0");
-    envVars.push_back("SERVER_PROTOCOL=HTTP/1.1");
-    envVars.push_back("SERVER_NAME=localhost");
-    envVars.push_back("SERVER_PORT=" + serverPort);
-    envVars.push_back("REQUEST_METHOD=" + request.getMethod());
-    envVars.push_back("SCRIPT_NAME=" + request.getUri());
-    envVars.push_back("SCRIPT_FILENAME=" + scriptPath);
-    envVars.push_back("QUERY_STRING=" + request.getQuery());
-    envVars.push_back("REMOTE_ADDR=" + clientAddress);
-    envVars.push_back("REMOTE_HOST=" + clientAddress);
-    envVars.push_back("PATH_INFO=");
-    envVars.push_back("PATH_TRANSLATED=");
-    envVars.push_back("REQUEST_URI=" + request.getUri());
-    envVars.push_back("DOCUMENT_ROOT=" + documentRoot);
-    envVars.push_back("REDIRECT_STATUS=CGI");
-    
-    // Pass client max body size to CGI scripts
-    std::ostringstream maxBodySize;
-    maxBodySize << clientMaxBodySize;
-    envVars.push_back("CLIENT_MAX_BODY_SIZE=" + maxBodySize.str());
-    
-    if (request.getMethod() == "POST") {
-        std::string contentType = request.getHeader("Content-Type");
-        if (contentType.empty()) {
-            contentType = "application/x-www-form-urlencoded";
-        }
-        envVars.push_back("CONTENT_TYPE=" + contentType);
-        
-        std::ostringstream contentLength;
-        contentLength << postData.length();
-        envVars.push_back("CONTENT_LENGTH=" + contentLength.str());
-    }
-    
-    // Pass all HTTP headers as HTTP_* environment variables (CGI spec requirement)
-    const std::map<std::string, std::string>& headers = request.getHeaders();
-    for (std::map<std::string, std::string>::const_iterator it = headers.begin(); 
-         it != headers.end(); ++it) {
-        std::string headerName = it->first;
-        std::string headerValue = it->second;
-        
-        // Convert header name to CGI format: "User-Agent" -> "HTTP_USER_AGENT"
-        for (size_t i = 0; i < headerName.length(); ++i) {
-            if (headerName[i] == '-') {
-                headerName[i] = '_';
-            } else {
-                headerName[i] = std::toupper(headerName[i]);
-            }
-        }
-        
-        // Skip Content-Type and Content-Length (already handled above)
-        if (headerName != "CONTENT_TYPE" && headerName != "CONTENT_LENGTH") {
-            envVars.push_back("HTTP_" + headerName + "=" + headerValue);
-        }
-    }
-    
-    char **env = new char*[envVars.size() + 1];
-    for (size_t i = 0; i < envVars.size(); ++i) {
-        size_t len = envVars[i].length();
-        env[i] = new char[len + 1];
-        for (size_t j = 0; j < len; ++j) {
-            env[i][j] = envVars[i][j];
-        }
-        env[i][len] = '\0';
-    }
-    env[envVars.size()] = NULL;
-    
-    return env;
-}
-
-void CgiOperation::freeCgiEnvironment(char** env)
-{
-    if (!env) return;
-    
-    for (int i = 0; env[i] != NULL; ++i) {
-        delete[] env[i];
-    }
-    delete[] env;
-}
-
 bool CgiOperation::setNonBlocking(int fd)
 {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -262,37 +267,48 @@ bool CgiOperation::setNonBlocking(int fd)
 
 void CgiOperation::readFromProcess()
 {
-    ssize_t bytesRead = read(outputFd, readBuffer, BUFFER_SIZE - 1);
-    
-    if (bytesRead > 0) {
-        readBuffer[bytesRead] = '\0';
-        result += std::string(readBuffer, bytesRead);
-    } else if (bytesRead == 0) {
-    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
-        error = true;
-        errorMessage = "Error reading from CGI process";
+    // Drain the pipe until EAGAIN so the fd can be watched edge-triggered,
+    // but stop once the output buffer is full: the caller then stops
+    // watching the pipe until the client has taken some of it.
+    while (result.size() < OUTPUT_BUFFER_LIMIT) {
+        ssize_t bytesRead = read(outputFd, readBuffer, BUFFER_SIZE);
+        
+        if (bytesRead > 0) {
+            result.append(readBuffer, bytesRead);
+        } else if (bytesRead == 0) {
+            outputEof = true;
+            break;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                error = true;
+                errorMessage = "Error reading from CGI process";
+            }
+            break;
+        }
     }
 }
 
+// The body is written from an offset; erasing the written part would move
+// the rest of it on every write
 void CgiOperation::writePostData()
 {
-    if (postData.empty() && inputFd < 0) return;
+    if (postData.empty() || inputFd < 0) return;
     
-    if (!postData.empty() && inputFd >= 0) {
-        ssize_t bytesWritten = write(inputFd, postData.c_str(), postData.length());
+    ssize_t bytesWritten = write(inputFd, postData.data() + postDataOffset, postData.length() - postDataOffset);
+    
+    if (bytesWritten > 0) {
+        postDataOffset += bytesWritten;
         
-        if (bytesWritten > 0) {
-            postData.erase(0, bytesWritten);
-            
-            if (postData.empty() && inputFd >= 0) {
-                close(inputFd);
-                inputFd = -1;
-            }
-        } else if (bytesWritten == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            std::cerr << "CgiOperation: Write error: " << strerror(errno) << std::endl;
+        if (postDataOffset == postData.length()) {
             close(inputFd);
             inputFd = -1;
+            postData.clear();
+            postDataOffset = 0;
         }
+    } else if (bytesWritten == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "CgiOperation: Write error: " << strerror(errno) << std::endl;
+        close(inputFd);
+        inputFd = -1;
     }
 }
 
@@ -0,0 +1,207 @@
+#include "CgiResponseCache.hpp"
+#include "HttpResponse.hpp"
+#include "OpenFileCache.hpp"
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+CgiResponseCache::CgiResponseCache(size_t maxBytes)
+    : maxBytes(maxBytes), usedBytes(0)
+{
+}
+
+CgiResponseCache::~CgiResponseCache()
+{
+}
+
+std::string CgiResponseCache::makeKey(const HttpRequest &request)
+{
+    std::string key = request.getMethod();
+    key += ' ';
+    key += request.getHeader("Host");
+    key += ' ';
+    key += request.getUri();
+    if (!request.getQuery().empty())
+    {
+        key += '?';
+        key += request.getQuery();
+    }
+    return key;
+}
+
+const std::string *CgiResponseCache::lookup(const std::string &key, bool &passed)
+{
+    passed = false;
+    std::map<std::string, EntryList::iterator>::iterator it = index.find(key);
+    if (it == index.end())
+        return NULL;
+
+    if (it->second->expires <= time(NULL))
+    {
+        evict(it);
+        return NULL;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    if (it->second->pass)
+    {
+        passed = true;
+        return NULL;
+    }
+    return &it->second->output;
+}
+
+void CgiResponseCache::clear()
+{
+    entries.clear();
+    index.clear();
+    usedBytes = 0;
+}
+
+bool CgiResponseCache::isFilling(const std::string &key) const
+{
+    return fills.find(key) != fills.end();
+}
+
+void CgiResponseCache::beginFill(const std::string &key)
+{
+    fills[key];
+}
+
+void CgiResponseCache::addWaiter(const std::string &key, int eventFd)
+{
+    fills[key].push_back(eventFd);
+}
+
+void CgiResponseCache::removeWaiter(const std::string &key, int eventFd)
+{
+    std::map<std::string, std::vector<int> >::iterator it = fills.find(key);
+    if (it == fills.end())
+        return;
+    std::vector<int> &waiters = it->second;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), eventFd), waiters.end());
+}
+
+// Waiters look the key up again once woken; without an entry they run the
+// request themselves, and a pass entry keeps them from queueing behind a
+// new fill one at a time. What a request with credentials got says nothing
+// about the others, so it leaves no pass entry behind.
+void CgiResponseCache::finishFill(const std::string &key, const std::string *output, bool authorized)
+{
+    std::map<std::string, std::vector<int> >::iterator it = fills.find(key);
+    if (it == fills.end())
+        return;
+
+    if (output)
+    {
+        time_t now = time(NULL);
+        size_t headerEnd = HttpResponse::findCgiHeaderEnd(*output);
+        long lifetime = headerEnd == std::string::npos ? 0 :
+                        freshnessLifetime(output->substr(0, headerEnd), now, authorized);
+        if (lifetime > 0 && key.size() + output->size() <= maxBytes)
+            store(key, *output, false, now + lifetime);
+        else if (!authorized)
+            store(key, std::string(), true, now + PASS_SECONDS);
+    }
+
+    const std::vector<int> &waiters = it->second;
+    for (size_t i = 0; i < waiters.size(); ++i)
+    {
+        uint64_t one = 1;
+        write(waiters[i], &one, sizeof(one));
+    }
+    fills.erase(it);
+}
+
+// Only shared responses that say how long they stay fresh are reused:
+// 200s without cookies, with s-maxage, max-age or a future Expires. A
+// response that varies on request headers (Vary: * included) would be
+// served to requests it was not made for, and one to a request with
+// Authorization needs public or s-maxage to be shared at all.
+long CgiResponseCache::freshnessLifetime(const std::string &headers, time_t now, bool authorized)
+{
+    HttpResponse response;
+    response.setCgiHeaders(headers);
+    if (response.getStatusCode() != 200 || response.hasHeader("Set-Cookie") || response.hasHeader("Vary"))
+        return 0;
+
+    std::string cacheControl = response.getHeader("Cache-Control");
+    for (size_t i = 0; i < cacheControl.size(); ++i)
+    {
+        cacheControl[i] = std::tolower(static_cast<unsigned char>(cacheControl[i]));
+    }
+
+    long maxAge = -1;
+    long sharedMaxAge = -1;
+    bool isPublic = false;
+    size_t start = 0;
+    while (start < cacheControl.size())
+    {
+        size_t end = cacheControl.find(',', start);
+        if (end == std::string::npos)
+            end = cacheControl.size();
+        size_t first = cacheControl.find_first_not_of(" \t", start);
+        std::string directive = first < end ? cacheControl.substr(first, end - first) : "";
+        directive.erase(directive.find_last_not_of(" \t") + 1);
+        start = end + 1;
+
+        if (directive == "no-store" || directive == "no-cache" || directive == "private")
+            return 0;
+        if (directive == "public")
+            isPublic = true;
+        else if (directive.compare(0, 8, "max-age=") == 0)
+            maxAge = std::atol(directive.c_str() + 8);
+        else if (directive.compare(0, 9, "s-maxage=") == 0)
+            sharedMaxAge = std::atol(directive.c_str() + 9);
+    }
+    if (authorized && !isPublic && sharedMaxAge < 0)
+        return 0;
+    if (sharedMaxAge >= 0)
+        return sharedMaxAge;
+    if (maxAge >= 0)
+        return maxAge;
+
+    // An Expires that cannot be parsed means already expired
+    time_t expires = OpenFileCache::parseHttpDate(response.getHeader("Expires"));
+    if (expires < 0)
+        return 0;
+    long lifetime = static_cast<long>(expires - now);
+    return lifetime > 0 ? lifetime : 0;
+}
+
+size_t CgiResponseCache::getMaxBytes() const
+{
+    return maxBytes;
+}
+
+void CgiResponseCache::store(const std::string &key, const std::string &output, bool pass, time_t expires)
+{
+    std::map<std::string, EntryList::iterator>::iterator it = index.find(key);
+    if (it != index.end())
+        evict(it);
+
+    size_t size = key.size() + output.size();
+    while (!entries.empty() && usedBytes + size > maxBytes)
+    {
+        evict(index.find(entries.back().key));
+    }
+
+    entries.push_front(Entry());
+    Entry &entry = entries.front();
+    entry.key = key;
+    entry.output = output;
+    entry.pass = pass;
+    entry.expires = expires;
+    index[key] = entries.begin();
+    usedBytes += size;
+}
+
+void CgiResponseCache::evict(std::map<std::string, EntryList::iterator>::iterator it)
+{
+    usedBytes -= it->second->key.size() + it->second->output.size();
+    entries.erase(it->second);
+    index.erase(it);
+}
@@ -0,0 +1,231 @@
+#include "CgiWorkerPool.hpp"
+#include "FastCgiPool.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+extern char **environ;
+
+CgiWorkerPool::CgiWorkerPool() : depleted(false)
+{
+}
+
+CgiWorkerPool::~CgiWorkerPool()
+{
+    clear();
+
+    // Busy workers are still running scripts for requests nobody will read
+    for (std::map<int, pid_t>::iterator it = leased.begin(); it != leased.end(); ++it)
+    {
+        kill(it->second, SIGKILL);
+        waitpid(it->second, NULL, 0);
+    }
+    leased.clear();
+}
+
+std::string CgiWorkerPool::makeKey(const std::string &interpreter, const std::string &worker)
+{
+    return interpreter + " " + worker;
+}
+
+void CgiWorkerPool::configure(const std::string &interpreter, const std::string &worker,
+                              size_t minIdle, size_t maxIdle)
+{
+    Pool &pool = pools[makeKey(interpreter, worker)];
+    pool.interpreter = interpreter;
+    pool.worker = worker;
+    if (minIdle > pool.minIdle)
+        pool.minIdle = minIdle;
+    if (maxIdle > pool.maxIdle)
+        pool.maxIdle = maxIdle;
+}
+
+void CgiWorkerPool::warmUp()
+{
+    depleted = false;
+    for (std::map<std::string, Pool>::iterator it = pools.begin(); it != pools.end(); ++it)
+    {
+        fill(it->second);
+    }
+}
+
+void CgiWorkerPool::refill()
+{
+    if (depleted)
+    {
+        warmUp();
+    }
+}
+
+int CgiWorkerPool::acquire(const std::string &key, bool &connecting)
+{
+    connecting = false;
+    reap();
+
+    std::map<std::string, Pool>::iterator it = pools.find(key);
+    if (it == pools.end())
+        return -1;
+    Pool &pool = it->second;
+
+    // The most recently used worker comes first; one that died while idle
+    // (a script that called exit in-process, a crash) is dropped here
+    Worker worker;
+    worker.fd = -1;
+    while (!pool.idle.empty())
+    {
+        Worker candidate = pool.idle.back();
+        pool.idle.pop_back();
+        if (FastCgiPool::isAlive(candidate.fd))
+        {
+            worker = candidate;
+            break;
+        }
+        retire(candidate, true);
+    }
+
+    // A fresh worker buffers the request in its socket while it starts up
+    if (worker.fd < 0 && !spawn(pool, worker))
+        return -1;
+    leased[worker.fd] = worker.pid;
+
+    // Topped up by refill() once the events at hand are dispatched
+    if (pool.idle.size() < pool.minIdle)
+        depleted = true;
+    return worker.fd;
+}
+
+// Each worker serves only the request it was leased for, so there is no
+// queue to account for
+void CgiWorkerPool::responded(const std::string & /* key */)
+{
+}
+
+void CgiWorkerPool::release(const std::string &key, int fd, bool reusable)
+{
+    std::map<int, pid_t>::iterator lease = leased.find(fd);
+    if (lease == leased.end())
+    {
+        close(fd);
+        return;
+    }
+    Worker worker;
+    worker.fd = fd;
+    worker.pid = lease->second;
+    leased.erase(lease);
+
+    std::map<std::string, Pool>::iterator it = pools.find(key);
+    if (reusable && it != pools.end() && it->second.idle.size() < it->second.maxIdle)
+        it->second.idle.push_back(worker);
+    else
+        // A worker cut off mid-request (timeout, client gone) may still be
+        // running the script, so it is killed rather than asked to exit
+        retire(worker, !reusable);
+    reap();
+}
+
+void CgiWorkerPool::clear()
+{
+    for (std::map<std::string, Pool>::iterator it = pools.begin(); it != pools.end(); ++it)
+    {
+        for (size_t i = 0; i < it->second.idle.size(); ++i)
+        {
+            retire(it->second.idle[i], true);
+        }
+        it->second.idle.clear();
+    }
+    for (size_t i = 0; i < exiting.size(); ++i)
+    {
+        waitpid(exiting[i], NULL, 0);
+    }
+    exiting.clear();
+}
+
+// Spawned like a plain CGI (see CgiOperation::startCgiProcess), so the cost
+// does not grow with the server's heap. A worker whose webserv worker dies
+// sees its socket close and exits on its own.
+bool CgiWorkerPool::spawn(const Pool &pool, Worker &worker)
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+    {
+        std::cerr << "CGI pool: socketpair failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pair[1], STDIN_FILENO);
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 34)
+    // Listening and client sockets are not close-on-exec
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+#endif
+
+    // The server ignores SIGPIPE; workers get the default back
+    posix_spawnattr_t attributes;
+    sigset_t defaultSignals;
+    posix_spawnattr_init(&attributes);
+    sigemptyset(&defaultSignals);
+    sigaddset(&defaultSignals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaultSignals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    char *argv[] = {const_cast<char *>(pool.interpreter.c_str()), const_cast<char *>(pool.worker.c_str()), NULL};
+    int status = posix_spawn(&pid, pool.interpreter.c_str(), &actions, &attributes, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+
+    close(pair[1]);
+    if (status != 0)
+    {
+        std::cerr << "CGI pool: Failed to start " << pool.interpreter << ": " << strerror(status) << std::endl;
+        close(pair[0]);
+        return false;
+    }
+    fcntl(pair[0], F_SETFL, O_NONBLOCK);
+    worker.fd = pair[0];
+    worker.pid = pid;
+    return true;
+}
+
+void CgiWorkerPool::fill(Pool &pool)
+{
+    while (pool.idle.size() < pool.minIdle)
+    {
+        Worker worker;
+        if (!spawn(pool, worker))
+            return;
+        pool.idle.push_back(worker);
+    }
+}
+
+// Closing the socket is enough for a worker to exit on its own; force is
+// for one that may be stuck in a script
+void CgiWorkerPool::retire(const Worker &worker, bool force)
+{
+    close(worker.fd);
+    if (force)
+        kill(worker.pid, SIGKILL);
+    exiting.push_back(worker.pid);
+}
+
+void CgiWorkerPool::reap()
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < exiting.size(); ++i)
+    {
+        if (waitpid(exiting[i], NULL, WNOHANG) == 0)
+            exiting[kept++] = exiting[i];
+    }
+    exiting.resize(kept);
+}
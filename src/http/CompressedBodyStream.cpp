@@ -0,0 +1,274 @@
+#include "CompressedBodyStream.hpp"
+
+#include <strings.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+// Input compressed by one read() before whatever the encoder holds back is
+// flushed out, so highly compressible data cannot keep it busy for long
+static const size_t MAX_INPUT_PER_READ = 262144;
+static const size_t OUTPUT_BUFFER_SIZE = 16384;
+// Brotli's default 4 MB window is a lot of memory per connection
+static const int BROTLI_WINDOW_BITS = 19;
+
+CompressedBodyStream::CompressedBodyStream(Coding coding, int level, BodyStream *source)
+    : coding(coding), brotli(NULL), initialized(false), finished(false), unflushed(false),
+      source(source), fd(-1), offset(0), remaining(0), bodyOffset(0)
+{
+    init(level);
+}
+
+CompressedBodyStream::CompressedBodyStream(Coding coding, int level, int fd, off_t offset, size_t length)
+    : coding(coding), brotli(NULL), initialized(false), finished(false), unflushed(false),
+      source(NULL), fd(fd), offset(offset), remaining(length), bodyOffset(0)
+{
+    init(level);
+}
+
+CompressedBodyStream::CompressedBodyStream(Coding coding, int level, const std::string &body)
+    : coding(coding), brotli(NULL), initialized(false), finished(false), unflushed(false),
+      source(NULL), fd(-1), offset(0), remaining(0), body(body), bodyOffset(0)
+{
+    init(level);
+}
+
+CompressedBodyStream::~CompressedBodyStream()
+{
+    if (initialized && coding == GZIP)
+    {
+        deflateEnd(&zstream);
+    }
+    if (brotli)
+    {
+        BrotliEncoderDestroyInstance(brotli);
+    }
+    delete source;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void CompressedBodyStream::init(int level)
+{
+    if (coding == GZIP)
+    {
+        std::memset(&zstream, 0, sizeof(zstream));
+        // 15 + 16: the largest window, with a gzip header and trailer
+        initialized = deflateInit2(&zstream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        return;
+    }
+
+    brotli = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    if (brotli)
+    {
+        BrotliEncoderSetParameter(brotli, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(level));
+        BrotliEncoderSetParameter(brotli, BROTLI_PARAM_LGWIN, BROTLI_WINDOW_BITS);
+        initialized = true;
+    }
+}
+
+// Compresses input until some output exists, the producer runs dry or the
+// body ends. Output held back by the encoder is flushed whenever the
+// producer has nothing more for now, so the client is never kept waiting
+// for bytes that were already produced.
+bool CompressedBodyStream::read(std::string &out, size_t maxBytes)
+{
+    if (finished)
+    {
+        return true;
+    }
+    if (!initialized)
+    {
+        return false;
+    }
+
+    size_t start = out.size();
+    size_t consumed = 0;
+    while (true)
+    {
+        bool sourceDone;
+        input.clear();
+        if (!readInput(maxBytes, sourceDone))
+        {
+            return false;
+        }
+        consumed += input.size();
+
+        Flush flush = FLUSH_NONE;
+        if (sourceDone)
+        {
+            flush = FLUSH_FINISH;
+        }
+        else if ((unflushed || !input.empty()) && (!isReady() || consumed >= MAX_INPUT_PER_READ))
+        {
+            flush = FLUSH_SYNC;
+        }
+
+        if ((!input.empty() || flush != FLUSH_NONE) && !encode(input.data(), input.size(), flush, out))
+        {
+            return false;
+        }
+        unflushed = flush == FLUSH_NONE && (unflushed || !input.empty());
+
+        if (flush == FLUSH_FINISH)
+        {
+            finished = true;
+            return true;
+        }
+        if (out.size() > start || !isReady())
+        {
+            return true;
+        }
+    }
+}
+
+bool CompressedBodyStream::isFinished() const
+{
+    return finished;
+}
+
+bool CompressedBodyStream::isReady() const
+{
+    return finished || !source || source->isReady() || source->isFinished();
+}
+
+bool CompressedBodyStream::readInput(size_t maxBytes, bool &sourceDone)
+{
+    if (source)
+    {
+        if (!source->read(input, maxBytes))
+        {
+            return false;
+        }
+        sourceDone = source->isFinished();
+        return true;
+    }
+
+    if (fd >= 0)
+    {
+        size_t length = remaining < maxBytes ? remaining : maxBytes;
+        if (length > 0)
+        {
+            input.resize(length);
+            ssize_t bytesRead = pread(fd, &input[0], length, offset);
+            if (bytesRead <= 0)
+            {
+                return false;  // The file shrank or failed under us
+            }
+            input.resize(static_cast<size_t>(bytesRead));
+            offset += bytesRead;
+            remaining -= static_cast<size_t>(bytesRead);
+        }
+        sourceDone = remaining == 0;
+        return true;
+    }
+
+    size_t length = body.size() - bodyOffset < maxBytes ? body.size() - bodyOffset : maxBytes;
+    input.assign(body, bodyOffset, length);
+    bodyOffset += length;
+    sourceDone = bodyOffset == body.size();
+    return true;
+}
+
+bool CompressedBodyStream::encode(const char *data, size_t length, Flush flush, std::string &out)
+{
+    unsigned char buffer[OUTPUT_BUFFER_SIZE];
+
+    if (coding == GZIP)
+    {
+        int mode = flush == FLUSH_FINISH ? Z_FINISH : (flush == FLUSH_SYNC ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        zstream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        zstream.avail_in = static_cast<uInt>(length);
+        // A full output buffer means deflate may have more to write
+        do
+        {
+            zstream.next_out = buffer;
+            zstream.avail_out = sizeof(buffer);
+            if (deflate(&zstream, mode) == Z_STREAM_ERROR)
+            {
+                return false;
+            }
+            out.append(reinterpret_cast<char *>(buffer), sizeof(buffer) - zstream.avail_out);
+        } while (zstream.avail_out == 0);
+        return true;
+    }
+
+    BrotliEncoderOperation operation = flush == FLUSH_FINISH ? BROTLI_OPERATION_FINISH :
+                                       (flush == FLUSH_SYNC ? BROTLI_OPERATION_FLUSH : BROTLI_OPERATION_PROCESS);
+    const uint8_t *nextIn = reinterpret_cast<const uint8_t *>(data);
+    size_t availIn = length;
+    while (true)
+    {
+        uint8_t *nextOut = buffer;
+        size_t availOut = sizeof(buffer);
+        if (!BrotliEncoderCompressStream(brotli, operation, &availIn, &nextIn, &availOut, &nextOut, NULL))
+        {
+            return false;
+        }
+        out.append(reinterpret_cast<char *>(buffer), sizeof(buffer) - availOut);
+        if (availIn == 0 && !BrotliEncoderHasMoreOutput(brotli) &&
+            (operation != BROTLI_OPERATION_FINISH || BrotliEncoderIsFinished(brotli)))
+        {
+            return true;
+        }
+    }
+}
+
+const char *CompressedBodyStream::codingName(Coding coding)
+{
+    return coding == GZIP ? "gzip" : "br";
+}
+
+// A listed coding wins over "*"; either is refused by a q-value of zero
+bool CompressedBodyStream::accepts(const std::string &acceptEncoding, Coding coding)
+{
+    const char *name = codingName(coding);
+    int listed = -1;
+    int wildcard = -1;
+    size_t start = 0;
+    while (start < acceptEncoding.size())
+    {
+        size_t end = acceptEncoding.find(',', start);
+        if (end == std::string::npos)
+            end = acceptEncoding.size();
+        std::string element = acceptEncoding.substr(start, end - start);
+        start = end + 1;
+
+        size_t semicolon = element.find(';');
+        std::string token = element.substr(0, semicolon);
+        size_t first = token.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            continue;
+        token = token.substr(first, token.find_last_not_of(" \t") - first + 1);
+
+        bool allowed = true;
+        if (semicolon != std::string::npos)
+        {
+            size_t q = element.find("q=", semicolon);
+            if (q != std::string::npos)
+                allowed = std::strtod(element.c_str() + q + 2, NULL) > 0;
+        }
+
+        if (strcasecmp(token.c_str(), name) == 0)
+            listed = allowed;
+        else if (token == "*")
+            wildcard = allowed;
+    }
+    return listed >= 0 ? listed == 1 : wildcard == 1;
+}
+
+bool CompressedBodyStream::compress(Coding coding, int level, const std::string &body, std::string &out)
+{
+    CompressedBodyStream stream(coding, level, body);
+    while (!stream.isFinished())
+    {
+        if (!stream.read(out, INPUT_CHUNK_SIZE))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,309 @@
+#include "DirectoryListing.hpp"
+
+#include <fcntl.h>
+
+#include <cstdio>
+
+DirectoryListing::DirectoryListing(const struct stat &dirStat)
+    : device(dirStat.st_dev), inode(dirStat.st_ino), mtime(dirStat.st_mtim),
+      startedAt(time(NULL)), complete(false), references(1)
+{
+}
+
+DirectoryListing::~DirectoryListing()
+{
+}
+
+void DirectoryListing::retain()
+{
+    ++references;
+}
+
+void DirectoryListing::release()
+{
+    if (--references == 0)
+    {
+        delete this;
+    }
+}
+
+bool DirectoryListing::isCurrent(const struct stat &dirStat) const
+{
+    return complete && dirStat.st_dev == device && dirStat.st_ino == inode &&
+           dirStat.st_mtim.tv_sec == mtime.tv_sec && dirStat.st_mtim.tv_nsec == mtime.tv_nsec &&
+           mtime.tv_sec < startedAt;
+}
+
+void DirectoryListing::add(const Entry &entry)
+{
+    entries.push_back(entry);
+}
+
+void DirectoryListing::markComplete()
+{
+    complete = true;
+}
+
+const std::vector<DirectoryListing::Entry> &DirectoryListing::getEntries() const
+{
+    return entries;
+}
+
+DirectoryListingCache::DirectoryListingCache()
+{
+}
+
+DirectoryListingCache::~DirectoryListingCache()
+{
+    clear();
+}
+
+DirectoryListing *DirectoryListingCache::lookup(const std::string &path, const struct stat &dirStat)
+{
+    std::map<std::string, EntryList::iterator>::iterator it = index.find(path);
+    if (it == index.end())
+        return NULL;
+
+    DirectoryListing *listing = it->second->second;
+    if (!listing->isCurrent(dirStat))
+    {
+        return NULL;  // Stale, or still being read; the next store() replaces it
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    listing->retain();
+    return listing;
+}
+
+void DirectoryListingCache::store(const std::string &path, DirectoryListing *listing)
+{
+    std::map<std::string, EntryList::iterator>::iterator it = index.find(path);
+    if (it != index.end())
+        evict(it);
+
+    while (entries.size() >= MAX_DIRECTORIES)
+    {
+        evict(index.find(entries.back().first));
+    }
+
+    listing->retain();
+    entries.push_front(std::make_pair(path, listing));
+    index[path] = entries.begin();
+}
+
+void DirectoryListingCache::clear()
+{
+    while (!entries.empty())
+    {
+        evict(index.find(entries.back().first));
+    }
+}
+
+void DirectoryListingCache::evict(std::map<std::string, EntryList::iterator>::iterator it)
+{
+    it->second->second->release();
+    entries.erase(it->second);
+    index.erase(it);
+}
+
+DirectoryListingStream::DirectoryListingStream(const std::string &dirPath, Format format,
+                                               DirectoryListing *listing)
+    : dirPath(dirPath), format(format), listing(listing), dir(NULL), next(0), sent(0), stage(STAGE_HEADER)
+{
+    listing->retain();
+}
+
+DirectoryListingStream::DirectoryListingStream(const std::string &dirPath, Format format,
+                                               DirectoryListing *listing, DIR *dir)
+    : dirPath(dirPath), format(format), listing(listing), dir(dir), next(0), sent(0), stage(STAGE_HEADER)
+{
+    listing->retain();
+}
+
+DirectoryListingStream::~DirectoryListingStream()
+{
+    if (dir)
+    {
+        closedir(dir);
+    }
+    listing->release();
+}
+
+bool DirectoryListingStream::read(std::string &out, size_t maxBytes)
+{
+    size_t limit = out.size() + maxBytes;
+
+    if (stage == STAGE_HEADER)
+    {
+        appendHeader(out);
+        stage = STAGE_ENTRIES;
+    }
+
+    const std::vector<DirectoryListing::Entry> &entries = listing->getEntries();
+    while (stage == STAGE_ENTRIES && out.size() < limit)
+    {
+        if (dir)
+        {
+            DirectoryListing::Entry entry;
+            if (!readEntry(entry))
+            {
+                closedir(dir);
+                dir = NULL;
+                listing->markComplete();
+                appendFooter(out);
+                stage = STAGE_DONE;
+                break;
+            }
+            appendEntry(out, entry);
+            listing->add(entry);
+        }
+        else if (next < entries.size())
+        {
+            appendEntry(out, entries[next++]);
+        }
+        else
+        {
+            appendFooter(out);
+            stage = STAGE_DONE;
+        }
+    }
+    return true;
+}
+
+bool DirectoryListingStream::isFinished() const
+{
+    return stage == STAGE_DONE;
+}
+
+// Entries are stat'ed relative to the open directory, which spares the
+// kernel a walk of the full path for each of them
+bool DirectoryListingStream::readEntry(DirectoryListing::Entry &entry)
+{
+    struct dirent *dirEntry;
+    do
+    {
+        dirEntry = readdir(dir);
+        if (!dirEntry)
+        {
+            return false;
+        }
+    } while (dirEntry->d_name[0] == '.' && (dirEntry->d_name[1] == '\0' ||
+             (dirEntry->d_name[1] == '.' && dirEntry->d_name[2] == '\0')));  // Skip . and ..
+
+    struct stat fileStat;
+    entry.name = dirEntry->d_name;
+    entry.isDirectory = false;
+    entry.size = -1;
+    if (fstatat(dirfd(dir), dirEntry->d_name, &fileStat, 0) == 0)
+    {
+        entry.isDirectory = S_ISDIR(fileStat.st_mode);
+        if (!entry.isDirectory)
+        {
+            entry.size = fileStat.st_size;
+        }
+    }
+    return true;
+}
+
+void DirectoryListingStream::appendHeader(std::string &out) const
+{
+    if (format == FORMAT_JSON)
+    {
+        out += "[";
+        return;
+    }
+
+    out += "<!DOCTYPE html>\n";
+    out += "<html>\n<head>\n";
+    out += "<title>Index of " + dirPath + "</title>\n";
+    out += "<style>\n";
+    out += "body { font-family: Arial, sans-serif; margin: 40px; }\n";
+    out += "h1 { color: #333; }\n";
+    out += "table { border-collapse: collapse; width: 100%; }\n";
+    out += "th, td { text-align: left; padding: 8px; border-bottom: 1px solid #ddd; }\n";
+    out += "th { background-color: #f2f2f2; }\n";
+    out += "a { text-decoration: none; color: #0066cc; }\n";
+    out += "a:hover { text-decoration: underline; }\n";
+    out += "</style>\n";
+    out += "</head>\n<body>\n";
+    out += "<h1>Index of " + dirPath + "</h1>\n";
+    out += "<table>\n";
+    out += "<tr><th>Name</th><th>Size</th><th>Type</th></tr>\n";
+}
+
+void DirectoryListingStream::appendEntry(std::string &out, const DirectoryListing::Entry &entry)
+{
+    char sizeBuf[32];
+    std::snprintf(sizeBuf, sizeof(sizeBuf), "%lld", static_cast<long long>(entry.size));
+
+    if (format == FORMAT_JSON)
+    {
+        out += sent > 0 ? ",\n{\"name\":" : "\n{\"name\":";
+        appendJsonString(out, entry.name);
+        out += entry.isDirectory ? ",\"type\":\"directory\"" : ",\"type\":\"file\"";
+        if (entry.size >= 0)
+        {
+            out += ",\"size\":";
+            out += sizeBuf;
+        }
+        out += "}";
+        ++sent;
+        return;
+    }
+
+    out += "<tr><td><a href=\"";
+    out += entry.name;
+    if (entry.isDirectory)
+        out += "/";
+    out += "\">";
+    out += entry.name;
+    out += "</a></td><td>";
+    if (entry.size >= 0)
+    {
+        out += sizeBuf;
+        out += " bytes";
+    }
+    else
+    {
+        out += "-";
+    }
+    out += "</td><td>";
+    out += entry.isDirectory ? "Directory" : "File";
+    out += "</td></tr>\n";
+    ++sent;
+}
+
+void DirectoryListingStream::appendFooter(std::string &out) const
+{
+    if (format == FORMAT_JSON)
+    {
+        out += "\n]\n";
+        return;
+    }
+    out += "</table>\n</body>\n</html>\n";
+}
+
+// Names are bytes; only the characters JSON cannot carry as they are get escaped
+void DirectoryListingStream::appendJsonString(std::string &out, const std::string &value)
+{
+    out += '"';
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(value[i]);
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += static_cast<char>(c);
+        }
+        else if (c < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+        {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
@@ -0,0 +1,358 @@
+#include "FastCgiOperation.hpp"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// Record layout and constants from the FastCGI 1.0 specification
+static const unsigned char FCGI_VERSION_1 = 1;
+static const unsigned char FCGI_BEGIN_REQUEST = 1;
+static const unsigned char FCGI_END_REQUEST = 3;
+static const unsigned char FCGI_PARAMS = 4;
+static const unsigned char FCGI_STDIN = 5;
+static const unsigned char FCGI_STDOUT = 6;
+static const unsigned char FCGI_STDERR = 7;
+static const unsigned char FCGI_RESPONDER = 1;
+static const unsigned char FCGI_KEEP_CONN = 1;
+static const unsigned char FCGI_REQUEST_COMPLETE = 0;
+static const size_t FCGI_HEADER_LEN = 8;
+
+// Only one request is ever in flight on a connection
+static const unsigned int REQUEST_ID = 1;
+
+FastCgiOperation::FastCgiOperation(UpstreamPool &pool, const std::string &address,
+                                   const std::vector<std::string> &params, const HttpRequest &request)
+    : pool(pool),
+      address(address),
+      socketFd(-1),
+      connecting(false),
+      awaitingResponse(false),
+      completed(false),
+      error(false),
+      ended(false),
+      outgoingOffset(0),
+      bodyFd(-1)
+{
+    char begin[8] = {0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0};
+    appendRecord(FCGI_BEGIN_REQUEST, begin, sizeof(begin));
+    appendParams(params);
+
+    // A spooled body is streamed from its file once the socket takes it
+    if (request.getMethod() == "POST" && request.isBodySpooled())
+    {
+        bodyFd = open(request.getBodyFilePath().c_str(), O_RDONLY | O_CLOEXEC);
+        if (bodyFd < 0)
+        {
+            fail("Failed to open request body");
+            return;
+        }
+    }
+    else
+    {
+        if (request.getMethod() == "POST")
+            appendStream(FCGI_STDIN, request.getBody());
+        appendRecord(FCGI_STDIN, NULL, 0);
+    }
+
+    socketFd = pool.acquire(address, connecting);
+    if (socketFd < 0)
+        fail("Failed to connect to FastCGI application");
+    else
+        awaitingResponse = true;
+}
+
+FastCgiOperation::~FastCgiOperation()
+{
+    cleanup();
+}
+
+bool FastCgiOperation::isComplete() const
+{
+    return completed;
+}
+
+std::string FastCgiOperation::getResult() const
+{
+    return result;
+}
+
+int FastCgiOperation::getMonitorFd() const
+{
+    return socketFd;
+}
+
+void FastCgiOperation::handleData()
+{
+    if (completed)
+        return;
+
+    if (connecting)
+    {
+        int socketError = 0;
+        socklen_t length = sizeof(socketError);
+        if (getsockopt(socketFd, SOL_SOCKET, SO_ERROR, &socketError, &length) < 0 || socketError != 0)
+        {
+            fail("Failed to connect to FastCGI application");
+            return;
+        }
+        connecting = false;
+    }
+
+    if (!flushOutgoing())
+    {
+        fail("Error writing to FastCGI application");
+        return;
+    }
+    readFromApplication();
+}
+
+std::string &FastCgiOperation::getOutput()
+{
+    return result;
+}
+
+bool FastCgiOperation::hasOutputRoom() const
+{
+    return result.size() < OUTPUT_BUFFER_LIMIT;
+}
+
+bool FastCgiOperation::needsWrite() const
+{
+    return !completed && (connecting || outgoingOffset < outgoing.size() || bodyFd >= 0);
+}
+
+bool FastCgiOperation::hasError() const
+{
+    return error;
+}
+
+std::string FastCgiOperation::getError() const
+{
+    return errorMessage;
+}
+
+// The connection is only reusable when both directions are at a record
+// boundary; anything else (an aborted request, a protocol error) closes it
+void FastCgiOperation::cleanup()
+{
+    if (bodyFd >= 0)
+    {
+        close(bodyFd);
+        bodyFd = -1;
+    }
+    if (awaitingResponse)
+    {
+        pool.responded(address);
+        awaitingResponse = false;
+    }
+    if (socketFd >= 0)
+    {
+        pool.release(address, socketFd, ended && incoming.empty() && outgoingOffset == outgoing.size());
+        socketFd = -1;
+    }
+}
+
+void FastCgiOperation::appendRecord(unsigned char type, const char *content, size_t length)
+{
+    char header[FCGI_HEADER_LEN] = {
+        static_cast<char>(FCGI_VERSION_1),
+        static_cast<char>(type),
+        static_cast<char>((REQUEST_ID >> 8) & 0xff),
+        static_cast<char>(REQUEST_ID & 0xff),
+        static_cast<char>((length >> 8) & 0xff),
+        static_cast<char>(length & 0xff),
+        0,
+        0};
+    outgoing.append(header, FCGI_HEADER_LEN);
+    if (length > 0)
+        outgoing.append(content, length);
+}
+
+// Splits a stream into records of at most MAX_RECORD_CONTENT bytes. The
+// empty record that closes the stream is appended separately.
+void FastCgiOperation::appendStream(unsigned char type, const std::string &content)
+{
+    for (size_t offset = 0; offset < content.size(); offset += MAX_RECORD_CONTENT)
+    {
+        size_t length = content.size() - offset;
+        if (length > MAX_RECORD_CONTENT)
+            length = MAX_RECORD_CONTENT;
+        appendRecord(type, content.data() + offset, length);
+    }
+}
+
+// Name-value pairs: lengths below 128 take one byte, longer ones four with
+// the high bit set
+void FastCgiOperation::appendParams(const std::vector<std::string> &params)
+{
+    std::string encoded;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        size_t separator = params[i].find('=');
+        if (separator == std::string::npos)
+            continue;
+
+        size_t lengths[2] = {separator, params[i].size() - separator - 1};
+        for (int j = 0; j < 2; ++j)
+        {
+            if (lengths[j] < 128)
+            {
+                encoded += static_cast<char>(lengths[j]);
+            }
+            else
+            {
+                encoded += static_cast<char>(((lengths[j] >> 24) & 0x7f) | 0x80);
+                encoded += static_cast<char>((lengths[j] >> 16) & 0xff);
+                encoded += static_cast<char>((lengths[j] >> 8) & 0xff);
+                encoded += static_cast<char>(lengths[j] & 0xff);
+            }
+        }
+        encoded.append(params[i], 0, separator);
+        encoded.append(params[i], separator + 1, std::string::npos);
+    }
+    appendStream(FCGI_PARAMS, encoded);
+    appendRecord(FCGI_PARAMS, NULL, 0);
+}
+
+// Encodes the next piece of a spooled body, or the end of FCGI_STDIN
+bool FastCgiOperation::refillOutgoing()
+{
+    outgoing.clear();
+    outgoingOffset = 0;
+
+    ssize_t bytesRead = read(bodyFd, readBuffer, BUFFER_SIZE);
+    if (bytesRead < 0)
+        return false;
+    if (bytesRead == 0)
+    {
+        close(bodyFd);
+        bodyFd = -1;
+        appendRecord(FCGI_STDIN, NULL, 0);
+        return true;
+    }
+    appendRecord(FCGI_STDIN, readBuffer, bytesRead);
+    return true;
+}
+
+bool FastCgiOperation::flushOutgoing()
+{
+    while (true)
+    {
+        if (outgoingOffset == outgoing.size())
+        {
+            if (bodyFd < 0)
+                return true;
+            if (!refillOutgoing())
+                return false;
+        }
+
+        ssize_t written = send(socketFd, outgoing.data() + outgoingOffset,
+                               outgoing.size() - outgoingOffset, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        outgoingOffset += written;
+    }
+}
+
+// Drains the socket like CgiOperation drains its pipe: until EAGAIN, or
+// until the output buffer is full and the caller stops polling
+void FastCgiOperation::readFromApplication()
+{
+    parseRecords();
+
+    while (!completed && hasOutputRoom())
+    {
+        ssize_t bytesRead = recv(socketFd, readBuffer, BUFFER_SIZE, 0);
+        if (bytesRead > 0)
+        {
+            if (awaitingResponse)
+            {
+                pool.responded(address);
+                awaitingResponse = false;
+            }
+            incoming.append(readBuffer, bytesRead);
+            parseRecords();
+        }
+        else if (bytesRead == 0)
+        {
+            fail("FastCGI application closed the connection");
+        }
+        else if (errno != EINTR)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fail("Error reading from FastCGI application");
+            break;
+        }
+    }
+}
+
+void FastCgiOperation::parseRecords()
+{
+    size_t offset = 0;
+
+    while (!completed && incoming.size() - offset >= FCGI_HEADER_LEN)
+    {
+        const unsigned char *header = reinterpret_cast<const unsigned char *>(incoming.data() + offset);
+        size_t contentLength = (header[4] << 8) | header[5];
+        size_t recordLength = FCGI_HEADER_LEN + contentLength + header[6];
+        if (header[0] != FCGI_VERSION_1)
+        {
+            fail("Malformed FastCGI record");
+            return;
+        }
+        if (incoming.size() - offset < recordLength)
+            break;
+
+        const char *content = incoming.data() + offset + FCGI_HEADER_LEN;
+        unsigned int requestId = (header[2] << 8) | header[3];
+        offset += recordLength;
+
+        // Management records (request id 0) are not used by this client
+        if (requestId != REQUEST_ID)
+            continue;
+
+        if (header[1] == FCGI_STDOUT)
+        {
+            result.append(content, contentLength);
+        }
+        else if (header[1] == FCGI_STDERR)
+        {
+            if (contentLength > 0)
+                std::cerr << "FastCGI: " << std::string(content, contentLength) << std::endl;
+        }
+        else if (header[1] == FCGI_END_REQUEST && contentLength >= 8)
+        {
+            const unsigned char *body = reinterpret_cast<const unsigned char *>(content);
+            unsigned long appStatus = (static_cast<unsigned long>(body[0]) << 24) | (body[1] << 16) |
+                                      (body[2] << 8) | body[3];
+            ended = true;
+            completed = true;
+            if (body[4] != FCGI_REQUEST_COMPLETE)
+            {
+                error = true;
+                errorMessage = "FastCGI application rejected the request";
+            }
+            else if (appStatus != 0)
+            {
+                error = true;
+                errorMessage = "FastCGI application exited with non-zero status";
+            }
+        }
+    }
+    incoming.erase(0, offset);
+}
+
+void FastCgiOperation::fail(const std::string &message)
+{
+    error = true;
+    completed = true;
+    errorMessage = message;
+}
@@ -0,0 +1,172 @@
+#include "FastCgiPool.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+FastCgiPool::FastCgiPool() : maxIdle(0)
+{
+}
+
+FastCgiPool::~FastCgiPool()
+{
+    clear();
+}
+
+void FastCgiPool::configure(size_t maxIdle)
+{
+    clear();
+    this->maxIdle = maxIdle;
+}
+
+int FastCgiPool::acquire(const std::string &address, bool &connecting)
+{
+    Upstream &upstream = upstreams[address];
+    connecting = false;
+
+    // The application may have dropped a parked connection (idle timeout,
+    // worker recycling); those are found here rather than mid-request
+    while (!upstream.idle.empty())
+    {
+        int fd = upstream.idle.back();
+        upstream.idle.pop_back();
+        if (isAlive(fd))
+        {
+            ++upstream.waiting;
+            return fd;
+        }
+        close(fd);
+    }
+
+    if (!upstream.resolved && !resolve(address, upstream))
+        return -1;
+    int fd = connectTo(upstream, connecting);
+    if (fd >= 0)
+        ++upstream.waiting;
+    return fd;
+}
+
+void FastCgiPool::responded(const std::string &address)
+{
+    Upstream &upstream = upstreams[address];
+    if (upstream.waiting > 0)
+        --upstream.waiting;
+}
+
+// Applications like php-fpm tie a worker to each connection until it is
+// closed. While another request has had no answer it may be sitting in the
+// accept queue behind parked connections, so the connection is closed to
+// free its worker instead.
+void FastCgiPool::release(const std::string &address, int fd, bool reusable)
+{
+    Upstream &upstream = upstreams[address];
+    if (!reusable || upstream.idle.size() >= maxIdle || upstream.waiting > 0)
+    {
+        close(fd);
+        return;
+    }
+    upstream.idle.push_back(fd);
+}
+
+void FastCgiPool::clear()
+{
+    for (std::map<std::string, Upstream>::iterator it = upstreams.begin(); it != upstreams.end(); ++it)
+    {
+        for (size_t i = 0; i < it->second.idle.size(); ++i)
+        {
+            close(it->second.idle[i]);
+        }
+        it->second.idle.clear();
+    }
+}
+
+bool FastCgiPool::resolve(const std::string &address, Upstream &upstream)
+{
+    std::memset(&upstream.addr, 0, sizeof(upstream.addr));
+
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        std::string path = address.substr(5);
+        struct sockaddr_un *un = reinterpret_cast<struct sockaddr_un *>(&upstream.addr);
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+        {
+            std::cerr << "FastCGI: invalid socket path " << path << std::endl;
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+        upstream.addrLength = sizeof(struct sockaddr_un);
+        upstream.resolved = true;
+        return true;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+    {
+        std::cerr << "FastCGI: invalid address " << address << std::endl;
+        return false;
+    }
+
+    struct addrinfo hints;
+    struct addrinfo *info;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int status = getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &info);
+    if (status != 0)
+    {
+        std::cerr << "FastCGI: cannot resolve " << address << ": " << gai_strerror(status) << std::endl;
+        return false;
+    }
+    std::memcpy(&upstream.addr, info->ai_addr, info->ai_addrlen);
+    upstream.addrLength = info->ai_addrlen;
+    upstream.resolved = true;
+    freeaddrinfo(info);
+    return true;
+}
+
+int FastCgiPool::connectTo(const Upstream &upstream, bool &connecting)
+{
+    int fd = socket(upstream.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        std::cerr << "FastCGI: socket failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    // Records are written whole, so there is nothing for Nagle to coalesce
+    if (upstream.addr.ss_family != AF_UNIX)
+    {
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+    if (connect(fd, reinterpret_cast<const struct sockaddr *>(&upstream.addr), upstream.addrLength) == 0)
+        return fd;
+
+    // A UNIX socket whose backlog is full reports EAGAIN; treat it like a refusal
+    if (errno == EINPROGRESS)
+    {
+        connecting = true;
+        return fd;
+    }
+    std::cerr << "FastCGI: connect failed: " << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+}
+
+// A parked connection has nothing in flight, so any readable state
+// (EOF, an error, stray data) means it cannot be reused
+bool FastCgiPool::isAlive(int fd)
+{
+    char probe;
+    ssize_t result = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
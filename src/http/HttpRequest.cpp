@@ -1,40 +1,459 @@
 #include "HttpRequest.hpp"
 
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <sstream>
 
 HttpRequest::HttpRequest()
     : requestComplete(false),
-      headersParsed(false)
+      headersParsed(false),
+      parseState(PARSE_REQUEST_LINE),
+      headerBytes(0),
+      bodyRemaining(0),
+      errorCode(400),
+      bodySetupDone(false),
+      chunkedBody(false),
+      chunkState(CHUNK_SIZE),
+      bodyLimit(0),
+      bodySpoolThreshold(0),
+      bodyFd(-1),
+      bodySize(0)
 {
 }
 
 HttpRequest::~HttpRequest()
 {
+    discardBodyFile();
 }
 
-bool HttpRequest::parseRequest(const std::string &rawRequest)
+// Consumes bytes of the request as they arrive and returns how many were used.
+// Every byte is looked at once: partial lines wait in lineBuffer until their
+// newline shows up. Parsing stops at the end of the request so that bytes of
+// a following (pipelined) request are left to the caller.
+size_t HttpRequest::feed(const char *data, size_t length)
 {
-    // Only parse the request - don't validate
-    if (!parseRequestLine(rawRequest))
+    size_t consumed = 0;
+
+    while (consumed < length && parseState != PARSE_COMPLETE && parseState != PARSE_ERROR)
+    {
+        if (parseState == PARSE_BODY)
+        {
+            // The caller decides where the body goes once it has seen the headers
+            if (!bodySetupDone)
+                break;
+
+            if (chunkedBody)
+            {
+                consumed += feedChunked(data + consumed, length - consumed);
+                continue;
+            }
+
+            size_t chunk = length - consumed;
+            if (chunk > bodyRemaining)
+                chunk = bodyRemaining;
+            if (!appendBody(data + consumed, chunk))
+            {
+                parseState = PARSE_ERROR;
+                return consumed + chunk;
+            }
+            consumed += chunk;
+            bodyRemaining -= chunk;
+            if (bodyRemaining == 0)
+            {
+                parseState = PARSE_COMPLETE;
+                requestComplete = true;
+            }
+            continue;
+        }
+
+        const char *start = data + consumed;
+        const char *newline = static_cast<const char *>(std::memchr(start, '\n', length - consumed));
+        size_t chunk = newline ? static_cast<size_t>(newline - start) + 1 : length - consumed;
+
+        headerBytes += chunk;
+        if (headerBytes > MAX_HEADER_SIZE)
+        {
+            parseState = PARSE_ERROR;
+            return consumed + chunk;
+        }
+
+        consumed += chunk;
+        if (!newline)
+        {
+            lineBuffer.append(start, chunk);
+            break;
+        }
+
+        lineBuffer.append(start, chunk - 1);
+        if (!lineBuffer.empty() && lineBuffer[lineBuffer.length() - 1] == '\r')
+        {
+            lineBuffer.erase(lineBuffer.length() - 1);
+        }
+
+        if (!parseLine(lineBuffer))
+        {
+            parseState = PARSE_ERROR;
+        }
+        lineBuffer.clear();
+    }
+
+    return consumed;
+}
+
+// Decodes a chunked body (RFC 9112 section 7.1). Size lines and trailers
+// are collected in lineBuffer like header lines; chunk data goes straight
+// to appendBody. Chunk extensions and trailer fields are ignored.
+size_t HttpRequest::feedChunked(const char *data, size_t length)
+{
+    size_t consumed = 0;
+
+    while (consumed < length && parseState == PARSE_BODY)
+    {
+        if (chunkState == CHUNK_DATA)
+        {
+            size_t chunk = length - consumed;
+            if (chunk > bodyRemaining)
+                chunk = bodyRemaining;
+            if (!appendBody(data + consumed, chunk))
+            {
+                parseState = PARSE_ERROR;
+                return consumed + chunk;
+            }
+            consumed += chunk;
+            bodyRemaining -= chunk;
+            if (bodyRemaining == 0)
+                chunkState = CHUNK_DATA_END;
+            continue;
+        }
+
+        const char *start = data + consumed;
+        const char *newline = static_cast<const char *>(std::memchr(start, '\n', length - consumed));
+        size_t chunk = newline ? static_cast<size_t>(newline - start) + 1 : length - consumed;
+
+        if (lineBuffer.size() + chunk > MAX_CHUNK_LINE_SIZE)
+        {
+            parseState = PARSE_ERROR;
+            return consumed + chunk;
+        }
+
+        consumed += chunk;
+        if (!newline)
+        {
+            lineBuffer.append(start, chunk);
+            break;
+        }
+
+        lineBuffer.append(start, chunk - 1);
+        if (!lineBuffer.empty() && lineBuffer[lineBuffer.length() - 1] == '\r')
+        {
+            lineBuffer.erase(lineBuffer.length() - 1);
+        }
+
+        if (!parseChunkLine(lineBuffer))
+        {
+            parseState = PARSE_ERROR;
+        }
+        lineBuffer.clear();
+    }
+
+    return consumed;
+}
+
+bool HttpRequest::parseChunkLine(const std::string &line)
+{
+    switch (chunkState)
     {
-        requestComplete = false;
+    case CHUNK_SIZE:
+    {
+        size_t size = 0;
+        size_t i = 0;
+        for (; i < line.size() && std::isxdigit(static_cast<unsigned char>(line[i])); ++i)
+        {
+            if (size > (static_cast<size_t>(-1) >> 4))
+            {
+                errorCode = 413;
+                return false;
+            }
+            char digit = line[i];
+            size = size * 16 + (std::isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : (digit | 0x20) - 'a' + 10);
+        }
+        if (i == 0 || (i < line.size() && line[i] != ';' && line[i] != ' ' && line[i] != '\t'))
+            return false;
+
+        if (size == 0)
+        {
+            chunkState = CHUNK_TRAILER;
+            return true;
+        }
+        if (size > bodyLimit - bodySize)
+        {
+            errorCode = 413;
+            return false;
+        }
+        bodyRemaining = size;
+        chunkState = CHUNK_DATA;
+        return true;
+    }
+    case CHUNK_DATA_END:
+        if (!line.empty())
+            return false;
+        chunkState = CHUNK_SIZE;
+        return true;
+    case CHUNK_TRAILER:
+        if (line.empty())
+        {
+            parseState = PARSE_COMPLETE;
+            requestComplete = true;
+            return true;
+        }
+        headerBytes += line.size();
+        return headerBytes <= MAX_HEADER_SIZE;
+    default:
+        return false;
+    }
+}
+
+bool HttpRequest::needsBodySetup() const
+{
+    return parseState == PARSE_BODY && !bodySetupDone;
+}
+
+void HttpRequest::setupBody(size_t maxBodySize, size_t spoolThreshold)
+{
+    bodySetupDone = true;
+    bodyLimit = maxBodySize;
+    bodySpoolThreshold = spoolThreshold;
+
+    // A chunked body has no announced size: it starts in memory and is
+    // moved to disk by appendBody once it outgrows the threshold
+    if (chunkedBody)
+        return;
+
+    if (bodyRemaining > maxBodySize)
+    {
+        errorCode = 413;
+        parseState = PARSE_ERROR;
+        return;
+    }
+
+    if (bodyRemaining <= spoolThreshold)
+    {
+        body.reserve(bodyRemaining);
+        return;
+    }
+
+    if (!startSpool())
+        parseState = PARSE_ERROR;
+}
+
+bool HttpRequest::startSpool()
+{
+    char path[] = "/tmp/webserv_body_XXXXXX";
+    bodyFd = mkostemp(path, O_CLOEXEC);
+    if (bodyFd < 0)
+    {
+        std::cerr << "Failed to create request body file: " << strerror(errno) << std::endl;
+        errorCode = 500;
+        return false;
+    }
+    bodyFilePath = path;
+    return true;
+}
+
+bool HttpRequest::appendBody(const char *data, size_t length)
+{
+    if (length > bodyLimit - bodySize)
+    {
+        errorCode = 413;
         return false;
     }
 
-    if (!parseHeaders(rawRequest))
+    if (bodyFd < 0 && body.size() + length > bodySpoolThreshold)
+    {
+        if (!startSpool() || !writeSpool(body.data(), body.size()))
+            return false;
+        body.clear();
+    }
+
+    if (bodyFd < 0)
+    {
+        body.append(data, length);
+    }
+    else if (!writeSpool(data, length))
+    {
+        return false;
+    }
+    bodySize += length;
+    return true;
+}
+
+bool HttpRequest::writeSpool(const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(bodyFd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Failed to write request body file: " << strerror(errno) << std::endl;
+            errorCode = 500;
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+void HttpRequest::discardBodyFile()
+{
+    if (bodyFd >= 0)
+    {
+        close(bodyFd);
+        bodyFd = -1;
+    }
+    if (!bodyFilePath.empty())
+    {
+        unlink(bodyFilePath.c_str());
+        bodyFilePath.clear();
+    }
+}
+
+bool HttpRequest::isBodySpooled() const
+{
+    return !bodyFilePath.empty();
+}
+
+const std::string &HttpRequest::getBodyFilePath() const
+{
+    return bodyFilePath;
+}
+
+size_t HttpRequest::getBodySize() const
+{
+    return bodySize;
+}
+
+// Returns the body as a string, loading it back from the spool file if needed
+std::string HttpRequest::readBody() const
+{
+    if (!isBodySpooled())
+        return body;
+
+    std::string content;
+    int fd = open(bodyFilePath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return content;
+
+    content.reserve(bodySize);
+    char buffer[65536];
+    ssize_t bytesRead;
+    while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        content.append(buffer, bytesRead);
+    }
+    close(fd);
+    return content;
+}
+
+// The spool file is created 0600; once moved into place it gets the 0644
+// that a body written out from memory gets, and is no longer owned here
+bool HttpRequest::moveBodyFile(const std::string &path)
+{
+    if (bodyFd < 0 || fchmod(bodyFd, 0644) < 0)
+        return false;
+    if (rename(bodyFilePath.c_str(), path.c_str()) < 0)
     {
-        requestComplete = false;
+        fchmod(bodyFd, 0600);
         return false;
     }
+    releaseBodyFile();
+    return true;
+}
+
+// Gives up ownership of the spool file (e.g. after renaming it into place)
+std::string HttpRequest::releaseBodyFile()
+{
+    std::string path = bodyFilePath;
+    if (bodyFd >= 0)
+    {
+        close(bodyFd);
+        bodyFd = -1;
+    }
+    bodyFilePath.clear();
+    return path;
+}
+
+bool HttpRequest::parseLine(const std::string &line)
+{
+    if (parseState == PARSE_REQUEST_LINE)
+    {
+        // Empty lines before the request line are ignored (RFC 7230 3.5)
+        if (line.empty())
+            return true;
+        if (!parseRequestLine(line))
+            return false;
+        parseState = PARSE_HEADERS;
+        return true;
+    }
+
+    if (line.empty())
+        return finishHeaders();
+
+    return parseHeader(line);
+}
+
+bool HttpRequest::finishHeaders()
+{
+    headersParsed = true;
+
+    bool hasContentLength = hasHeader("Content-Length");
+    std::string transferEncoding = getHeader("Transfer-Encoding");
+    if (!transferEncoding.empty())
+    {
+        // Both framings at once is a request smuggling vector; refuse it
+        if (hasContentLength)
+            return false;
+        for (size_t i = 0; i < transferEncoding.size(); ++i)
+            transferEncoding[i] = std::tolower(static_cast<unsigned char>(transferEncoding[i]));
+        if (transferEncoding != "chunked")
+        {
+            errorCode = 501;
+            return false;
+        }
+        chunkedBody = true;
+        chunkState = CHUNK_SIZE;
+        parseState = PARSE_BODY;
+        return true;
+    }
 
-    if (!parseBody(rawRequest))
+    if (!hasContentLength)
+    {
+        bodyRemaining = 0;
+    }
+    else if (!parseContentLength(getHeader("Content-Length"), bodyRemaining))
     {
-        requestComplete = false;
         return false;
     }
 
-    requestComplete = true;
+    if (bodyRemaining > 0)
+    {
+        parseState = PARSE_BODY;
+    }
+    else
+    {
+        parseState = PARSE_COMPLETE;
+        requestComplete = true;
+    }
     return true;
 }
 
@@ -63,16 +482,44 @@ bool HttpRequest::isComplete() const
     return requestComplete;
 }
 
+bool HttpRequest::hasError() const
+{
+    return parseState == PARSE_ERROR;
+}
+
+int HttpRequest::getErrorCode() const
+{
+    return errorCode;
+}
+
+HttpRequest::ParseState HttpRequest::getParseState() const
+{
+    return parseState;
+}
+
 void HttpRequest::reset()
 {
     method.clear();
     uri.clear();
     version.clear();
     query.clear();
-    headers.clear();
+    headerArena.clear();
+    headerFields.clear();
     body.clear();
     requestComplete = false;
     headersParsed = false;
+    parseState = PARSE_REQUEST_LINE;
+    lineBuffer.clear();
+    headerBytes = 0;
+    bodyRemaining = 0;
+    errorCode = 400;
+    bodySetupDone = false;
+    chunkedBody = false;
+    chunkState = CHUNK_SIZE;
+    bodyLimit = 0;
+    bodySpoolThreshold = 0;
+    discardBodyFile();
+    bodySize = 0;
 }
 
 const std::string &HttpRequest::getMethod() const
@@ -96,9 +543,19 @@ const std::string &HttpRequest::getQuery() const
     return query;
 }
 
-const std::map<std::string, std::string> &HttpRequest::getHeaders() const
+size_t HttpRequest::getHeaderCount() const
 {
-    return headers;
+    return headerFields.size();
+}
+
+std::string HttpRequest::getHeaderName(size_t index) const
+{
+    return headerArena.substr(headerFields[index].nameOffset, headerFields[index].nameLength);
+}
+
+std::string HttpRequest::getHeaderValue(size_t index) const
+{
+    return headerArena.substr(headerFields[index].valueOffset, headerFields[index].valueLength);
 }
 
 const std::string &HttpRequest::getBody() const
@@ -108,28 +565,70 @@ const std::string &HttpRequest::getBody() const
 
 std::string HttpRequest::getHeader(const std::string &name) const
 {
-    std::map<std::string, std::string>::const_iterator it = headers.find(toLower(name));
-    if (it != headers.end())
-        return it->second;
+    int index = findHeader(name.data(), name.length());
+    if (index >= 0)
+        return getHeaderValue(index);
     return "";
 }
 
 bool HttpRequest::hasHeader(const std::string &name) const
 {
-    return headers.find(name) != headers.end();
+    return findHeader(name.data(), name.length()) >= 0;
+}
+
+// Stored names are lowercase, so only the lookup key needs folding
+int HttpRequest::findHeader(const char *name, size_t length) const
+{
+    for (size_t i = 0; i < headerFields.size(); ++i)
+    {
+        const HeaderField &field = headerFields[i];
+        if (field.nameLength != length)
+            continue;
+
+        size_t j = 0;
+        while (j < field.nameLength)
+        {
+            char c = name[j];
+            if (c >= 'A' && c <= 'Z')
+                c = c + ('a' - 'A');
+            if (headerArena[field.nameOffset + j] != c)
+                break;
+            ++j;
+        }
+        if (j == field.nameLength)
+            return static_cast<int>(i);
+    }
+    return -1;
 }
 
 size_t HttpRequest::getContentLength() const
 {
-    std::string contentLengthStr = getHeader("Content-Length");
-    if (!contentLengthStr.empty())
+    size_t length;
+    if (!parseContentLength(getHeader("Content-Length"), length))
+        return 0;
+    return length;
+}
+
+// Digits only, and the value must fit: a length that wrapped around would
+// pass the body size check and leave the rest of the body to be read as
+// another request
+bool HttpRequest::parseContentLength(const std::string &value, size_t &length)
+{
+    if (value.empty())
+        return false;
+
+    const size_t maxLength = static_cast<size_t>(-1);
+    length = 0;
+    for (size_t i = 0; i < value.length(); ++i)
     {
-        std::istringstream iss(contentLengthStr);
-        size_t length;
-        iss >> length;
-        return length;
+        if (value[i] < '0' || value[i] > '9')
+            return false;
+        size_t digit = static_cast<size_t>(value[i] - '0');
+        if (length > (maxLength - digit) / 10)
+            return false;
+        length = length * 10 + digit;
     }
-    return 0;
+    return true;
 }
 
 std::string HttpRequest::getContentType() const
@@ -148,159 +647,85 @@ bool HttpRequest::isValidVersion() const
     return version == "HTTP/1.0" || version == "HTTP/1.1";
 }
 
-bool HttpRequest::parseRequestLine(const std::string &rawRequest)
+bool HttpRequest::parseRequestLine(const std::string &line)
 {
-    // Find the first line (request line)
-    size_t firstLineEnd = rawRequest.find("\r\n");
-    if (firstLineEnd == std::string::npos)
+    // METHOD SP request-target SP HTTP-version, tolerating repeated spaces
+    std::string parts[3];
+    size_t pos = 0;
+
+    for (int i = 0; i < 3; ++i)
     {
-        firstLineEnd = rawRequest.find("\n");
-        if (firstLineEnd == std::string::npos)
+        while (pos < line.length() && (line[pos] == ' ' || line[pos] == '\t'))
+            ++pos;
+        size_t end = pos;
+        while (end < line.length() && line[end] != ' ' && line[end] != '\t')
+            ++end;
+        if (end == pos)
         {
-            return false;  // No line ending found
+            return false;  // Failed to parse request line
         }
+        parts[i].assign(line, pos, end - pos);
+        pos = end;
     }
 
-    std::string requestLine = rawRequest.substr(0, firstLineEnd);
-    std::istringstream iss(requestLine);
-    std::string method, fullUri, version;
-
-    if (!(iss >> method >> fullUri >> version))
-    {
-        return false;  // Failed to parse request line
-    }
-
-    this->method = method;
-    this->version = version;
+    this->method = parts[0];
+    this->version = parts[2];
 
     // Parse URI and query string
-    parseUri(fullUri);
+    parseUri(parts[1]);
 
     return true;
 }
 
-bool HttpRequest::parseHeaders(const std::string &rawRequest)
+bool HttpRequest::parseHeader(const std::string &line)
 {
-    // Find start of headers (after request line)
-    size_t headerStart = rawRequest.find("\r\n");
-    if (headerStart == std::string::npos)
-    {
-        headerStart = rawRequest.find("\n");
-        if (headerStart == std::string::npos)
-        {
-            return false;
-        }
-        headerStart += 1;
-    }
-    else
-    {
-        headerStart += 2;
-    }
-
-    // Find end of headers (empty line)
-    size_t headerEnd = rawRequest.find("\r\n\r\n", headerStart);
-    if (headerEnd == std::string::npos)
+    size_t colonPos = line.find(':');
+    if (colonPos == std::string::npos || colonPos == 0)
     {
-        headerEnd = rawRequest.find("\n\n", headerStart);
-        if (headerEnd == std::string::npos)
-        {
-            // No body separator found - headers go to end
-            headerEnd = rawRequest.length();
-        }
+        return false;  // Invalid header format
     }
-
-    std::string headerSection = rawRequest.substr(headerStart, headerEnd - headerStart);
-
-    // Parse individual headers
-    std::istringstream headerStream(headerSection);
-    std::string line;
-
-    while (std::getline(headerStream, line))
+    // No whitespace is allowed in or after the name (RFC 9112 section 5.1);
+    // "Content-Length : 5" would otherwise be stored under another name
+    if (line.find_first_of(" \t") < colonPos)
     {
-        // Remove \r if present
-        if (!line.empty() && line[line.length() - 1] == '\r')
-        {
-            line.erase(line.length() - 1);
-        }
-
-        if (!line.empty())
-        {
-            if (!parseHeader(line))
-            {
-                return false;
-            }
-        }
+        return false;
     }
 
-    headersParsed = true;
-    return true;
-}
+    // Trim whitespace around the value without intermediate copies
+    size_t valueStart = line.find_first_not_of(" \t", colonPos + 1);
+    size_t valueLength = 0;
+    if (valueStart != std::string::npos)
+        valueLength = line.find_last_not_of(" \t") - valueStart + 1;
 
-bool HttpRequest::parseBody(const std::string &rawRequest)
-{
-    // Find body start (after headers)
-    size_t bodyStart = rawRequest.find("\r\n\r\n");
-    if (bodyStart != std::string::npos)
+    // A repeated header replaces the earlier value, as before, except for
+    // Content-Length: differing values make the body's end ambiguous, so
+    // only identical repeats are accepted (RFC 9112 section 6.3)
+    int index = findHeader(line.data(), colonPos);
+    if (index >= 0 && colonPos == 14 && strncasecmp(line.c_str(), "content-length", 14) == 0)
     {
-        bodyStart += 4;  // Skip \r\n\r\n
+        const HeaderField &field = headerFields[index];
+        return field.valueLength == valueLength &&
+               (valueLength == 0 || headerArena.compare(field.valueOffset, valueLength, line, valueStart, valueLength) == 0);
     }
-    else
+    if (index < 0)
     {
-        bodyStart = rawRequest.find("\n\n");
-        if (bodyStart != std::string::npos)
-        {
-            bodyStart += 2;  // Skip \n\n
-        }
-        else
+        // Names are stored lowercase for case-insensitive lookup
+        HeaderField newField;
+        newField.nameOffset = headerArena.size();
+        newField.nameLength = colonPos;
+        for (size_t i = 0; i < colonPos; ++i)
         {
-            // No body separator found - no body
-            body.clear();
-            return true;
+            char c = line[i];
+            headerArena += (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
         }
+        headerFields.push_back(newField);
+        index = static_cast<int>(headerFields.size()) - 1;
     }
 
-    if (bodyStart < rawRequest.length())
-    {
-        body = rawRequest.substr(bodyStart);
-    }
-    else
-    {
-        body.clear();
-    }
-
-    return true;
-}
-
-bool HttpRequest::parseHeader(const std::string &line)
-{
-    size_t colonPos = line.find(':');
-    if (colonPos == std::string::npos)
-    {
-        return false;  // Invalid header format
-    }
-
-    std::string name = line.substr(0, colonPos);
-    std::string value = line.substr(colonPos + 1);
-
-    // Trim whitespace from value
-    size_t valueStart = value.find_first_not_of(" \t");
-    if (valueStart != std::string::npos)
-    {
-        value = value.substr(valueStart);
-    }
-    else
-    {
-        value.clear();
-    }
-
-    size_t valueEnd = value.find_last_not_of(" \t");
-    if (valueEnd != std::string::npos)
-    {
-        value = value.substr(0, valueEnd + 1);
-    }
-
-    // Convert header name to lowercase for case-insensitive lookup
-    headers[toLower(name)] = value;
+    headerFields[index].valueOffset = headerArena.size();
+    headerFields[index].valueLength = valueLength;
+    if (valueLength > 0)
+        headerArena.append(line, valueStart, valueLength);
 
     return true;
 }
@@ -311,8 +736,8 @@ void HttpRequest::parseUri(const std::string &fullUri)
     size_t queryPos = fullUri.find('?');
     if (queryPos != std::string::npos)
     {
-        uri = fullUri.substr(0, queryPos);
-        query = fullUri.substr(queryPos + 1);
+        uri.assign(fullUri, 0, queryPos);
+        query.assign(fullUri, queryPos + 1, std::string::npos);
     }
     else
     {
@@ -320,16 +745,3 @@ void HttpRequest::parseUri(const std::string &fullUri)
         query.clear();
     }
 }
-
-std::string HttpRequest::toLower(const std::string &str) const
-{
-    std::string result = str;
-    for (size_t i = 0; i < result.length(); ++i)
-    {
-        if (result[i] >= 'A' && result[i] <= 'Z')
-        {
-            result[i] = result[i] + ('a' - 'A');
-        }
-    }
-    return result;
-}
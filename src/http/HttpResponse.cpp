@@ -3,17 +3,68 @@
 #include <sstream>
 #include <fstream>
 #include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 std::string HttpResponse::serverName = "WebServ/1.0";
 
-HttpResponse::HttpResponse() : statusCode(200), statusMessage("OK")
+const char *const HttpResponse::slotNames[HEADER_SLOT_COUNT] = {
+    "Server",
+    "Connection",
+    "Content-Type",
+    "Location",
+    "Last-Modified",
+    "ETag"
+};
+
+// The Date header only changes once per second, so it is formatted once and shared
+static time_t cachedDateSecond = -1;
+static char cachedDate[40];
+static size_t cachedDateLength = 0;
+
+static void refreshCachedDate()
+{
+    std::time_t now = std::time(0);
+    if (now != cachedDateSecond)
+    {
+        struct tm tmBuf;
+        cachedDateLength = std::strftime(cachedDate, sizeof(cachedDate),
+                                         "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&now, &tmBuf));
+        cachedDateSecond = now;
+    }
+}
+
+// Formats value into the end of buf and returns a pointer to the first digit
+static const char *formatNumber(char *bufEnd, size_t value)
+{
+    char *p = bufEnd;
+    do
+    {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    return p;
+}
+
+HttpResponse::HttpResponse()
+    : statusCode(200), statusMessage("OK"), contentLength(0), hasContentLength(false),
+      bodyFd(-1), bodyOffset(0), bodyLength(0), bodyStream(NULL), chunked(false)
 {
+    for (int i = 0; i < HEADER_SLOT_COUNT; ++i)
+    {
+        slotSet[i] = false;
+    }
     setHeader("Server", serverName);
-    setHeader("Connection", "close");
 }
 
 HttpResponse::~HttpResponse()
 {
+    closeBodyFile();
+    discardBodyStream();
 }
 
 void HttpResponse::setStatus(int code, const std::string &message)
@@ -31,74 +82,370 @@ void HttpResponse::setStatus(int code, const std::string &message)
 
 void HttpResponse::setHeader(const std::string &name, const std::string &value)
 {
-    headers[name] = value;
+    int slot = findSlot(name);
+    if (slot >= 0)
+    {
+        slotValues[slot] = value;
+        slotSet[slot] = true;
+        return;
+    }
+    if (strcasecmp(name.c_str(), "Content-Length") == 0)
+    {
+        setContentLength(std::strtoul(value.c_str(), NULL, 10));
+        return;
+    }
+
+    for (size_t i = 0; i < extraHeaders.size(); ++i)
+    {
+        if (strcasecmp(extraHeaders[i].first.c_str(), name.c_str()) == 0)
+        {
+            extraHeaders[i].second = value;
+            return;
+        }
+    }
+    extraHeaders.push_back(std::make_pair(name, value));
+}
+
+int HttpResponse::findSlot(const std::string &name)
+{
+    for (int i = 0; i < HEADER_SLOT_COUNT; ++i)
+    {
+        if (strcasecmp(name.c_str(), slotNames[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void HttpResponse::setContentLength(size_t length)
+{
+    contentLength = length;
+    hasContentLength = true;
 }
 
 void HttpResponse::setBody(const std::string &content)
 {
+    closeBodyFile();
+    discardBodyStream();
     body = content;
-    std::ostringstream oss;
-    oss << content.length();
-    setHeader("Content-Length", oss.str());
+    setContentLength(body.length());
 }
 
 void HttpResponse::setBodyFromFile(const std::string &filePath)
 {
-    std::ifstream file(filePath.c_str(), std::ios::binary);
-    if (file.is_open())
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode))
+    {
+        close(fd);
+        return;
+    }
+
+    setBodyFile(fd, 0, static_cast<size_t>(fileStat.st_size));
+    setHeader("Content-Type", getContentTypeFromPath(filePath));
+}
+
+void HttpResponse::setBodyFile(int fd, off_t offset, size_t length)
+{
+    closeBodyFile();
+    discardBodyStream();
+    body.clear();
+    bodyFd = fd;
+    bodyOffset = offset;
+    bodyLength = length;
+    setContentLength(length);
+}
+
+bool HttpResponse::hasBodyFile() const
+{
+    return bodyFd >= 0;
+}
+
+// Hands the file descriptor over to the caller, who becomes responsible for closing it
+int HttpResponse::releaseBodyFile(off_t &offset, size_t &length)
+{
+    int fd = bodyFd;
+    offset = bodyOffset;
+    length = bodyLength;
+
+    bodyFd = -1;
+    bodyOffset = 0;
+    bodyLength = 0;
+    return fd;
+}
+
+void HttpResponse::closeBodyFile()
+{
+    if (bodyFd >= 0)
     {
-        std::ostringstream oss;
-        oss << file.rdbuf();
-        setBody(oss.str());
-        file.close();
-        
-        setHeader("Content-Type", getContentTypeFromPath(filePath));
+        close(bodyFd);
     }
+    bodyFd = -1;
+    bodyOffset = 0;
+    bodyLength = 0;
 }
 
 void HttpResponse::appendBody(const std::string &content)
 {
+    closeBodyFile();
+    discardBodyStream();
     body += content;
-    std::ostringstream oss;
-    oss << body.length();
-    setHeader("Content-Length", oss.str());
+    setContentLength(body.length());
 }
 
 void HttpResponse::clearBody()
 {
+    closeBodyFile();
+    discardBodyStream();
     body.clear();
-    setHeader("Content-Length", "0");
+    setContentLength(0);
 }
 
-std::string HttpResponse::toString() const
+void HttpResponse::setBodyStream(BodyStream *stream)
 {
-    std::ostringstream response;
-    
-    response << "HTTP/1.1 " << statusCode << " " << statusMessage << "\r\n";
-    
-    std::time_t now = std::time(0);
-    char timeStr[100];
-    std::strftime(timeStr, sizeof(timeStr), "%a, %d %b %Y %H:%M:%S GMT", std::gmtime(&now));
-    response << "Date: " << timeStr << "\r\n";
-    
-    for (std::map<std::string, std::string>::const_iterator it = headers.begin();
-         it != headers.end(); ++it)
+    closeBodyFile();
+    discardBodyStream();
+    body.clear();
+    bodyStream = stream;
+    hasContentLength = false;
+}
+
+bool HttpResponse::hasBodyStream() const
+{
+    return bodyStream != NULL;
+}
+
+// Hands the stream over to the caller, who becomes responsible for deleting it
+BodyStream *HttpResponse::releaseBodyStream()
+{
+    BodyStream *stream = bodyStream;
+    bodyStream = NULL;
+    return stream;
+}
+
+void HttpResponse::discardBodyStream()
+{
+    delete bodyStream;
+    bodyStream = NULL;
+}
+
+void HttpResponse::setChunked(bool chunked)
+{
+    this->chunked = chunked;
+    if (chunked)
     {
-        response << it->first << ": " << it->second << "\r\n";
+        hasContentLength = false;
     }
-    
-    response << "\r\n";
-    
-    response << body;
-    
-    std::string result = response.str();
+}
 
-#ifdef VERBOSE_LOGGING
-    for (std::map<std::string, std::string>::const_iterator it = headers.begin();
-         it != headers.end(); ++it)
+bool HttpResponse::isChunked() const
+{
+    return chunked;
+}
+
+// An empty chunk would read as the end of the body, so it is never written
+void HttpResponse::appendChunk(std::string &out, const char *data, size_t length)
+{
+    if (length == 0)
     {
-        std::cout << "  " << it->first << ": " << it->second << std::endl;
+        return;
     }
+
+    out.reserve(out.size() + length + 24);
+    appendChunkHeader(out, length);
+    out.append(data, length);
+    out.append("\r\n", 2);
+}
+
+// For chunk data that is sent separately (spliced from a pipe); the caller
+// appends the closing CRLF once the data is out
+void HttpResponse::appendChunkHeader(std::string &out, size_t length)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    char sizeBuf[24];
+    char *p = sizeBuf + sizeof(sizeBuf);
+    size_t value = length;
+    do
+    {
+        *--p = hexDigits[value & 0xf];
+        value >>= 4;
+    } while (value > 0);
+
+    out.append(p, sizeBuf + sizeof(sizeBuf) - p);
+    out.append("\r\n", 2);
+}
+
+void HttpResponse::appendLastChunk(std::string &out)
+{
+    out.append("0\r\n\r\n", 5);
+}
+
+// Returns the offset just past the blank line ending the header block
+size_t HttpResponse::findCgiHeaderEnd(const std::string &output)
+{
+    size_t headerEnd = output.find("\r\n\r\n");
+    if (headerEnd != std::string::npos)
+    {
+        return headerEnd + 4;
+    }
+    headerEnd = output.find("\n\n");
+    if (headerEnd != std::string::npos)
+    {
+        return headerEnd + 2;
+    }
+    return std::string::npos;
+}
+
+void HttpResponse::setCgiHeaders(const std::string &headers)
+{
+    std::istringstream headerStream(headers);
+    std::string line;
+    bool statusSet = false;
+
+    while (std::getline(headerStream, line))
+    {
+        if (!line.empty() && line[line.length() - 1] == '\r')
+        {
+            line.erase(line.length() - 1);
+        }
+
+        size_t colonPos = line.find(':');
+        if (colonPos == std::string::npos)
+        {
+            continue;
+        }
+        std::string name = line.substr(0, colonPos);
+        std::string value = line.substr(colonPos + 1);
+        while (!value.empty() && (value[0] == ' ' || value[0] == '\t'))
+        {
+            value.erase(0, 1);
+        }
+
+        if (name == "Status" && !statusSet)
+        {
+            size_t spacePos = value.find(' ');
+            if (spacePos != std::string::npos)
+            {
+                setStatus(atoi(value.substr(0, spacePos).c_str()), value.substr(spacePos + 1));
+                statusSet = true;
+            }
+        }
+        else if (strcasecmp(name.c_str(), "Transfer-Encoding") != 0 &&
+                 strcasecmp(name.c_str(), "Connection") != 0)
+        {
+            // Framing and connection handling are the server's business
+            setHeader(name, value);
+        }
+    }
+
+    if (!statusSet)
+    {
+        setStatus(200, "OK");
+    }
+}
+
+// Output without a header block is sent as an HTML body
+void HttpResponse::setCgiOutput(const std::string &output)
+{
+    size_t headerEnd = findCgiHeaderEnd(output);
+    if (headerEnd != std::string::npos)
+    {
+        setCgiHeaders(output.substr(0, headerEnd));
+        setBody(output.substr(headerEnd));
+    }
+    else
+    {
+        setStatus(200, "OK");
+        setHeader("Content-Type", "text/html");
+        setBody(output);
+    }
+}
+
+// Appends the status line and header block to out. The exact size is
+// computed first so a reused buffer is filled without reallocating.
+void HttpResponse::serializeHeaders(std::string &out) const
+{
+    refreshCachedDate();
+
+    char statusBuf[24];
+    const char *statusDigits = formatNumber(statusBuf + sizeof(statusBuf), statusCode);
+    size_t statusDigitsLength = statusBuf + sizeof(statusBuf) - statusDigits;
+
+    char lengthBuf[24];
+    const char *lengthDigits = formatNumber(lengthBuf + sizeof(lengthBuf), contentLength);
+    size_t lengthDigitsLength = lengthBuf + sizeof(lengthBuf) - lengthDigits;
+
+    size_t size = 9 + statusDigitsLength + 1 + statusMessage.size() + 2;  // "HTTP/1.1 " code " " message CRLF
+    size += 6 + cachedDateLength + 2;                                     // "Date: " date CRLF
+    for (int i = 0; i < HEADER_SLOT_COUNT; ++i)
+    {
+        if (slotSet[i])
+            size += std::strlen(slotNames[i]) + 2 + slotValues[i].size() + 2;
+    }
+    if (hasContentLength)
+        size += 16 + lengthDigitsLength + 2;                              // "Content-Length: " n CRLF
+    if (chunked)
+        size += 28;                                                       // "Transfer-Encoding: chunked" CRLF
+    for (size_t i = 0; i < extraHeaders.size(); ++i)
+    {
+        size += extraHeaders[i].first.size() + 2 + extraHeaders[i].second.size() + 2;
+    }
+    size += 2;
+
+    out.reserve(out.size() + size);
+
+    out.append("HTTP/1.1 ", 9);
+    out.append(statusDigits, statusDigitsLength);
+    out += ' ';
+    out += statusMessage;
+    out.append("\r\nDate: ", 8);
+    out.append(cachedDate, cachedDateLength);
+    out.append("\r\n", 2);
+
+    for (int i = 0; i < HEADER_SLOT_COUNT; ++i)
+    {
+        if (!slotSet[i])
+            continue;
+        out += slotNames[i];
+        out.append(": ", 2);
+        out += slotValues[i];
+        out.append("\r\n", 2);
+    }
+    if (hasContentLength)
+    {
+        out.append("Content-Length: ", 16);
+        out.append(lengthDigits, lengthDigitsLength);
+        out.append("\r\n", 2);
+    }
+    if (chunked)
+    {
+        out.append("Transfer-Encoding: chunked\r\n", 28);
+    }
+    for (size_t i = 0; i < extraHeaders.size(); ++i)
+    {
+        out += extraHeaders[i].first;
+        out.append(": ", 2);
+        out += extraHeaders[i].second;
+        out.append("\r\n", 2);
+    }
+    out.append("\r\n", 2);
+}
+
+std::string HttpResponse::toString() const
+{
+    std::string result;
+    result.reserve(256 + body.size());
+    serializeHeaders(result);
+    result += body;
+
+#ifdef VERBOSE_LOGGING
+    std::cout << result.substr(0, result.size() - body.size());
     if (!body.empty())
     {
         if (body.length() > 100) std::cout << "...";
@@ -126,38 +473,97 @@ const std::string& HttpResponse::getStatusMessage() const
 
 std::string HttpResponse::getHeader(const std::string &name) const
 {
-    std::map<std::string, std::string>::const_iterator it = headers.find(name);
-    if (it != headers.end())
+    int slot = findSlot(name);
+    if (slot >= 0)
+    {
+        return slotSet[slot] ? slotValues[slot] : "";
+    }
+    if (strcasecmp(name.c_str(), "Content-Length") == 0)
+    {
+        if (!hasContentLength)
+            return "";
+        char lengthBuf[24];
+        const char *digits = formatNumber(lengthBuf + sizeof(lengthBuf), contentLength);
+        return std::string(digits, lengthBuf + sizeof(lengthBuf) - digits);
+    }
+
+    for (size_t i = 0; i < extraHeaders.size(); ++i)
     {
-        return it->second;
+        if (strcasecmp(extraHeaders[i].first.c_str(), name.c_str()) == 0)
+        {
+            return extraHeaders[i].second;
+        }
     }
     return "";
 }
 
 bool HttpResponse::hasHeader(const std::string &name) const
 {
-    return headers.find(name) != headers.end();
+    int slot = findSlot(name);
+    if (slot >= 0)
+    {
+        return slotSet[slot];
+    }
+    if (strcasecmp(name.c_str(), "Content-Length") == 0)
+    {
+        return hasContentLength;
+    }
+
+    for (size_t i = 0; i < extraHeaders.size(); ++i)
+    {
+        if (strcasecmp(extraHeaders[i].first.c_str(), name.c_str()) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 void HttpResponse::removeHeader(const std::string &name)
 {
-    headers.erase(name);
+    int slot = findSlot(name);
+    if (slot >= 0)
+    {
+        slotSet[slot] = false;
+        return;
+    }
+    if (strcasecmp(name.c_str(), "Content-Length") == 0)
+    {
+        hasContentLength = false;
+        return;
+    }
+
+    for (size_t i = 0; i < extraHeaders.size(); ++i)
+    {
+        if (strcasecmp(extraHeaders[i].first.c_str(), name.c_str()) == 0)
+        {
+            extraHeaders.erase(extraHeaders.begin() + i);
+            return;
+        }
+    }
 }
 
 void HttpResponse::reset()
 {
     statusCode = 200;
     statusMessage = "OK";
-    headers.clear();
+    for (int i = 0; i < HEADER_SLOT_COUNT; ++i)
+    {
+        slotSet[i] = false;
+    }
+    hasContentLength = false;
+    extraHeaders.clear();
     body.clear();
+    closeBodyFile();
+    discardBodyStream();
+    chunked = false;
     
     setHeader("Server", serverName);
-    setHeader("Connection", "close");
 }
 
 bool HttpResponse::isReady() const
 {
-    return !body.empty() || statusCode >= 400;
+    return !body.empty() || bodyFd >= 0 || bodyStream != NULL || statusCode >= 400;
 }
 
 std::string HttpResponse::getDefaultStatusMessage(int code)
@@ -167,8 +573,10 @@ std::string HttpResponse::getDefaultStatusMessage(int code)
         case 200: return "OK";
         case 201: return "Created";
         case 204: return "No Content";
+        case 206: return "Partial Content";
         case 301: return "Moved Permanently";
         case 302: return "Found";
+        case 304: return "Not Modified";
         case 400: return "Bad Request";
         case 401: return "Unauthorized";
         case 403: return "Forbidden";
@@ -176,10 +584,12 @@ std::string HttpResponse::getDefaultStatusMessage(int code)
         case 405: return "Method Not Allowed";
         case 409: return "Conflict";
         case 413: return "Payload Too Large";
+        case 416: return "Range Not Satisfiable";
         case 500: return "Internal Server Error";
         case 501: return "Not Implemented";
         case 502: return "Bad Gateway";
         case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
         default: return "Unknown";
     }
 }
@@ -1,39 +1,193 @@
 #include "HttpServer.hpp"
 #include "AsyncOperation.hpp"
-#include "CgiOperation.hpp"
 
 #include <netinet/in.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
 
+#include <csignal>
 #include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <new>
+#include <stdexcept>
 
 HttpServer::HttpServer(Config& config)
     : config(config),
       socketManager(),
       eventLoop(),
-      requestHandler(config, socketManager),
-      running(false)
+      requestHandler(this->config, socketManager),
+      running(false),
+      isMaster(false),
+      workersSignaled(false),
+      reloadRequested(0),
+      connectionPool(sizeof(ClientConnection), CONNECTION_SLAB_SIZE)
 {
 }
 
 HttpServer::~HttpServer()
 {
-    for (std::map<int, ClientConnection*>::iterator it = connections.begin(); it != connections.end(); ++it)
+    for (size_t fd = 0; fd < fdTable.size(); ++fd)
     {
-        socketManager.closeConnection(it->first);
-        delete it->second;
+        if (fdTable[fd].type == FD_CLIENT)
+        {
+            socketManager.closeConnection(fd);
+            destroyConnection(fdTable[fd].conn);
+        }
     }
-    connections.clear();
+    fdTable.clear();
     socketManager.closeAllSockets();
 }
 
 void HttpServer::run()
+{
+    if (config.workerProcesses > 1)
+    {
+        runMaster();
+        return;
+    }
+    runWorker();
+}
+
+// The master never opens a listening socket itself: every worker binds its own
+// SO_REUSEPORT socket so accepts are spread across processes by the kernel.
+void HttpServer::runMaster()
+{
+    isMaster = true;
+    running = true;
+    socketManager.setReusePort(true);
+    workerPids.assign(config.workerProcesses, -1);
+    workerStartTimes.assign(config.workerProcesses, 0);
+
+    for (size_t i = 0; i < workerPids.size(); ++i)
+    {
+        if (spawnWorker(i) == 0)
+        {
+            return;
+        }
+    }
+
+    std::cout << "HTTP Server master started with " << workerPids.size() << " worker processes" << std::endl;
+
+    while (running)
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR) continue;
+            std::cerr << "waitpid error: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        size_t slot = 0;
+        while (slot < workerPids.size() && workerPids[slot] != pid)
+        {
+            ++slot;
+        }
+        if (slot == workerPids.size())
+        {
+            continue;
+        }
+        workerPids[slot] = -1;
+
+        if (!running)
+        {
+            break;
+        }
+
+        // A worker that fails right after being spawned (bind error, bad config)
+        // would fail again, so give up instead of respawning in a tight loop.
+        if (WIFEXITED(status) && WEXITSTATUS(status) != 0 &&
+            time(NULL) - workerStartTimes[slot] < WORKER_STARTUP_GRACE)
+        {
+            std::cerr << "Worker " << pid << " failed during startup, shutting down" << std::endl;
+            running = false;
+            break;
+        }
+
+        std::cerr << "Worker " << pid << " exited unexpectedly, respawning" << std::endl;
+        if (spawnWorker(slot) == 0)
+        {
+            return;
+        }
+    }
+
+    stopWorkers();
+}
+
+pid_t HttpServer::spawnWorker(size_t slot)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        std::cerr << "Failed to fork worker process: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        // Terminal signals reach the whole process group; only the master
+        // reacts to them and forwards SIGTERM so each worker stops exactly once.
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+        isMaster = false;
+        workerPids.clear();
+        workerStartTimes.clear();
+        runWorker();
+        return 0;
+    }
+
+    workerPids[slot] = pid;
+    workerStartTimes[slot] = time(NULL);
+    return pid;
+}
+
+// Called from the signal handler as well, so it only sends signals.
+void HttpServer::signalWorkers()
+{
+    if (workersSignaled)
+    {
+        return;
+    }
+    workersSignaled = true;
+
+    for (size_t i = 0; i < workerPids.size(); ++i)
+    {
+        if (workerPids[i] > 0)
+        {
+            kill(workerPids[i], SIGTERM);
+        }
+    }
+}
+
+void HttpServer::stopWorkers()
+{
+    signalWorkers();
+
+    for (size_t i = 0; i < workerPids.size(); ++i)
+    {
+        if (workerPids[i] <= 0)
+        {
+            continue;
+        }
+        int status;
+        while (waitpid(workerPids[i], &status, 0) < 0 && errno == EINTR)
+        {
+        }
+        workerPids[i] = -1;
+    }
+}
+
+void HttpServer::runWorker()
 {
     if (!initializeServers())
     {
         throw std::runtime_error("Failed to initialize servers");
     }
+    requestHandler.startCgiWorkers();
     
     std::cout << "HTTP Server started successfully" << std::endl;
     running = true;
@@ -43,6 +197,13 @@ void HttpServer::run()
 
     while (running)
     {
+        if (reloadRequested)
+        {
+            reloadRequested = 0;
+            requestHandler.reloadCaches();
+            std::cout << "Reloaded error pages and file cache" << std::endl;
+        }
+
         epoll_event events[MAX_EVENTS];
         int eventCount = eventLoop.wait(events, MAX_EVENTS, TIMEOUT_MS);
 
@@ -60,23 +221,26 @@ void HttpServer::run()
             std::cout << "Event on FD " << fd << " with events: " << events[i].events << std::endl;
 #endif
             
-            if (isServerSocket(fd))
+            FdType type = lookupFd(fd).type;
+
+            if (type == FD_LISTENER)
             {
                 handleNewConnection(fd);
             }
-            else if (isCgiSocket(fd))
+            else if (type == FD_CGI)
             {
-                // Handle CGI events
+                // Handle CGI events; EPOLLOUT only comes while a FastCGI
+                // request is still being sent
                 if (events[i].events & (EPOLLERR | EPOLLHUP))
                 {
                     handleCgiError(fd);
                 }
-                else if (events[i].events & EPOLLIN)
+                else if (events[i].events & (EPOLLIN | EPOLLOUT))
                 {
                     handleCgiRead(fd);
                 }
             }
-            else
+            else if (type == FD_CLIENT)
             {
                 // Handle client events
                 if (events[i].events & (EPOLLERR | EPOLLHUP))
@@ -96,12 +260,40 @@ void HttpServer::run()
                 }
             }
         }
+
+        // Workers leased by the requests above are replaced once, after the
+        // whole batch, rather than while each request waits
+        requestHandler.refillCgiWorkers();
+        handleTimeouts();
     }
 }
 
 void HttpServer::stop()
 {
     running = false;
+
+    if (isMaster)
+    {
+        signalWorkers();
+    }
+}
+
+// Called from the SIGHUP handler: the worker loop picks the flag up on its
+// next iteration and the master passes the signal on to its workers.
+void HttpServer::reload()
+{
+    reloadRequested = 1;
+
+    if (isMaster)
+    {
+        for (size_t i = 0; i < workerPids.size(); ++i)
+        {
+            if (workerPids[i] > 0)
+            {
+                kill(workerPids[i], SIGHUP);
+            }
+        }
+    }
 }
 
 bool HttpServer::initializeServers()
@@ -110,6 +302,7 @@ bool HttpServer::initializeServers()
     {
         return false;
     }
+    eventLoop.setEdgeTriggered(config.edgeTriggered);
 
     const std::vector<Config::ServerConfig>& serverConfigs = config.servers;
     for (size_t i = 0; i < serverConfigs.size(); ++i)
@@ -134,6 +327,7 @@ bool HttpServer::initializeServers()
             std::cerr << "Failed to add server socket " << serverSockets[i] << " to event loop" << std::endl;
             return false;
         }
+        registerFd(serverSockets[i], FD_LISTENER, NULL);
     }
 
 #ifdef VERBOSE_LOGGING
@@ -150,55 +344,70 @@ bool HttpServer::initializeServers()
 
 void HttpServer::handleNewConnection(int serverFd)
 {
-    struct sockaddr_in clientAddr;
-    int clientFd = socketManager.acceptConnection(serverFd, clientAddr);
-    if (clientFd < 0)
+    // An edge-triggered listener only fires once per burst, so keep accepting
+    // until the backlog is empty.
+    do
     {
-        return;
-    }
+        struct sockaddr_in clientAddr;
+        int clientFd = socketManager.acceptConnection(serverFd, clientAddr);
+        if (clientFd < 0)
+        {
+            return;
+        }
 
 #ifdef VERBOSE_LOGGING
-    std::cout << "New connection accepted on fd: " << clientFd << std::endl;
+        std::cout << "New connection accepted on fd: " << clientFd << std::endl;
 #endif
 
-    connections[clientFd] = new ClientConnection(clientFd, clientAddr, requestHandler);
-    
-    connections[clientFd]->setServerFd(serverFd);    
+        ClientConnection *conn = createConnection(clientFd, clientAddr);
+        conn->setServerFd(serverFd);
+        conn->setEdgeTriggered(eventLoop.isEdgeTriggered());
+        conn->setMaxRequests(config.keepaliveTimeout > 0 ? config.keepaliveRequests : 0);
+        registerFd(clientFd, FD_CLIENT, conn);
 
-    if (!eventLoop.add(clientFd, EPOLLIN))
-    {
-        closeConnection(clientFd);
-    }
+        if (!eventLoop.add(clientFd, EPOLLIN))
+        {
+            closeConnection(clientFd);
+            continue;
+        }
+        updateTimer(conn);
+    } while (eventLoop.isEdgeTriggered());
 }
 
 void HttpServer::handleClientRead(int clientFd)
 {
-    
-    std::map<int, ClientConnection*>::iterator it = connections.find(clientFd);
-    if (it == connections.end()) 
+    // The connection may have been closed earlier in the same event batch
+    ClientConnection* conn = lookupFd(clientFd).conn;
+    if (!conn)
     {
-        std::cerr << "Client connection not found for FD: " << clientFd << std::endl;
         return;
     }
-
-    ClientConnection* conn = it->second;
     if (!conn->readData())
     {
         closeConnection(clientFd);
         return;
     }
+    scheduleConnection(conn);
+}
 
+// Hooks up whatever the last request produced: a CGI to watch or a
+// response to write. Modifying the registration also re-arms EPOLLOUT in
+// edge-triggered mode when the socket is already writable.
+void HttpServer::scheduleConnection(ClientConnection *conn)
+{
     if (conn->hasPendingOperation())
     {
         AsyncOperation* op = conn->getPendingOperation();
         int cgiFd = op->getMonitorFd();
         
-        if (cgiConnections.find(cgiFd) == cgiConnections.end())
+        if (lookupFd(cgiFd).type != FD_CGI)
         {
-            if (eventLoop.add(cgiFd, EPOLLIN))
+            if (eventLoop.add(cgiFd, cgiEvents(op)))
             {
-                cgiConnections[cgiFd] = conn; 
-                op->handleData();
+                registerFd(cgiFd, FD_CGI, conn);
+                fdTable[cgiFd].writing = op->needsWrite();
+                serviceCgi(conn, false);
+                return;
             }
             else
             {
@@ -207,23 +416,24 @@ void HttpServer::handleClientRead(int clientFd)
             }
         }
     }
-    else if (conn->isReadyToWrite())
+    if (conn->canWrite())
+    {
+        eventLoop.modify(conn->getSocketFd(), clientEvents(conn, true));
+    }
+    else if (!conn->isReadyToRead())
     {
-        eventLoop.modify(clientFd, EPOLLIN | EPOLLOUT);
+        eventLoop.modify(conn->getSocketFd(), clientEvents(conn, false));
     }
+    updateTimer(conn);
 }
 
 void HttpServer::handleClientWrite(int clientFd)
 {
-    
-    std::map<int, ClientConnection*>::iterator it = connections.find(clientFd);
-    if (it == connections.end()) 
+    ClientConnection* conn = lookupFd(clientFd).conn;
+    if (!conn)
     {
-        std::cerr << "Client connection not found for FD: " << clientFd << std::endl;
         return;
     }
-
-    ClientConnection* conn = it->second;
     
     bool writeComplete = conn->writeData();
     
@@ -238,12 +448,35 @@ void HttpServer::handleClientWrite(int clientFd)
         if (!conn->isKeepAlive())
         {
             closeConnection(clientFd);
+            return;
         }
-        else
+
+        conn->startNextRequest();
+        if (!conn->canWrite())
         {
-            eventLoop.modify(clientFd, EPOLLIN);
+            eventLoop.modify(clientFd, clientEvents(conn, false));
         }
+        scheduleConnection(conn);
+        return;
     }
+
+    // A streamed body waiting for its producer: let a paused CGI refill the
+    // buffer, and stop polling for EPOLLOUT until it has data. The CGI is
+    // resumed first so output arriving in between is never left unpolled.
+    resumeCgi(conn);
+    if (!conn->canWrite())
+    {
+        eventLoop.modify(clientFd, clientEvents(conn, false));
+    }
+    else if (eventLoop.isEdgeTriggered() && (conn->getPendingOperation() || conn->hasYieldedWrite()))
+    {
+        // The producer caught up after writeData gave up on it, or writeData
+        // used up its budget for this event; with the socket still writable
+        // no new edge would come, so re-arm for one. Connections already
+        // reported go first.
+        eventLoop.modify(clientFd, clientEvents(conn, true));
+    }
+    updateTimer(conn);
 }
 
 void HttpServer::handleClientError(int clientFd)
@@ -254,94 +487,271 @@ void HttpServer::handleClientError(int clientFd)
 void HttpServer::closeConnection(int clientFd)
 {
     eventLoop.remove(clientFd);
-    
-    std::map<int, ClientConnection*>::iterator it = connections.find(clientFd);
-    if (it != connections.end())
+
+    ClientConnection* conn = lookupFd(clientFd).conn;
+    if (!conn)
     {
-        delete it->second; 
-        connections.erase(it);
+        return;
     }
-}
 
-bool HttpServer::isServerSocket(int fd) const
-{
-    const std::vector<int>& serverSockets = socketManager.getServerSockets();
-    for (size_t i = 0; i < serverSockets.size(); ++i)
+    // A CGI still running for this client goes away with it
+    if (conn->hasPendingOperation())
     {
-        if (serverSockets[i] == fd)
+        int cgiFd = conn->getPendingOperation()->getMonitorFd();
+        if (lookupFd(cgiFd).conn == conn)
         {
-            return true;
+            if (!lookupFd(cgiFd).paused)
+            {
+                eventLoop.remove(cgiFd);
+            }
+            unregisterFd(cgiFd);
         }
     }
-    return false;
+
+    unregisterFd(clientFd);
+    destroyConnection(conn);
 }
 
-bool HttpServer::isCgiSocket(int fd) const
+ClientConnection *HttpServer::createConnection(int clientFd, const struct sockaddr_in &clientAddr)
 {
-    return cgiConnections.find(fd) != cgiConnections.end();
+    void *memory = connectionPool.allocate();
+    try
+    {
+        return new (memory) ClientConnection(clientFd, clientAddr, requestHandler);
+    }
+    catch (...)
+    {
+        connectionPool.release(memory);
+        throw;
+    }
 }
 
-void HttpServer::handleCgiRead(int cgiFd)
+void HttpServer::destroyConnection(ClientConnection *conn)
 {
-    
-    std::map<int, ClientConnection*>::iterator it = cgiConnections.find(cgiFd);
-    if (it == cgiConnections.end())
+    conn->~ClientConnection();
+    connectionPool.release(conn);
+}
+
+void HttpServer::registerFd(int fd, FdType type, ClientConnection *conn)
+{
+    if (fd < 0)
     {
-        std::cerr << "CGI FD not found in cgiConnections map" << std::endl;
         return;
     }
-    
-    ClientConnection* conn = it->second;
-    AsyncOperation* op = conn->getPendingOperation();
-    
-    if (!op)
+    if (static_cast<size_t>(fd) >= fdTable.size())
+    {
+        fdTable.resize(static_cast<size_t>(fd) * 2 + 64);
+    }
+    fdTable[fd].type = type;
+    fdTable[fd].conn = conn;
+    fdTable[fd].paused = false;
+    fdTable[fd].writing = false;
+}
+
+void HttpServer::unregisterFd(int fd)
+{
+    if (fd >= 0 && static_cast<size_t>(fd) < fdTable.size())
+    {
+        fdTable[fd] = FdEntry();
+    }
+}
+
+const HttpServer::FdEntry &HttpServer::lookupFd(int fd) const
+{
+    static const FdEntry unused;
+
+    if (fd < 0 || static_cast<size_t>(fd) >= fdTable.size())
+    {
+        return unused;
+    }
+    return fdTable[fd];
+}
+
+void HttpServer::handleCgiRead(int cgiFd)
+{
+    ClientConnection* conn = lookupFd(cgiFd).conn;
+    if (!conn || !conn->getPendingOperation())
     {
         std::cerr << "No pending operation for CGI FD: " << cgiFd << std::endl;
         return;
     }
-    
+    serviceCgi(conn, false);
+}
+
+void HttpServer::handleCgiError(int cgiFd)
+{
+    ClientConnection* conn = lookupFd(cgiFd).conn;
+    if (conn && conn->getPendingOperation())
+    {
+        serviceCgi(conn, true);
+    }
+}
+
+// Moves CGI output along: reads what the pipe has (up to the operation's
+// buffer limit), starts or feeds the client response, and stops watching
+// the pipe while the client is too slow to take more.
+void HttpServer::serviceCgi(ClientConnection *conn, bool hangup)
+{
+    AsyncOperation* op = conn->getPendingOperation();
+    int cgiFd = op->getMonitorFd();
+
     op->handleData();
-    
+
+    // The writer is gone; if no output is left behind the buffer limit,
+    // nothing more will arrive
+    if (hangup && !op->isComplete() && op->hasOutputRoom())
+    {
+        op->forceCompletion();
+    }
+
     if (op->isComplete())
     {
-        eventLoop.remove(cgiFd);
-        cgiConnections.erase(it);
-        
+        if (!lookupFd(cgiFd).paused)
+        {
+            eventLoop.remove(cgiFd);
+        }
+        unregisterFd(cgiFd);
         conn->completePendingOperation();
-        
-        if (conn->canWrite())
+        if (conn->hasPendingOperation())
         {
-            eventLoop.modify(conn->getSocketFd(), EPOLLIN | EPOLLOUT);
+            // Handled again and waiting on a new operation
+            scheduleConnection(conn);
+            return;
         }
     }
+    else
+    {
+        conn->pumpPendingOperation();
+        if (!op->hasOutputRoom() && !lookupFd(cgiFd).paused)
+        {
+            eventLoop.remove(cgiFd);
+            fdTable[cgiFd].paused = true;
+        }
+        else if (!lookupFd(cgiFd).paused && lookupFd(cgiFd).writing != op->needsWrite())
+        {
+            eventLoop.modify(cgiFd, cgiEvents(op));
+            fdTable[cgiFd].writing = op->needsWrite();
+        }
+    }
+
+    if (conn->canWrite())
+    {
+        eventLoop.modify(conn->getSocketFd(), clientEvents(conn, true));
+    }
+    updateTimer(conn);
 }
 
-void HttpServer::handleCgiError(int cgiFd)
+// Watches a paused CGI pipe again once the client has drained some output
+void HttpServer::resumeCgi(ClientConnection *conn)
 {
-    
-    std::map<int, ClientConnection*>::iterator it = cgiConnections.find(cgiFd);
-    if (it != cgiConnections.end())
+    AsyncOperation* op = conn->getPendingOperation();
+    if (!op || !op->hasOutputRoom())
     {
-        ClientConnection* conn = it->second;
-        AsyncOperation* op = conn->getPendingOperation();
-        
-        if (op) {
-            op->handleData();
-            
-            CgiOperation* cgiOp = dynamic_cast<CgiOperation*>(op);
-            if (cgiOp && !op->isComplete()) {
-                cgiOp->forceCompletion();
-            }
+        return;
+    }
+
+    int cgiFd = op->getMonitorFd();
+    if (lookupFd(cgiFd).type == FD_CGI && lookupFd(cgiFd).paused)
+    {
+        if (eventLoop.add(cgiFd, cgiEvents(op)))
+        {
+            fdTable[cgiFd].paused = false;
+            fdTable[cgiFd].writing = op->needsWrite();
         }
-        
-        conn->completePendingOperation();
-        
-        eventLoop.remove(cgiFd);
-        cgiConnections.erase(it);
-        
-        if (conn->canWrite())
+    }
+}
+
+uint32_t HttpServer::cgiEvents(const AsyncOperation *op)
+{
+    return op->needsWrite() ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+}
+
+// EPOLLIN is left out while a connection holds back pipelined requests;
+// registering it again re-reports data already waiting, edge-triggered too
+uint32_t HttpServer::clientEvents(const ClientConnection *conn, bool writing)
+{
+    uint32_t events = writing ? static_cast<uint32_t>(EPOLLOUT) : 0;
+    if (conn->isReadyToRead())
+    {
+        events |= EPOLLIN;
+    }
+    return events;
+}
+
+// Header, keep-alive and CGI limits cover the whole phase, so their timer is
+// only armed when the phase starts. Body and send limits bound the gap
+// between two I/O events and are pushed back on every event.
+void HttpServer::updateTimer(ClientConnection *conn)
+{
+    ClientConnection::TimeoutPhase phase = conn->getTimeoutPhase();
+    if (phase == conn->getArmedPhase() &&
+        phase != ClientConnection::TIMEOUT_BODY && phase != ClientConnection::TIMEOUT_SEND)
+    {
+        return;
+    }
+    conn->setArmedPhase(phase);
+
+    int seconds = getTimeout(phase);
+    if (seconds > 0)
+    {
+        eventLoop.addTimer(conn->getTimer(), seconds);
+    }
+    else
+    {
+        conn->getTimer().cancel();
+    }
+}
+
+int HttpServer::getTimeout(ClientConnection::TimeoutPhase phase) const
+{
+    switch (phase)
+    {
+    case ClientConnection::TIMEOUT_HEADER:
+        return config.clientHeaderTimeout;
+    case ClientConnection::TIMEOUT_BODY:
+        return config.clientBodyTimeout;
+    case ClientConnection::TIMEOUT_SEND:
+        return config.sendTimeout;
+    case ClientConnection::TIMEOUT_KEEPALIVE:
+        return config.keepaliveTimeout;
+    case ClientConnection::TIMEOUT_CGI:
+        return config.cgiTimeout;
+    default:
+        return 0;
+    }
+}
+
+void HttpServer::handleTimeouts()
+{
+    expiredTimers.clear();
+    eventLoop.expireTimers(expiredTimers);
+
+    for (size_t i = 0; i < expiredTimers.size(); ++i)
+    {
+        int clientFd = expiredTimers[i]->fd;
+        ClientConnection* conn = lookupFd(clientFd).conn;
+        if (!conn || &conn->getTimer() != expiredTimers[i])
         {
-            eventLoop.modify(conn->getSocketFd(), EPOLLIN | EPOLLOUT);
+            continue;
         }
+
+        if (conn->getArmedPhase() == ClientConnection::TIMEOUT_CGI && conn->hasPendingOperation())
+        {
+            std::cerr << "CGI timed out for client " << conn->getClientAddress() << std::endl;
+            int cgiFd = conn->getPendingOperation()->getMonitorFd();
+            eventLoop.remove(cgiFd);
+            unregisterFd(cgiFd);
+
+            conn->abortPendingOperation(504);
+            eventLoop.modify(clientFd, clientEvents(conn, true));
+            updateTimer(conn);
+            continue;
+        }
+
+#ifdef VERBOSE_LOGGING
+        std::cout << "Closing timed out connection on fd " << clientFd
+                  << " (phase " << conn->getArmedPhase() << ")" << std::endl;
+#endif
+        closeConnection(clientFd);
     }
 }
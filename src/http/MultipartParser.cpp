@@ -0,0 +1,224 @@
+#include "MultipartParser.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+MultipartParser::MultipartParser(const std::string &boundary, const std::string &uploadDir,
+                                 const std::string &fallbackName)
+    : state(PREAMBLE),
+      delimiter("\r\n--" + boundary),
+      uploadDir(uploadDir),
+      fallbackName(fallbackName),
+      buffer("\r\n"),  // Lets the first boundary match the same CRLF-prefixed delimiter
+      outputFd(-1)
+{
+}
+
+MultipartParser::~MultipartParser()
+{
+    endPart();
+}
+
+bool MultipartParser::feed(const char *data, size_t length)
+{
+    if (state == FAILED)
+        return false;
+    if (state == EPILOGUE)
+        return true;
+
+    buffer.append(data, length);
+    if (!process())
+    {
+        endPart();
+        state = FAILED;
+        return false;
+    }
+    return true;
+}
+
+bool MultipartParser::finish()
+{
+    endPart();
+    if (state != EPILOGUE)
+    {
+        state = FAILED;
+        return false;
+    }
+    return !savedFiles.empty();
+}
+
+bool MultipartParser::hasError() const
+{
+    return state == FAILED;
+}
+
+const std::vector<std::string> &MultipartParser::getSavedFiles() const
+{
+    return savedFiles;
+}
+
+// Consumes as much of buffer as possible. Only a possible partial delimiter
+// (or an incomplete part header block) is kept between calls.
+bool MultipartParser::process()
+{
+    while (true)
+    {
+        switch (state)
+        {
+        case PREAMBLE:
+        {
+            size_t pos = buffer.find(delimiter);
+            if (pos == std::string::npos)
+            {
+                if (buffer.size() >= delimiter.size())
+                    buffer.erase(0, buffer.size() - delimiter.size() + 1);
+                return true;
+            }
+            buffer.erase(0, pos + delimiter.size());
+            state = AFTER_BOUNDARY;
+            break;
+        }
+        case AFTER_BOUNDARY:
+        {
+            if (buffer.size() < 2)
+                return true;
+            if (buffer[0] == '-' && buffer[1] == '-')
+            {
+                buffer.clear();
+                state = EPILOGUE;
+                return true;
+            }
+            size_t pos = buffer.find("\r\n");
+            if (pos == std::string::npos)
+                return buffer.size() <= MAX_PART_HEADER_SIZE;
+            buffer.erase(0, pos + 2);
+            state = PART_HEADERS;
+            break;
+        }
+        case PART_HEADERS:
+        {
+            std::string headers;
+            if (buffer.compare(0, 2, "\r\n") == 0)
+            {
+                buffer.erase(0, 2);
+            }
+            else
+            {
+                size_t pos = buffer.find("\r\n\r\n");
+                if (pos == std::string::npos)
+                    return buffer.size() <= MAX_PART_HEADER_SIZE;
+                headers = buffer.substr(0, pos);
+                buffer.erase(0, pos + 4);
+            }
+            if (!startPart(headers))
+                return false;
+            state = PART_BODY;
+            break;
+        }
+        case PART_BODY:
+        {
+            size_t pos = buffer.find(delimiter);
+            if (pos == std::string::npos)
+            {
+                // Everything except a possible partial delimiter at the end is content
+                if (buffer.size() >= delimiter.size())
+                {
+                    size_t flush = buffer.size() - delimiter.size() + 1;
+                    if (!writePartData(buffer.data(), flush))
+                        return false;
+                    buffer.erase(0, flush);
+                }
+                return true;
+            }
+            if (!writePartData(buffer.data(), pos))
+                return false;
+            buffer.erase(0, pos + delimiter.size());
+            endPart();
+            state = AFTER_BOUNDARY;
+            break;
+        }
+        case EPILOGUE:
+            buffer.clear();
+            return true;
+        case FAILED:
+            return false;
+        }
+    }
+}
+
+bool MultipartParser::startPart(const std::string &headers)
+{
+    // Only file parts are stored; plain form fields are skipped
+    if (headers.find("filename=") == std::string::npos)
+        return true;
+
+    std::string filename = extractFilename(headers);
+    if (filename.empty())
+        filename = fallbackName;
+
+    std::string fullPath = uploadDir + "/" + filename;
+    outputFd = open(fullPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outputFd < 0)
+    {
+        std::cerr << "Failed to create upload file " << fullPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    savedFiles.push_back(filename);
+    return true;
+}
+
+bool MultipartParser::writePartData(const char *data, size_t length)
+{
+    if (outputFd < 0)
+        return true;
+
+    while (length > 0)
+    {
+        ssize_t written = write(outputFd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Failed to write upload file: " << strerror(errno) << std::endl;
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+void MultipartParser::endPart()
+{
+    if (outputFd >= 0)
+    {
+        close(outputFd);
+        outputFd = -1;
+    }
+}
+
+std::string MultipartParser::extractFilename(const std::string &headers) const
+{
+    size_t filenamePos = headers.find("filename=\"");
+    if (filenamePos == std::string::npos)
+        return "";
+
+    filenamePos += 10;
+    size_t filenameEnd = headers.find('"', filenamePos);
+    if (filenameEnd == std::string::npos)
+        return "";
+
+    std::string filename = headers.substr(filenamePos, filenameEnd - filenamePos);
+
+    // Keep only the last path component so uploads cannot escape uploadDir
+    size_t slash = filename.find_last_of("/\\");
+    if (slash != std::string::npos)
+        filename = filename.substr(slash + 1);
+    if (filename == "." || filename == "..")
+        return "";
+    return filename;
+}
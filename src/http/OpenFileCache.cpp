@@ -0,0 +1,161 @@
+#include "OpenFileCache.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+OpenFileCache::OpenFileCache(MimeResolver mimeResolver)
+    : mimeResolver(mimeResolver), maxEntries(0), validSeconds(0)
+{
+}
+
+OpenFileCache::~OpenFileCache()
+{
+    clear();
+}
+
+void OpenFileCache::configure(size_t maxEntries, int validSeconds)
+{
+    clear();
+    this->maxEntries = maxEntries;
+    this->validSeconds = validSeconds;
+}
+
+bool OpenFileCache::isEnabled() const
+{
+    return maxEntries > 0;
+}
+
+// Returns NULL when the path cannot be opened; the caller then falls back to
+// the regular lookup so errors keep their usual status codes.
+const OpenFileCache::Entry *OpenFileCache::lookup(const std::string &path)
+{
+    if (!isEnabled())
+        return NULL;
+
+    time_t now = time(NULL);
+    std::map<std::string, EntryList::iterator>::iterator it = index.find(path);
+
+    if (it != index.end())
+    {
+        Entry &entry = *it->second;
+        entries.splice(entries.begin(), entries, it->second);
+
+        if (now - entry.validatedAt < validSeconds)
+            return &entry;
+
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat) != 0)
+        {
+            evict(it);
+            return NULL;
+        }
+        if (fileStat.st_ino != entry.inode || fileStat.st_size != entry.size ||
+            fileStat.st_mtime != entry.mtime)
+        {
+            release(entry);
+            if (!load(entry, fileStat))
+            {
+                evict(it);
+                return NULL;
+            }
+        }
+        entry.validatedAt = now;
+        return &entry;
+    }
+
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0)
+        return NULL;
+
+    Entry entry;
+    entry.path = path;
+    entry.fd = -1;
+    if (!load(entry, fileStat))
+        return NULL;
+    entry.validatedAt = now;
+
+    if (entries.size() >= maxEntries)
+        evict(index.find(entries.back().path));
+
+    entries.push_front(entry);
+    index[path] = entries.begin();
+    return &entries.front();
+}
+
+void OpenFileCache::clear()
+{
+    for (EntryList::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        release(*it);
+    }
+    entries.clear();
+    index.clear();
+}
+
+std::string OpenFileCache::makeETag(const struct stat &fileStat)
+{
+    char etag[64];
+    std::snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"",
+                  static_cast<unsigned long>(fileStat.st_ino),
+                  static_cast<unsigned long>(fileStat.st_size),
+                  static_cast<unsigned long>(fileStat.st_mtime));
+    return etag;
+}
+
+std::string OpenFileCache::makeHttpDate(time_t when)
+{
+    char date[64];
+    struct tm tmBuf;
+    std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&when, &tmBuf));
+    return date;
+}
+
+time_t OpenFileCache::parseHttpDate(const std::string &date)
+{
+    struct tm tmBuf;
+    std::memset(&tmBuf, 0, sizeof(tmBuf));
+    const char *end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tmBuf);
+    if (!end || *end != '\0')
+        return -1;
+    return timegm(&tmBuf);
+}
+
+bool OpenFileCache::load(Entry &entry, const struct stat &fileStat)
+{
+    entry.isDirectory = S_ISDIR(fileStat.st_mode);
+    if (!entry.isDirectory)
+    {
+        if (!S_ISREG(fileStat.st_mode))
+            return false;
+        entry.fd = open(entry.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (entry.fd < 0)
+            return false;
+        entry.mimeType = mimeResolver(entry.path);
+    }
+
+    entry.size = fileStat.st_size;
+    entry.mtime = fileStat.st_mtime;
+    entry.inode = fileStat.st_ino;
+    entry.etag = makeETag(fileStat);
+    entry.lastModified = makeHttpDate(fileStat.st_mtime);
+    return true;
+}
+
+void OpenFileCache::release(Entry &entry)
+{
+    if (entry.fd >= 0)
+    {
+        close(entry.fd);
+        entry.fd = -1;
+    }
+}
+
+void OpenFileCache::evict(std::map<std::string, EntryList::iterator>::iterator it)
+{
+    release(*it->second);
+    entries.erase(it->second);
+    index.erase(it);
+}
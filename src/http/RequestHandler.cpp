@@ -5,17 +5,54 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <strings.h>
+#include "ByteRangesStream.hpp"
+#include "CgiCacheOperation.hpp"
+#include "CgiEnvironment.hpp"
 #include "CgiOperation.hpp"
 #include "ClientConnection.hpp"
+#include "CompressedBodyStream.hpp"
+#include "DirectoryListing.hpp"
+#include "FastCgiOperation.hpp"
+#include "MultipartParser.hpp"
+#include "utiles.hpp"
 
 RequestHandler::RequestHandler(const Config &config, SocketManager &socketManager)
-    : config(config), socketManager(socketManager)
+    : config(config), socketManager(socketManager), fileCache(&RequestHandler::getMimeType)
 {
+    fileCache.configure(config.openFileCacheMax, config.openFileCacheValid);
+    fastcgiPool.configure(config.fastcgiKeepalive);
+    for (size_t i = 0; i < config.servers.size(); ++i)
+    {
+        const std::vector<Config::LocationConfig> &locations = config.servers[i].locations;
+        for (size_t j = 0; j < locations.size(); ++j)
+        {
+            std::string interpreterPath;
+            if (locations[j].cgiPoolMaxIdle > 0 && resolveInterpreter(locations[j].cgiPass, interpreterPath))
+            {
+                cgiWorkerPool.configure(interpreterPath, locations[j].cgiWorker,
+                                        locations[j].cgiPoolMinIdle, locations[j].cgiPoolMaxIdle);
+            }
+            if (locations[j].cgiCacheSize > 0)
+            {
+                cgiCaches[&locations[j]] = new CgiResponseCache(locations[j].cgiCacheSize);
+            }
+        }
+    }
+    loadErrorPages();
 }
 
 RequestHandler::~RequestHandler()
 {
+    for (std::map<const Config::LocationConfig*, CgiResponseCache*>::iterator it = cgiCaches.begin();
+         it != cgiCaches.end(); ++it)
+    {
+        delete it->second;
+    }
 }
 
 void RequestHandler::handleRequest(const HttpRequest &request, HttpResponse &response, ClientConnection* connection)
@@ -44,7 +81,7 @@ void RequestHandler::handleRequest(const HttpRequest &request, HttpResponse &res
         
         if (!isMethodAllowed(method, locationConfig))
         {
-            serveErrorPage(405, response, serverConfig);
+            serveErrorPage(405, response, serverConfig, &locationConfig);
             return;
         }
 
@@ -56,7 +93,7 @@ void RequestHandler::handleRequest(const HttpRequest &request, HttpResponse &res
             
             if (contentLength > maxBodySize)
             {
-                serveErrorPage(413, response, serverConfig);
+                serveErrorPage(413, response, serverConfig, &locationConfig);
                 return;
             }
         }
@@ -81,7 +118,7 @@ void RequestHandler::handleRequest(const HttpRequest &request, HttpResponse &res
         }
         else
         {
-            serveErrorPage(501, response, serverConfig);
+            serveErrorPage(501, response, serverConfig, &locationConfig);
         }
         
     }
@@ -112,21 +149,34 @@ void RequestHandler::generateErrorPage(int errorCode, HttpResponse &response, in
     }
 }
 
+void RequestHandler::getBodyLimits(const HttpRequest &request, int serverFd,
+                                   size_t &maxBodySize, size_t &bufferSize) const
+{
+    const Config::ServerConfig &serverConfig = findServerConfig(request, serverFd);
+    const Config::LocationConfig &locationConfig = findLocationConfig(serverConfig, request.getUri());
+
+    maxBodySize = locationConfig.clientMaxBodySize > 0 ?
+                  locationConfig.clientMaxBodySize : serverConfig.clientMaxBodySize;
+    bufferSize = locationConfig.clientBodyBufferSize > 0 ?
+                 locationConfig.clientBodyBufferSize : serverConfig.clientBodyBufferSize;
+}
+
 void RequestHandler::processGetRequest(const HttpRequest &request, HttpResponse &response, 
                                      const Config::ServerConfig &server, const Config::LocationConfig &location,
                                      ClientConnection* connection)
 {
     std::string uri = request.getUri();
     std::string filePath = resolveFilePath(uri, location, server);
-    
+    const OpenFileCache::Entry *cached = fileCache.lookup(filePath);
+    struct stat fileStat;
 
-    if (!fileExists(filePath))
+    if (!cached && stat(filePath.c_str(), &fileStat) != 0)
     {
-        serveErrorPage(404, response, server);
+        serveErrorPage(404, response, server, &location);
         return;
     }
 
-    if (isDirectory(filePath))
+    if (cached ? cached->isDirectory : S_ISDIR(fileStat.st_mode))
     {
         std::string indexFile = location.index.empty() ? server.index : location.index;
         if (indexFile.empty())
@@ -137,34 +187,36 @@ void RequestHandler::processGetRequest(const HttpRequest &request, HttpResponse
             indexPath += "/";
         indexPath += indexFile;
 
-        if (fileExists(indexPath) && !isDirectory(indexPath))
+        const OpenFileCache::Entry *cachedIndex = fileCache.lookup(indexPath);
+        if (cachedIndex ? !cachedIndex->isDirectory : (fileExists(indexPath) && !isDirectory(indexPath)))
         {
-            serveStaticFile(indexPath, response);
+            serveFile(request, indexPath, response);
         }
         else if (location.autoindex || server.autoindex)
         {
-            serveDirectoryListing(filePath, response);
+            serveDirectoryListing(filePath, location.autoindexFormat.empty() ?
+                                  server.autoindexFormat : location.autoindexFormat, response);
         }
         else
         {
-            serveErrorPage(403, response, server);
+            serveErrorPage(403, response, server, &location);
         }
     }
     else
     {
         
-        if (!location.cgiPass.empty())
+        if (!location.cgiPass.empty() || !location.fastcgiPass.empty())
         {
             executeCgi(request, response, server, location, connection);
             return;
         }     
-        if (hasPermission(filePath))
+        if (cached || hasPermission(filePath))
         {
-            serveStaticFile(filePath, response);
+            serveFile(request, filePath, response);
         }
         else
         {
-            serveErrorPage(403, response, server);
+            serveErrorPage(403, response, server, &location);
         }
     }
 }
@@ -175,7 +227,7 @@ void RequestHandler::processPostRequest(const HttpRequest &request, HttpResponse
 {
     std::string uri = request.getUri();
     
-    if (!location.cgiPass.empty())
+    if (!location.cgiPass.empty() || !location.fastcgiPass.empty())
     {
         executeCgi(request, response, server, location, connection);
         return;
@@ -195,7 +247,7 @@ void RequestHandler::processPostRequest(const HttpRequest &request, HttpResponse
     {
         std::string filePath = resolveFilePath(uri, location, server);
         
-        if (createFile(filePath, request.getBody()))
+        if (storeRequestBody(request, filePath))
         {
             response.setStatus(201, "Created");
             response.setBody("Resource created successfully");
@@ -203,7 +255,7 @@ void RequestHandler::processPostRequest(const HttpRequest &request, HttpResponse
         }
         else
         {
-            serveErrorPage(500, response, server);
+            serveErrorPage(500, response, server, &location);
         }
     }
 }
@@ -218,18 +270,18 @@ void RequestHandler::processDeleteRequest(const HttpRequest &request, HttpRespon
 
     if (!fileExists(filePath))
     {
-        serveErrorPage(404, response, server);
+        serveErrorPage(404, response, server, &location);
         return;
     }
 
     if (!hasPermission(filePath))
     {
-        serveErrorPage(403, response, server);
+        serveErrorPage(403, response, server, &location);
         return;
     }
     if (isDirectory(filePath))
     {
-        serveErrorPage(403, response, server);
+        serveErrorPage(403, response, server, &location);
         return;
     }
 
@@ -240,170 +292,602 @@ void RequestHandler::processDeleteRequest(const HttpRequest &request, HttpRespon
     }
     else
     {
-        serveErrorPage(500, response, server);
+        serveErrorPage(500, response, server, &location);
     }
 }
 
+// A static file, or 304 Not Modified when the client's copy is current. The
+// validators come from the open file cache or a stat(), so revalidation
+// never opens the file.
+void RequestHandler::serveFile(const HttpRequest &request, const std::string &filePath, HttpResponse &response)
+{
+    bool conditional = request.hasHeader("If-None-Match") || request.hasHeader("If-Modified-Since");
+    if (conditional || config.gzipStatic)
+    {
+        std::string etag;
+        std::string lastModified;
+        time_t mtime = 0;
+        const OpenFileCache::Entry *cached = fileCache.lookup(filePath);
+        struct stat fileStat;
+        if (cached && !cached->isDirectory)
+        {
+            etag = cached->etag;
+            lastModified = cached->lastModified;
+            mtime = cached->mtime;
+        }
+        else if (!cached && stat(filePath.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode))
+        {
+            etag = OpenFileCache::makeETag(fileStat);
+            lastModified = OpenFileCache::makeHttpDate(fileStat.st_mtime);
+            mtime = fileStat.st_mtime;
+        }
+
+        if (!etag.empty() && conditional && isNotModified(request, etag, mtime))
+        {
+            response.setStatus(304, "Not Modified");
+            response.setHeader("ETag", etag);
+            response.setHeader("Last-Modified", lastModified);
+            return;
+        }
+        // A precompressed sibling stands in for the file, so it carries the
+        // file's validators, weakened like those of a compressed response
+        if (!etag.empty() && servePrecompressed(request, filePath, response))
+        {
+            response.setHeader("ETag", "W/" + etag);
+            response.setHeader("Last-Modified", lastModified);
+        }
+    }
+    if (!response.hasBodyFile())
+    {
+        serveStaticFile(filePath, response);
+    }
+
+    if (response.hasBodyFile())
+    {
+        response.setHeader("Accept-Ranges", "bytes");
+        if (request.hasHeader("Range"))
+        {
+            serveRanges(request, response);
+        }
+    }
+}
+
+// Turns a whole-file 200 into a 206 of the requested ranges: one range is
+// still sent with sendfile(), several as multipart/byteranges. A Range that
+// cannot be parsed, or asks for too much, is ignored; one that misses the
+// file entirely gets 416.
+void RequestHandler::serveRanges(const HttpRequest &request, HttpResponse &response)
+{
+    // If-Range compares strongly: a weak tag or another date means the
+    // client's partial copy may not belong to this representation
+    std::string ifRange = request.getHeader("If-Range");
+    if (!ifRange.empty())
+    {
+        const char *validator = ifRange[0] == '"' ? "ETag" : "Last-Modified";
+        if (ifRange != response.getHeader(validator))
+        {
+            return;
+        }
+    }
+
+    size_t size = std::strtoul(response.getHeader("Content-Length").c_str(), NULL, 10);
+    ByteRangesStream::Ranges ranges;
+    if (!parseRanges(request.getHeader("Range"), size, ranges))
+    {
+        return;
+    }
+    if (ranges.empty())
+    {
+        setErrorResponse(416, response, "Range Not Satisfiable");
+        response.setHeader("Content-Range", "bytes */" + itoa(size));
+        return;
+    }
+
+    off_t offset;
+    size_t length;
+    int fd = response.releaseBodyFile(offset, length);
+    response.setStatus(206, "Partial Content");
+    if (ranges.size() == 1)
+    {
+        off_t first = ranges[0].first;
+        response.setBodyFile(fd, offset + first, ranges[0].second);
+        response.setHeader("Content-Range", "bytes " + itoa(first) + "-" +
+                           itoa(first + ranges[0].second - 1) + "/" + itoa(size));
+        return;
+    }
+
+    static unsigned long boundaryCounter = 0;
+    char boundary[40];
+    std::snprintf(boundary, sizeof(boundary), "%08lx%08lx", static_cast<unsigned long>(time(NULL)),
+                  ++boundaryCounter);
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        ranges[i].first += offset;
+    }
+
+    ByteRangesStream *stream = new ByteRangesStream(fd, static_cast<off_t>(size), ranges,
+                                                    response.getHeader("Content-Type"), boundary);
+    response.setBodyStream(stream);
+    response.setHeader("Content-Type", std::string("multipart/byteranges; boundary=") + boundary);
+    response.setHeader("Content-Length", itoa(stream->getLength()));
+}
+
+// "bytes=" followed by first-last, first- and -suffix ranges. Ranges that
+// start past the end are dropped; false if the header is malformed, or the
+// ranges are too many or add up to more than the file (overlapping
+// ranges are a cheap way to multiply a response).
+bool RequestHandler::parseRanges(const std::string &header, size_t size, ByteRangesStream::Ranges &ranges)
+{
+    if (header.size() < 6 || strncasecmp(header.c_str(), "bytes=", 6) != 0)
+    {
+        return false;
+    }
+
+    size_t total = 0;
+    size_t count = 0;
+    size_t start = 6;
+    while (start <= header.size())
+    {
+        size_t end = header.find(',', start);
+        if (end == std::string::npos)
+            end = header.size();
+        std::string spec = header.substr(start, end - start);
+        start = end + 1;
+
+        size_t first = spec.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            continue;
+        spec = spec.substr(first, spec.find_last_not_of(" \t") - first + 1);
+
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos || ++count > MAX_RANGES)
+            return false;
+        std::string firstText = spec.substr(0, dash);
+        std::string lastText = spec.substr(dash + 1);
+        size_t rangeFirst;
+        size_t rangeLast;
+        if (firstText.empty())
+        {
+            size_t suffix;
+            if (!parseRangeNumber(lastText, suffix))
+                return false;
+            if (suffix == 0 || size == 0)
+                continue;
+            rangeFirst = suffix < size ? size - suffix : 0;
+            rangeLast = size - 1;
+        }
+        else
+        {
+            if (!parseRangeNumber(firstText, rangeFirst))
+                return false;
+            if (lastText.empty())
+                rangeLast = size - 1;
+            else if (!parseRangeNumber(lastText, rangeLast) || rangeLast < rangeFirst)
+                return false;
+            if (rangeFirst >= size)
+                continue;
+            if (rangeLast >= size)
+                rangeLast = size - 1;
+        }
+
+        total += rangeLast - rangeFirst + 1;
+        if (total > size)
+            return false;
+        ranges.push_back(std::make_pair(static_cast<off_t>(rangeFirst), rangeLast - rangeFirst + 1));
+    }
+    return count > 0;
+}
+
+bool RequestHandler::parseRangeNumber(const std::string &text, size_t &value)
+{
+    if (text.empty() || text.size() > 18 || text.find_first_not_of("0123456789") != std::string::npos)
+    {
+        return false;
+    }
+    value = std::strtoul(text.c_str(), NULL, 10);
+    return true;
+}
+
 void RequestHandler::serveStaticFile(const std::string &filePath, HttpResponse &response)
 {
-    std::ifstream file(filePath.c_str(), std::ios::binary);
-    if (!file.is_open())
+    const OpenFileCache::Entry *cached = fileCache.lookup(filePath);
+    if (cached && !cached->isDirectory)
+    {
+        serveCachedFile(*cached, response);
+        return;
+    }
+
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
         response.setStatus(404, "Not Found");
         return;
     }
 
-    std::ostringstream oss;
-    oss << file.rdbuf();
-    file.close();
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode))
+    {
+        close(fd);
+        response.setStatus(404, "Not Found");
+        return;
+    }
 
     std::string mimeType = getMimeType(filePath);
     
+    // The body stays on disk; ClientConnection streams it with sendfile()
     response.setStatus(200, "OK");
-    response.setBody(oss.str());
+    response.setBodyFile(fd, 0, static_cast<size_t>(fileStat.st_size));
     response.setHeader("Content-Type", mimeType);
+    response.setHeader("ETag", OpenFileCache::makeETag(fileStat));
+    response.setHeader("Last-Modified", OpenFileCache::makeHttpDate(fileStat.st_mtime));
 }
 
-void RequestHandler::serveDirectoryListing(const std::string &dirPath, HttpResponse &response)
+void RequestHandler::serveCachedFile(const OpenFileCache::Entry &entry, HttpResponse &response)
 {
-    DIR* dir = opendir(dirPath.c_str());
-    if (!dir)
+    // The response owns a duplicate so eviction never closes a descriptor mid-transfer;
+    // sendfile() uses its own offset, so sharing the open file description is safe.
+    // Unlike dup(), F_DUPFD_CLOEXEC keeps the copy out of spawned CGIs.
+    int fd = fcntl(entry.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0)
     {
-        response.setStatus(403, "Forbidden");
+        response.setStatus(500, "Internal Server Error");
         return;
     }
 
-    std::ostringstream html;
-    html << "<!DOCTYPE html>\n";
-    html << "<html>\n<head>\n";
-    html << "<title>Index of " << dirPath << "</title>\n";
-    html << "<style>\n";
-    html << "body { font-family: Arial, sans-serif; margin: 40px; }\n";
-    html << "h1 { color: #333; }\n";
-    html << "table { border-collapse: collapse; width: 100%; }\n";
-    html << "th, td { text-align: left; padding: 8px; border-bottom: 1px solid #ddd; }\n";
-    html << "th { background-color: #f2f2f2; }\n";
-    html << "a { text-decoration: none; color: #0066cc; }\n";
-    html << "a:hover { text-decoration: underline; }\n";
-    html << "</style>\n";
-    html << "</head>\n<body>\n";
-    html << "<h1>Index of " << dirPath << "</h1>\n";
-    html << "<table>\n";
-    html << "<tr><th>Name</th><th>Size</th><th>Type</th></tr>\n";
-
-    struct dirent* entry;
-
-    while ((entry = readdir(dir)) != NULL)
-    {
-        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || 
-            (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
-            continue; // Skip . and ..
-
-        std::string fullPath = dirPath;
-        if (fullPath[fullPath.length() - 1] != '/')
-            fullPath += "/";
-        fullPath += entry->d_name;
+    response.setStatus(200, "OK");
+    response.setBodyFile(fd, 0, static_cast<size_t>(entry.size));
+    response.setHeader("Content-Type", entry.mimeType);
+    response.setHeader("ETag", entry.etag);
+    response.setHeader("Last-Modified", entry.lastModified);
+}
 
-        struct stat fileStat;
-        std::string fileType = "File";
-        std::string fileSize = "-";
-        
-        if (stat(fullPath.c_str(), &fileStat) == 0)
+// gzip_static: a prebuilt foo.css.br or foo.css.gz next to foo.css is sent
+// as it is, with the type of the original, to clients that accept it
+bool RequestHandler::servePrecompressed(const HttpRequest &request, const std::string &filePath,
+                                        HttpResponse &response)
+{
+    if (!config.gzipStatic)
+    {
+        return false;
+    }
+
+    static const CompressedBodyStream::Coding codings[] = { CompressedBodyStream::BROTLI, CompressedBodyStream::GZIP };
+    static const char *const suffixes[] = { ".br", ".gz" };
+    std::string acceptEncoding = request.getHeader("Accept-Encoding");
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (!CompressedBodyStream::accepts(acceptEncoding, codings[i]))
         {
-            if (S_ISDIR(fileStat.st_mode))
-            {
-                fileType = "Directory";
-            }
-            else
+            continue;
+        }
+
+        std::string path = filePath + suffixes[i];
+        const OpenFileCache::Entry *sibling = fileCache.lookup(path);
+        int fd;
+        size_t size;
+        if (sibling)
+        {
+            if (sibling->isDirectory)
+                continue;
+            fd = fcntl(sibling->fd, F_DUPFD_CLOEXEC, 0);
+            size = static_cast<size_t>(sibling->size);
+        }
+        else
+        {
+            struct stat fileStat;
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0 && (fstat(fd, &fileStat) < 0 || !S_ISREG(fileStat.st_mode)))
             {
-                std::ostringstream sizeStr;
-                sizeStr << fileStat.st_size;
-                fileSize = sizeStr.str() + " bytes";
+                close(fd);
+                fd = -1;
             }
+            size = fd >= 0 ? static_cast<size_t>(fileStat.st_size) : 0;
+        }
+        if (fd < 0)
+        {
+            continue;
         }
 
-        html << "<tr>";
-        html << "<td><a href=\"" << entry->d_name;
-        if (fileType == "Directory") html << "/";
-        html << "\">" << entry->d_name << "</a></td>";
-        html << "<td>" << fileSize << "</td>";
-        html << "<td>" << fileType << "</td>";
-        html << "</tr>\n";
+        response.setStatus(200, "OK");
+        response.setBodyFile(fd, 0, size);
+        response.setHeader("Content-Type", getMimeType(filePath));
+        response.setHeader("Content-Encoding", CompressedBodyStream::codingName(codings[i]));
+        response.setHeader("Vary", "Accept-Encoding");
+        return true;
     }
+    return false;
+}
 
-    html << "</table>\n</body>\n</html>\n";
-    closedir(dir);
+// A listing that is still current is replayed from the cache for the cost
+// of one stat() on the directory; otherwise the directory is read while the
+// page is sent, and what was read is kept for the next request
+void RequestHandler::serveDirectoryListing(const std::string &dirPath, const std::string &format,
+                                           HttpResponse &response)
+{
+    DirectoryListingStream::Format streamFormat = format == "json" ?
+        DirectoryListingStream::FORMAT_JSON : DirectoryListingStream::FORMAT_HTML;
+    struct stat dirStat;
+    if (stat(dirPath.c_str(), &dirStat) < 0 || !S_ISDIR(dirStat.st_mode))
+    {
+        response.setStatus(403, "Forbidden");
+        return;
+    }
+
+    DirectoryListingStream *stream;
+    DirectoryListing *listing = listingCache.lookup(dirPath, dirStat);
+    if (listing)
+    {
+        stream = new DirectoryListingStream(dirPath, streamFormat, listing);
+    }
+    else
+    {
+        DIR* dir = opendir(dirPath.c_str());
+        if (!dir)
+        {
+            response.setStatus(403, "Forbidden");
+            return;
+        }
+        listing = new DirectoryListing(dirStat);
+        listingCache.store(dirPath, listing);
+        stream = new DirectoryListingStream(dirPath, streamFormat, listing, dir);
+    }
+    listing->release();
 
     response.setStatus(200, "OK");
-    response.setBody(html.str());
+    response.setBodyStream(stream);
+    response.setHeader("Content-Type", streamFormat == DirectoryListingStream::FORMAT_JSON ?
+                       "application/json" : "text/html");
+}
+
+// The matched location's error_page comes first, then the server's
+void RequestHandler::serveErrorPage(int errorCode, HttpResponse &response, const Config::ServerConfig &server,
+                                    const Config::LocationConfig *location)
+{
+    response.setStatus(errorCode, HttpResponse::getDefaultStatusMessage(errorCode));
+
+    if ((location && useErrorPage(errorCode, location->errorPages, response)) ||
+        useErrorPage(errorCode, server.errorPages, response))
+    {
+        return;
+    }
+
+    std::map<int, std::string>::iterator page = defaultErrorPages.find(errorCode);
+    if (page == defaultErrorPages.end())
+    {
+        std::ostringstream html;
+        html << "<!DOCTYPE html>\n";
+        html << "<html>\n<head>\n";
+        html << "<title>" << errorCode << " " << HttpResponse::getDefaultStatusMessage(errorCode) << "</title>\n";
+        html << "</head>\n<body>\n";
+        html << "<h1>" << errorCode << " " << HttpResponse::getDefaultStatusMessage(errorCode) << "</h1>\n";
+        html << "<p>The requested resource could not be found or accessed.</p>\n";
+        html << "<hr>\n";
+        html << "<p><em>" << HttpResponse::serverName << "</em></p>\n";
+        html << "</body>\n</html>\n";
+        page = defaultErrorPages.insert(std::make_pair(errorCode, html.str())).first;
+    }
+
+    response.setBody(page->second);
     response.setHeader("Content-Type", "text/html");
 }
 
-void RequestHandler::serveErrorPage(int errorCode, HttpResponse &response, const Config::ServerConfig &server)
+void RequestHandler::reloadCaches()
+{
+    fileCache.clear();
+    listingCache.clear();
+    loadErrorPages();
+    for (std::map<const Config::LocationConfig*, CgiResponseCache*>::iterator it = cgiCaches.begin();
+         it != cgiCaches.end(); ++it)
+    {
+        it->second->clear();
+    }
+    cgiWorkerPool.clear();
+    cgiWorkerPool.warmUp();
+}
+
+void RequestHandler::startCgiWorkers()
+{
+    cgiWorkerPool.warmUp();
+}
+
+void RequestHandler::refillCgiWorkers()
+{
+    cgiWorkerPool.refill();
+}
+
+// gzip / brotli: a 200 of a gzip_types type is compressed while it is sent,
+// brotli preferred. Bodies of a known length below gzip_min_length are left
+// alone; small in-memory ones are compressed on the spot.
+void RequestHandler::compressResponse(const HttpRequest &request, HttpResponse &response) const
+{
+    if ((!config.gzip && !config.brotli) || response.getStatusCode() != 200 ||
+        response.hasHeader("Content-Encoding"))
+    {
+        return;
+    }
+
+    std::string type = response.getHeader("Content-Type");
+    type = type.substr(0, type.find(';'));
+    type.erase(type.find_last_not_of(" \t") + 1);
+    for (size_t i = 0; i < type.size(); ++i)
+    {
+        type[i] = std::tolower(static_cast<unsigned char>(type[i]));
+    }
+    if (!config.gzipTypes.count(type) && !config.gzipTypes.count("*"))
+    {
+        return;
+    }
+    if (response.getHeader("Cache-Control").find("no-transform") != std::string::npos)
+    {
+        return;
+    }
+
+    // Caches must keep the compressed and the identity variant apart
+    std::string vary = response.getHeader("Vary");
+    if (vary.empty())
+    {
+        response.setHeader("Vary", "Accept-Encoding");
+    }
+    else if (vary.find("Accept-Encoding") == std::string::npos && vary != "*")
+    {
+        response.setHeader("Vary", vary + ", Accept-Encoding");
+    }
+
+    std::string length = response.getHeader("Content-Length");
+    if (!length.empty() && std::strtoul(length.c_str(), NULL, 10) < config.gzipMinLength)
+    {
+        return;
+    }
+
+    std::string acceptEncoding = request.getHeader("Accept-Encoding");
+    CompressedBodyStream::Coding coding;
+    int level;
+    if (config.brotli && CompressedBodyStream::accepts(acceptEncoding, CompressedBodyStream::BROTLI))
+    {
+        coding = CompressedBodyStream::BROTLI;
+        level = config.brotliCompLevel;
+    }
+    else if (config.gzip && CompressedBodyStream::accepts(acceptEncoding, CompressedBodyStream::GZIP))
+    {
+        coding = CompressedBodyStream::GZIP;
+        level = config.gzipCompLevel;
+    }
+    else
+    {
+        return;
+    }
+
+    if (response.hasBodyStream())
+    {
+        response.setBodyStream(new CompressedBodyStream(coding, level, response.releaseBodyStream()));
+    }
+    else if (response.hasBodyFile())
+    {
+        off_t offset;
+        size_t fileLength;
+        int fd = response.releaseBodyFile(offset, fileLength);
+        response.setBodyStream(new CompressedBodyStream(coding, level, fd, offset, fileLength));
+    }
+    else if (response.getBody().size() <= INLINE_COMPRESS_MAX)
+    {
+        std::string compressed;
+        if (!CompressedBodyStream::compress(coding, level, response.getBody(), compressed))
+        {
+            return;
+        }
+        response.setBody(compressed);
+    }
+    else
+    {
+        response.setBodyStream(new CompressedBodyStream(coding, level, response.getBody()));
+    }
+
+    response.setHeader("Content-Encoding", CompressedBodyStream::codingName(coding));
+    response.removeHeader("Accept-Ranges");
+    // The bytes differ from the identity variant, so only a weak match holds
+    std::string etag = response.getHeader("ETag");
+    if (!etag.empty() && etag.compare(0, 2, "W/") != 0)
+    {
+        response.setHeader("ETag", "W/" + etag);
+    }
+}
+
+bool RequestHandler::useErrorPage(int errorCode, const std::vector<Config::ErrorPageConfig> &pages,
+                                  HttpResponse &response) const
 {
-    for (size_t i = 0; i < server.errorPages.size(); ++i)
+    for (size_t i = 0; i < pages.size(); ++i)
     {
-        if (server.errorPages[i].errorCode == errorCode)
+        if (pages[i].errorCode == errorCode)
         {
-            std::string errorPagePath = server.errorPages[i].filePath;
-            if (fileExists(errorPagePath))
+            std::map<std::string, CachedErrorPage>::const_iterator page = errorPageCache.find(pages[i].filePath);
+            if (page != errorPageCache.end())
             {
-                serveStaticFile(errorPagePath, response);
-                response.setStatus(errorCode, HttpResponse::getDefaultStatusMessage(errorCode));
-                return;
+                response.setBody(page->second.body);
+                response.setHeader("Content-Type", page->second.contentType);
+                return true;
             }
         }
     }
+    return false;
+}
 
-    std::ostringstream html;
-    html << "<!DOCTYPE html>\n";
-    html << "<html>\n<head>\n";
-    html << "<title>" << errorCode << " " << HttpResponse::getDefaultStatusMessage(errorCode) << "</title>\n";
-    html << "</head>\n<body>\n";
-    html << "<h1>" << errorCode << " " << HttpResponse::getDefaultStatusMessage(errorCode) << "</h1>\n";
-    html << "<p>The requested resource could not be found or accessed.</p>\n";
-    html << "<hr>\n";
-    html << "<p><em>" << HttpResponse::serverName << "</em></p>\n";
-    html << "</body>\n</html>\n";
+// Error pages are read once so 4xx/5xx floods never touch the disk. A page
+// that cannot be read falls back to the generated one, as before.
+void RequestHandler::loadErrorPages()
+{
+    errorPageCache.clear();
 
-    response.setStatus(errorCode, HttpResponse::getDefaultStatusMessage(errorCode));
-    response.setBody(html.str());
-    response.setHeader("Content-Type", "text/html");
-    
+    for (size_t i = 0; i < config.servers.size(); ++i)
+    {
+        const Config::ServerConfig &server = config.servers[i];
+        for (size_t j = 0; j < server.errorPages.size(); ++j)
+        {
+            loadErrorPage(server.errorPages[j].filePath);
+        }
+        for (size_t j = 0; j < server.locations.size(); ++j)
+        {
+            const Config::LocationConfig &location = server.locations[j];
+            for (size_t k = 0; k < location.errorPages.size(); ++k)
+            {
+                loadErrorPage(location.errorPages[k].filePath);
+            }
+        }
+    }
+}
+
+void RequestHandler::loadErrorPage(const std::string &path)
+{
+    if (errorPageCache.find(path) != errorPageCache.end())
+        return;
+
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Warning: cannot read error page " << path << std::endl;
+        return;
+    }
+
+    std::ostringstream content;
+    content << file.rdbuf();
+
+    CachedErrorPage &page = errorPageCache[path];
+    page.body = content.str();
+    page.contentType = getMimeType(path);
 }
 
 void RequestHandler::executeCgi(const HttpRequest &request, HttpResponse &response, 
                                const Config::ServerConfig &server, const Config::LocationConfig &location,
                                ClientConnection* connection)
 {
-    std::string uri = request.getUri();
-    std::string scriptPath = resolveFilePath(uri, location, server);
-    std::string interpreterPath = location.cgiPass;
-    
-    if (interpreterPath.substr(0, 2) == "./") {
-        std::string relativePath = interpreterPath.substr(2);
-        
-        if (relativePath.substr(0, 7) == "usr/bin" || relativePath.substr(0, 4) == "bin/") {
-            std::string absolutePath = "/" + relativePath;
-            if (access(absolutePath.c_str(), X_OK) == 0) {
-                interpreterPath = absolutePath;
-            }
-            else if (access(relativePath.c_str(), X_OK) == 0) {
-                interpreterPath = relativePath;
-            }
-            else {
-                response.setStatus(500, "Internal Server Error");
-                response.setBody("CGI interpreter not found");
-                response.setHeader("Content-Type", "text/plain");
+    // A stored GET or HEAD response is copied out without running anything;
+    // a miss for a key that is already being filled waits for that fill
+    CgiResponseCache *cache = NULL;
+    std::string cacheKey;
+    std::map<const Config::LocationConfig*, CgiResponseCache*>::iterator cacheIt = cgiCaches.find(&location);
+    if (cacheIt != cgiCaches.end() && (request.getMethod() == "GET" || request.getMethod() == "HEAD")) {
+        bool passed;
+        cacheKey = CgiResponseCache::makeKey(request);
+        const std::string *cached = cacheIt->second->lookup(cacheKey, passed);
+        if (cached) {
+            response.setCgiOutput(*cached);
+            return;
+        }
+        if (!passed && cacheIt->second->isFilling(cacheKey)) {
+            AsyncOperation* wait = new CgiCacheWaitOperation(*cacheIt->second, cacheKey);
+            if (!wait->hasError()) {
+                connection->setPendingOperation(wait);
                 return;
             }
-        }
-        else {
-            interpreterPath = relativePath;
+            std::cerr << "CGI: Cannot wait for cached response: " << wait->getError() << std::endl;
+            delete wait;
+        } else if (!passed) {
+            cache = cacheIt->second;
         }
     }
     
-    std::string documentRoot = location.root.empty() ? server.root : location.root;
+    std::string uri = request.getUri();
+    std::string scriptPath = resolveFilePath(uri, location, server);
     
     std::string serverPort = "8080";  // default
     std::string hostHeader = request.getHeader("Host");
@@ -416,25 +900,54 @@ void RequestHandler::executeCgi(const HttpRequest &request, HttpResponse &respon
     
     std::string clientAddr = connection->getClientAddress();
     
-    // Get client max body size from location config, fallback to server config
-    size_t clientMaxBodySize = location.clientMaxBodySize;
-    if (clientMaxBodySize == 0) {
-        clientMaxBodySize = server.clientMaxBodySize;
+    std::string interpreterPath;
+    if (location.fastcgiPass.empty() && !resolveInterpreter(location.cgiPass, interpreterPath)) {
+        response.setStatus(500, "Internal Server Error");
+        response.setBody("CGI interpreter not found");
+        response.setHeader("Content-Type", "text/plain");
+        return;
     }
     
-    CgiOperation* cgiOp = new CgiOperation(scriptPath, interpreterPath, request, documentRoot, 
-                                           serverPort, clientAddr, clientMaxBodySize);
+    bool pooled = !location.fastcgiPass.empty() || location.cgiPoolMaxIdle > 0;
+    if (pooled && !scriptPath.empty() && scriptPath[0] != '/') {
+        // The application runs in its own working directory
+        char cwd[4096];
+        if (scriptPath.compare(0, 2, "./") == 0) {
+            scriptPath.erase(0, 2);
+        }
+        if (getcwd(cwd, sizeof(cwd))) {
+            scriptPath = std::string(cwd) + "/" + scriptPath;
+        }
+    }
     
-    if (cgiOp->hasError()) {
-        std::cerr << "CGI: Failed to start CGI operation: " << cgiOp->getError() << std::endl;
+    // Only the request's own variables are formatted per request
+    std::vector<std::string> environment = getCgiEnvironmentTemplate(server, location);
+    size_t bodyLength = request.getMethod() == "POST" ? request.getBodySize() : 0;
+    appendRequestEnvironment(environment, request, scriptPath, serverPort, clientAddr, bodyLength);
+    
+    AsyncOperation* operation;
+    if (!location.fastcgiPass.empty()) {
+        operation = new FastCgiOperation(fastcgiPool, location.fastcgiPass, environment, request);
+    } else if (pooled) {
+        operation = new FastCgiOperation(cgiWorkerPool, CgiWorkerPool::makeKey(interpreterPath, location.cgiWorker),
+                                         environment, request);
+    } else {
+        operation = new CgiOperation(scriptPath, interpreterPath, request, environment);
+    }
+    if (cache && !operation->hasError()) {
+        operation = new CgiCacheFillOperation(*cache, cacheKey, request.hasHeader("Authorization"), operation);
+    }
+    
+    if (operation->hasError()) {
+        std::cerr << "CGI: Failed to start CGI operation: " << operation->getError() << std::endl;
         response.setStatus(500, "Internal Server Error");
-        response.setBody("Failed to start CGI script: " + cgiOp->getError());
+        response.setBody("Failed to start CGI script: " + operation->getError());
         response.setHeader("Content-Type", "text/plain");
-        delete cgiOp;
+        delete operation;
         return;
     }
     
-    connection->setPendingOperation(cgiOp);
+    connection->setPendingOperation(operation);
 }
 
 void RequestHandler::handleFileUpload(const HttpRequest &request, HttpResponse &response, 
@@ -461,95 +974,58 @@ void RequestHandler::handleFileUpload(const HttpRequest &request, HttpResponse &
     
     if (boundary.empty())
     {
-        serveErrorPage(400, response, server);
+        serveErrorPage(400, response, server, &location);
         return;
     }
     
-    std::string body = request.getBody();
-    std::string boundaryDelimiter = "--" + boundary;
-    
-    // Find the file part
-    size_t partStart = body.find(boundaryDelimiter);
-    if (partStart == std::string::npos)
-    {
-        serveErrorPage(400, response, server);
-        return;
-    }
-    
-    partStart = body.find("\r\n", partStart) + 2;
-    size_t partEnd = body.find(boundaryDelimiter, partStart);
-    
-    if (partEnd == std::string::npos)
-    {
-        serveErrorPage(400, response, server);
-        return;
-    }
-    
-    std::string part = body.substr(partStart, partEnd - partStart);
-    
-    // Extract filename from Content-Disposition header
-    std::string filename;
-    size_t filenamePos = part.find("filename=\"");
-    if (filenamePos != std::string::npos)
-    {
-        filenamePos += 10;
-        size_t filenameEnd = part.find("\"", filenamePos);
-        filename = part.substr(filenamePos, filenameEnd - filenamePos);
-    }
-    
-    if (filename.empty())
-    {
-        filename = "upload_" + getCurrentTimestamp();
-    }
-    
-    // Extract file content (after headers)
-    size_t contentStart = part.find("\r\n\r\n");
-    if (contentStart == std::string::npos)
+    // Parts are streamed straight to their destination files, whether the
+    // body is in memory or was spooled to disk while it was received
+    MultipartParser parser(boundary, uploadDir, "upload_" + getCurrentTimestamp());
+    bool parsed = true;
+
+    if (request.isBodySpooled())
     {
-        contentStart = part.find("\n\n");
-        if (contentStart != std::string::npos)
-            contentStart += 2;
+        int fd = open(request.getBodyFilePath().c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            serveErrorPage(500, response, server, &location);
+            return;
+        }
+        char buffer[65536];
+        ssize_t bytesRead;
+        while (parsed && (bytesRead = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            parsed = parser.feed(buffer, static_cast<size_t>(bytesRead));
+        }
+        close(fd);
     }
     else
     {
-        contentStart += 4;
+        parsed = parser.feed(request.getBody().data(), request.getBody().size());
     }
-    
-    if (contentStart == std::string::npos)
+
+    if (!parsed || !parser.finish())
     {
-        serveErrorPage(400, response, server);
+        serveErrorPage(parser.getSavedFiles().empty() ? 400 : 500, response, server, &location);
         return;
     }
-    
-    // Extract content (remove trailing \r\n before boundary)
-    std::string fileContent = part.substr(contentStart);
-    if (fileContent.length() >= 2 && fileContent.substr(fileContent.length() - 2) == "\r\n")
-    {
-        fileContent = fileContent.substr(0, fileContent.length() - 2);
-    }
-    
-    std::string fullPath = uploadDir + "/" + filename;
-    
-    // Save file in binary mode to support all file types (images, etc.)
-    std::ofstream file(fullPath.c_str(), std::ios::binary);
-    if (!file.is_open())
+
+    const std::vector<std::string> &savedFiles = parser.getSavedFiles();
+    std::string filenames = savedFiles[0];
+    for (size_t i = 1; i < savedFiles.size(); ++i)
     {
-        serveErrorPage(500, response, server);
-        return;
+        filenames += ", " + savedFiles[i];
     }
     
-    file.write(fileContent.c_str(), fileContent.length());
-    file.close();
-    
     response.setStatus(201, "Created");
-    response.setBody("File uploaded successfully: " + filename);
+    response.setBody("File uploaded successfully: " + filenames);
     response.setHeader("Content-Type", "text/plain");
 }
 
 void RequestHandler::handleFormData(const HttpRequest &request, HttpResponse &response)
 {
     response.setStatus(200, "OK");
-    response.setBody("Form data processed successfully\nReceived: " + request.getBody());
+    response.setBody("Form data processed successfully\nReceived: " + request.readBody());
     response.setHeader("Content-Type", "text/plain");
 }
 
@@ -614,6 +1090,46 @@ bool RequestHandler::createFile(const std::string &path, const std::string &cont
     return true;
 }
 
+// Stores a raw request body at path. A spooled body is moved into place
+// instead of being copied through memory.
+bool RequestHandler::storeRequestBody(const HttpRequest &request, const std::string &path) const
+{
+    if (!request.isBodySpooled())
+    {
+        return createFile(path, request.getBody());
+    }
+
+    // The spool file now lives at path; the request must not unlink it
+    if (const_cast<HttpRequest &>(request).moveBodyFile(path))
+    {
+        return true;
+    }
+
+    // Different filesystem: copy the spool file in fixed-size chunks
+    int in = open(request.getBodyFilePath().c_str(), O_RDONLY);
+    if (in < 0)
+    {
+        return false;
+    }
+    int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+
+    bool ok = true;
+    char buffer[65536];
+    ssize_t bytesRead;
+    while (ok && (bytesRead = read(in, buffer, sizeof(buffer))) > 0)
+    {
+        ok = write(out, buffer, bytesRead) == bytesRead;
+    }
+    close(in);
+    close(out);
+    return ok && bytesRead == 0;
+}
+
 std::string RequestHandler::getCurrentTimestamp() const
 {
     std::time_t now = std::time(0);
@@ -622,7 +1138,62 @@ std::string RequestHandler::getCurrentTimestamp() const
     return oss.str();
 }
 
-std::string RequestHandler::getMimeType(const std::string &filePath) const
+const std::vector<std::string> &RequestHandler::getCgiEnvironmentTemplate(const Config::ServerConfig &server,
+                                                                          const Config::LocationConfig &location)
+{
+    std::pair<const Config::ServerConfig*, const Config::LocationConfig*> key(&server, &location);
+    std::map<std::pair<const Config::ServerConfig*, const Config::LocationConfig*>,
+             std::vector<std::string> >::iterator it = cgiEnvironmentTemplates.find(key);
+    if (it != cgiEnvironmentTemplates.end())
+    {
+        return it->second;
+    }
+
+    std::string documentRoot = location.root.empty() ? server.root : location.root;
+    // Client max body size from the location, falling back to the server's
+    size_t clientMaxBodySize = location.clientMaxBodySize;
+    if (clientMaxBodySize == 0)
+    {
+        clientMaxBodySize = server.clientMaxBodySize;
+    }
+    return cgiEnvironmentTemplates[key] = buildCgiEnvironmentTemplate(documentRoot, clientMaxBodySize);
+}
+
+// "./usr/bin/python3" style paths name a system interpreter when one
+// exists there; other "./" paths are relative to the working directory
+bool RequestHandler::resolveInterpreter(const std::string &cgiPass, std::string &interpreterPath)
+{
+    interpreterPath = cgiPass;
+    if (interpreterPath.substr(0, 2) != "./")
+    {
+        return true;
+    }
+
+    std::string relativePath = interpreterPath.substr(2);
+    if (relativePath.substr(0, 7) == "usr/bin" || relativePath.substr(0, 4) == "bin/")
+    {
+        std::string absolutePath = "/" + relativePath;
+        if (access(absolutePath.c_str(), X_OK) == 0)
+        {
+            interpreterPath = absolutePath;
+        }
+        else if (access(relativePath.c_str(), X_OK) == 0)
+        {
+            interpreterPath = relativePath;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else
+    {
+        interpreterPath = relativePath;
+    }
+    return true;
+}
+
+std::string RequestHandler::getMimeType(const std::string &filePath)
 {
     size_t dotPos = filePath.find_last_of('.');
     if (dotPos == std::string::npos)
@@ -657,12 +1228,48 @@ std::string RequestHandler::getMimeType(const std::string &filePath) const
         mimeType = "image/gif";
     else if (extension == "txt")
         mimeType = "text/plain";
+    else if (extension == "svg")
+        mimeType = "image/svg+xml";
+    else if (extension == "xml")
+        mimeType = "application/xml";
     else
         mimeType = "application/octet-stream";
     
     return mimeType;
 }
 
+// If-None-Match takes precedence over If-Modified-Since; entity tags are
+// compared weakly, so a W/ tag from a compressed response still matches
+bool RequestHandler::isNotModified(const HttpRequest &request, const std::string &etag, time_t mtime)
+{
+    if (request.hasHeader("If-None-Match"))
+    {
+        std::string ifNoneMatch = request.getHeader("If-None-Match");
+        std::string tag = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+        size_t start = 0;
+        while (start < ifNoneMatch.size())
+        {
+            size_t end = ifNoneMatch.find(',', start);
+            if (end == std::string::npos)
+                end = ifNoneMatch.size();
+            size_t first = ifNoneMatch.find_first_not_of(" \t", start);
+            if (first < end)
+            {
+                std::string candidate = ifNoneMatch.substr(first, ifNoneMatch.find_last_not_of(" \t", end - 1) - first + 1);
+                if (candidate.compare(0, 2, "W/") == 0)
+                    candidate.erase(0, 2);
+                if (candidate == "*" || candidate == tag)
+                    return true;
+            }
+            start = end + 1;
+        }
+        return false;
+    }
+
+    time_t since = OpenFileCache::parseHttpDate(request.getHeader("If-Modified-Since"));
+    return since >= 0 && mtime <= since;
+}
+
 bool RequestHandler::isMethodAllowed(const std::string &method, const Config::LocationConfig &location) const
 {
     
@@ -705,8 +1312,8 @@ bool RequestHandler::isValidRequest(const HttpRequest &request) const
 
     if (request.getMethod() == "POST")
     {
-        std::string contentLength = request.getHeader("content-length");
-        if (contentLength.empty())
+        // The parser only accepts Transfer-Encoding when it is "chunked"
+        if (!request.hasHeader("content-length") && !request.hasHeader("transfer-encoding"))
         {
             std::cerr << "VALIDATION: POST request missing Content-Length header" << std::endl;
             return false;
@@ -718,68 +1325,16 @@ bool RequestHandler::isValidRequest(const HttpRequest &request) const
 
 const Config::ServerConfig &RequestHandler::findServerConfig(const HttpRequest &request, int serverFd) const
 {
-    std::string hostHeader = request.getHeader("host");
-    
-    if (hostHeader.empty())
-    {
-        const std::vector<const Config::ServerConfig*>* serverConfigs = socketManager.getServerConfigs(serverFd);
-        if (serverConfigs && !serverConfigs->empty())
-        {
-            return *(serverConfigs->at(0));
-        }
-        if (!config.servers.empty())
-        {
-            return config.servers[0];
-        }
-        throw std::runtime_error("No server configurations available");
-    }
-
-    std::string hostname = hostHeader;
-    size_t colonPos = hostname.find(':');
-    if (colonPos != std::string::npos)
-    {
-        hostname = hostname.substr(0, colonPos);
-    }
-    
-    hostname = toLower(hostname);
-
-    const std::vector<const Config::ServerConfig*>* serverConfigs = socketManager.getServerConfigs(serverFd);
-    
-    if (!serverConfigs || serverConfigs->empty())
-    {
-        if (!config.servers.empty())
-        {
-            return config.servers[0];
-        }
-        throw std::runtime_error("No server configurations available");
-    }
-    
-    for (size_t i = 0; i < serverConfigs->size(); ++i)
+    const Config::ServerConfig *server = socketManager.findServerConfig(serverFd, request.getHeader("host"));
+    if (server)
     {
-        const Config::ServerConfig* server = serverConfigs->at(i);
-        const std::vector<std::string> &serverNames = server->serverNames;
-        
-        for (size_t j = 0; j < serverNames.size(); ++j)
-        {
-            std::string serverName = toLower(serverNames[j]);
-            
-            if (serverName == hostname)
-            {
-                return *server;
-            }
-        }
+        return *server;
     }
-    return *(serverConfigs->at(0));
-}
-
-std::string RequestHandler::toLower(const std::string &str) const
-{
-    std::string result = str;
-    for (size_t i = 0; i < result.length(); ++i)
+    if (!config.servers.empty())
     {
-        result[i] = std::tolower(static_cast<unsigned char>(result[i]));
+        return config.servers[0];
     }
-    return result;
+    throw std::runtime_error("No server configurations available");
 }
 
 const Config::LocationConfig &RequestHandler::findLocationConfig(const Config::ServerConfig &server, const std::string &uri) const
@@ -794,45 +1349,16 @@ const Config::LocationConfig &RequestHandler::findLocationConfig(const Config::S
         defaultLocation.root = "./www";
         defaultLocation.autoindex = false;
         defaultLocation.clientMaxBodySize = 0;
+        defaultLocation.clientBodyBufferSize = 0;
         defaultLocation.allowedMethods.clear();
         
         return defaultLocation;
     }
     
-    const Config::LocationConfig *bestMatch = NULL;
-    size_t bestMatchLength = 0;
-
-    for (size_t i = 0; i < locations.size(); ++i)
-    {
-        const std::string &locationPath = locations[i].path;
-        
-        bool matches = false;
-        
-        if (locationPath.length() > 0 && locationPath[0] == '*')
-        {
-            std::string extension = locationPath.substr(1); 
-            if (uri.length() >= extension.length() && 
-                uri.substr(uri.length() - extension.length()) == extension)
-            {
-                matches = true;
-            }
-        }
-        
-        else if (uri.find(locationPath) == 0)
-        {
-            matches = true;
-        }
-        
-        if (matches && locationPath.length() > bestMatchLength)
-        {
-            bestMatch = &locations[i];
-            bestMatchLength = locationPath.length();
-        }
-    }
-
-    if (bestMatch)
+    int bestMatch = server.locationIndex.match(uri);
+    if (bestMatch >= 0)
     {
-        return *bestMatch;
+        return locations[bestMatch];
     }
 
     return locations[0];
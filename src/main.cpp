@@ -12,6 +12,7 @@ int main(void)
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
     signal(SIGQUIT, signalHandler);
+    signal(SIGHUP, reloadHandler);
     signal(SIGPIPE, SIG_IGN);
 
     try
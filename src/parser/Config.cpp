@@ -4,8 +4,33 @@
 #include <algorithm>
 #include <cctype>
 #include <stdexcept>
+#include <unistd.h>
 
-Config::Config() {}
+Config::Config()
+    : workerProcesses(1),
+      edgeTriggered(false),
+      openFileCacheMax(0),
+      openFileCacheValid(60),
+      clientHeaderTimeout(60),
+      clientBodyTimeout(60),
+      sendTimeout(60),
+      keepaliveTimeout(75),
+      cgiTimeout(60),
+      keepaliveRequests(1000),
+      fastcgiKeepalive(1),
+      gzip(false),
+      brotli(false),
+      gzipStatic(false),
+      gzipCompLevel(1),
+      brotliCompLevel(4),
+      gzipMinLength(256)
+{
+        gzipTypes.insert("text/html");
+        gzipTypes.insert("text/css");
+        gzipTypes.insert("text/plain");
+        gzipTypes.insert("application/javascript");
+        gzipTypes.insert("application/json");
+}
 
 Config::~Config() {}
 
@@ -16,12 +41,123 @@ void Config::validateAndParseConfig()
                 throw std::runtime_error("Configuration must contain at least one server block");
         }
 
+        parseGlobalConfig();
+
         for (size_t i = 0; i < servers.size(); ++i)
         {
                 parseServerConfig(servers[i]);
         }
 }
 
+void Config::parseGlobalConfig()
+{
+        for (std::map<std::string, std::vector<std::string> >::iterator it = directives.begin();
+             it != directives.end(); ++it)
+        {
+                if (it->first != "worker_processes" && it->first != "edge_triggered" &&
+                    it->first != "open_file_cache" && it->first != "client_header_timeout" &&
+                    it->first != "client_body_timeout" && it->first != "send_timeout" &&
+                    it->first != "keepalive_timeout" && it->first != "cgi_timeout" &&
+                    it->first != "keepalive_requests" && it->first != "fastcgi_keepalive" &&
+                    it->first != "gzip" && it->first != "brotli" && it->first != "gzip_static" &&
+                    it->first != "gzip_types" && it->first != "gzip_comp_level" &&
+                    it->first != "brotli_comp_level" && it->first != "gzip_min_length")
+                {
+                        throwValidationError(it->first, "", "directive is not allowed in the main context");
+                }
+                validateDirectiveValues(it->first, it->second);
+        }
+
+        if (directives.find("worker_processes") != directives.end())
+        {
+                workerProcesses = parseWorkerProcessesDirective(directives["worker_processes"].back());
+        }
+
+        if (directives.find("edge_triggered") != directives.end())
+        {
+                edgeTriggered = parseOnOffDirective("edge_triggered", directives["edge_triggered"].back());
+        }
+
+        if (directives.find("open_file_cache") != directives.end())
+        {
+                parseOpenFileCacheDirective(directives["open_file_cache"]);
+        }
+
+        if (directives.find("client_header_timeout") != directives.end())
+        {
+                clientHeaderTimeout = parseSecondsDirective(directives["client_header_timeout"].back());
+        }
+
+        if (directives.find("client_body_timeout") != directives.end())
+        {
+                clientBodyTimeout = parseSecondsDirective(directives["client_body_timeout"].back());
+        }
+
+        if (directives.find("send_timeout") != directives.end())
+        {
+                sendTimeout = parseSecondsDirective(directives["send_timeout"].back());
+        }
+
+        if (directives.find("keepalive_timeout") != directives.end())
+        {
+                keepaliveTimeout = parseSecondsDirective(directives["keepalive_timeout"].back());
+        }
+
+        if (directives.find("cgi_timeout") != directives.end())
+        {
+                cgiTimeout = parseSecondsDirective(directives["cgi_timeout"].back());
+        }
+
+        if (directives.find("keepalive_requests") != directives.end())
+        {
+                keepaliveRequests = static_cast<int>(parseNumberDirective(directives["keepalive_requests"].back()));
+        }
+
+        if (directives.find("fastcgi_keepalive") != directives.end())
+        {
+                fastcgiKeepalive = static_cast<int>(parseNumberDirective(directives["fastcgi_keepalive"].back()));
+        }
+
+        if (directives.find("gzip") != directives.end())
+        {
+                gzip = parseOnOffDirective("gzip", directives["gzip"].back());
+        }
+
+        if (directives.find("brotli") != directives.end())
+        {
+                brotli = parseOnOffDirective("brotli", directives["brotli"].back());
+        }
+
+        if (directives.find("gzip_static") != directives.end())
+        {
+                gzipStatic = parseOnOffDirective("gzip_static", directives["gzip_static"].back());
+        }
+
+        // Replaces the default list; HTML is always compressed
+        if (directives.find("gzip_types") != directives.end())
+        {
+                const std::vector<std::string> &types = directives["gzip_types"];
+                gzipTypes.clear();
+                gzipTypes.insert("text/html");
+                gzipTypes.insert(types.begin(), types.end());
+        }
+
+        if (directives.find("gzip_comp_level") != directives.end())
+        {
+                gzipCompLevel = static_cast<int>(parseNumberDirective(directives["gzip_comp_level"].back()));
+        }
+
+        if (directives.find("brotli_comp_level") != directives.end())
+        {
+                brotliCompLevel = static_cast<int>(parseNumberDirective(directives["brotli_comp_level"].back()));
+        }
+
+        if (directives.find("gzip_min_length") != directives.end())
+        {
+                gzipMinLength = static_cast<size_t>(parseNumberDirective(directives["gzip_min_length"].back()));
+        }
+}
+
 void Config::parseServerConfig(ServerConfig &server)
 {
         for (std::map<std::string, std::vector<std::string> >::iterator it = server.directives.begin();
@@ -76,6 +212,15 @@ void Config::parseServerConfig(ServerConfig &server)
                 server.autoindex = false;
         }
 
+        if (server.directives.find("autoindex_format") != server.directives.end())
+        {
+                server.autoindexFormat = server.directives["autoindex_format"].back();
+        }
+        else
+        {
+                server.autoindexFormat = "html";
+        }
+
         if (server.directives.find("client_size") != server.directives.end())
         {
                 server.clientMaxBodySize = parseClientSizeDirective(server.directives["client_size"].back());
@@ -89,14 +234,25 @@ void Config::parseServerConfig(ServerConfig &server)
                 server.clientMaxBodySize = 1048576;
         }
 
+        if (server.directives.find("client_body_buffer_size") != server.directives.end())
+        {
+                server.clientBodyBufferSize = parseClientSizeDirective(server.directives["client_body_buffer_size"].back());
+        }
+        else
+        {
+                server.clientBodyBufferSize = 16384;
+        }
+
         if (server.directives.find("error_page") != server.directives.end())
         {
                 server.errorPages = parseErrorPageDirective(server.directives["error_page"]);
         }
 
+        server.locationIndex.clear();
         for (size_t i = 0; i < server.locations.size(); ++i)
         {
                 parseLocationConfig(server.locations[i]);
+                server.locationIndex.add(server.locations[i].path, i);
         }
 }
 
@@ -132,6 +288,11 @@ void Config::parseLocationConfig(LocationConfig &location)
                 location.autoindex = false;
         }
 
+        if (location.directives.find("autoindex_format") != location.directives.end())
+        {
+                location.autoindexFormat = location.directives["autoindex_format"].back();
+        }
+
         if (location.directives.find("client_size") != location.directives.end())
         {
                 location.clientMaxBodySize = parseClientSizeDirective(location.directives["client_size"].back());
@@ -141,11 +302,53 @@ void Config::parseLocationConfig(LocationConfig &location)
                 location.clientMaxBodySize = 0;
         }
 
+        if (location.directives.find("client_body_buffer_size") != location.directives.end())
+        {
+                location.clientBodyBufferSize = parseClientSizeDirective(location.directives["client_body_buffer_size"].back());
+        }
+        else
+        {
+                location.clientBodyBufferSize = 0;
+        }
+
         if (location.directives.find("cgi_pass") != location.directives.end())
         {
                 location.cgiPass = location.directives["cgi_pass"].back();
         }
 
+        location.cgiPoolMinIdle = 0;
+        location.cgiPoolMaxIdle = 0;
+        if (location.directives.find("cgi_pool") != location.directives.end())
+        {
+                if (location.cgiPass.empty() || location.directives.find("cgi_worker") == location.directives.end())
+                {
+                        throwValidationError("cgi_pool", location.path, "requires cgi_pass and cgi_worker in the same location");
+                }
+                const std::vector<std::string> &pool = location.directives["cgi_pool"];
+                location.cgiWorker = location.directives["cgi_worker"].back();
+                location.cgiPoolMinIdle = static_cast<size_t>(parseNumberDirective(pool[0]));
+                location.cgiPoolMaxIdle = static_cast<size_t>(parseNumberDirective(pool[1]));
+        }
+
+        if (location.directives.find("fastcgi_pass") != location.directives.end())
+        {
+                if (!location.cgiPass.empty())
+                {
+                        throwValidationError("fastcgi_pass", location.path, "cannot be combined with cgi_pass in one location");
+                }
+                location.fastcgiPass = location.directives["fastcgi_pass"].back();
+        }
+
+        location.cgiCacheSize = 0;
+        if (location.directives.find("cgi_cache") != location.directives.end())
+        {
+                if (location.cgiPass.empty() && location.fastcgiPass.empty())
+                {
+                        throwValidationError("cgi_cache", location.path, "requires cgi_pass or fastcgi_pass in the same location");
+                }
+                location.cgiCacheSize = static_cast<size_t>(parseNumberDirective(location.directives["cgi_cache"].back()));
+        }
+
         if (location.directives.find("return") != location.directives.end())
         {
                 location.returnUrl = location.directives["return"].back();
@@ -222,6 +425,63 @@ bool Config::parseAutoindexDirective(const std::string &value)
         return (value == "on" || value == "true" || value == "1");
 }
 
+// Switches added since autoindex take exactly on or off, so a typo is an
+// error instead of quietly leaving the feature off
+bool Config::parseOnOffDirective(const std::string &directive, const std::string &value)
+{
+        validateOnOffValue(directive, value);
+        return value == "on";
+}
+
+int Config::parseWorkerProcessesDirective(const std::string &value)
+{
+        if (value == "auto")
+        {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                return cpus > 0 ? static_cast<int>(cpus) : 1;
+        }
+
+        std::istringstream iss(value);
+        int count;
+        iss >> count;
+        return count;
+}
+
+// open_file_cache off | max=N [valid=TIME]
+void Config::parseOpenFileCacheDirective(const std::vector<std::string> &values)
+{
+        openFileCacheMax = 0;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+                if (values[i].compare(0, 4, "max=") == 0)
+                {
+                        std::istringstream iss(values[i].substr(4));
+                        iss >> openFileCacheMax;
+                }
+                else if (values[i].compare(0, 6, "valid=") == 0)
+                {
+                        openFileCacheValid = parseSecondsDirective(values[i].substr(6));
+                }
+        }
+}
+
+// A time in seconds, optionally written with an 's' suffix ("30" or "30s")
+int Config::parseSecondsDirective(const std::string &value)
+{
+        std::istringstream iss(value);
+        int seconds = 0;
+        iss >> seconds;
+        return seconds;
+}
+
+long Config::parseNumberDirective(const std::string &value)
+{
+        std::istringstream iss(value);
+        long number = 0;
+        iss >> number;
+        return number;
+}
+
 std::vector<Config::ErrorPageConfig> Config::parseErrorPageDirective(const std::vector<std::string> &values)
 {
         std::vector<ErrorPageConfig> errorPages;
@@ -285,7 +545,7 @@ void Config::validateDirectiveValues(const std::string &directive, const std::ve
                         throwValidationError(directive, values[0], "index must be a filename without path separators");
                 }
         }
-        else if (directive == "client_size" || directive == "client_max_body_size")
+        else if (directive == "client_size" || directive == "client_max_body_size" || directive == "client_body_buffer_size")
         {
                 if (values.size() != 1)
                 {
@@ -301,6 +561,17 @@ void Config::validateDirectiveValues(const std::string &directive, const std::ve
                 }
                 validateAutoindexValue(values[0]);
         }
+        else if (directive == "autoindex_format")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", "autoindex_format directive must have exactly one value");
+                }
+                if (values[0] != "html" && values[0] != "json")
+                {
+                        throwValidationError(directive, values[0], "autoindex_format must be 'html' or 'json'");
+                }
+        }
         else if (directive == "return")
         {
                 if (values.size() != 1)
@@ -317,6 +588,121 @@ void Config::validateDirectiveValues(const std::string &directive, const std::ve
                 }
                 validateCgiPath(values[0]);
         }
+        else if (directive == "cgi_worker")
+        {
+                if (values.size() != 1 || values[0].empty())
+                {
+                        throwValidationError(directive, "", "cgi_worker directive must have exactly one value");
+                }
+        }
+        else if (directive == "cgi_pool")
+        {
+                if (values.size() != 2)
+                {
+                        throwValidationError(directive, "", "cgi_pool directive must have min_idle and max_idle values");
+                }
+                validateNumber(directive, values[0], 0, 256);
+                validateNumber(directive, values[1], 1, 256);
+                if (parseNumberDirective(values[0]) > parseNumberDirective(values[1]))
+                {
+                        throwValidationError(directive, values[0], "min_idle cannot exceed max_idle");
+                }
+        }
+        else if (directive == "cgi_cache")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", "cgi_cache directive must have exactly one value");
+                }
+                validateNumber(directive, values[0], 1, 1073741824);
+        }
+        else if (directive == "fastcgi_pass")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", "fastcgi_pass directive must have exactly one value");
+                }
+                validateFastCgiAddress(values[0]);
+        }
+        else if (directive == "worker_processes")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", "worker_processes directive must have exactly one value");
+                }
+                validateWorkerProcesses(values[0]);
+        }
+        else if (directive == "edge_triggered" || directive == "gzip" || directive == "brotli" ||
+                 directive == "gzip_static")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", directive + " directive must have exactly one value");
+                }
+                validateOnOffValue(directive, values[0]);
+        }
+        else if (directive == "client_header_timeout" || directive == "client_body_timeout" ||
+                 directive == "send_timeout" || directive == "keepalive_timeout" || directive == "cgi_timeout")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", directive + " directive must have exactly one value");
+                }
+                validateSeconds(directive, values[0]);
+        }
+        else if (directive == "keepalive_requests")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", directive + " directive must have exactly one value");
+                }
+                validateNumber(directive, values[0], 0, 1000000);
+        }
+        else if (directive == "fastcgi_keepalive")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", directive + " directive must have exactly one value");
+                }
+                validateNumber(directive, values[0], 0, 1024);
+        }
+        else if (directive == "gzip_types")
+        {
+                if (values.empty())
+                {
+                        throwValidationError(directive, "", "gzip_types directive must list at least one MIME type");
+                }
+                for (size_t i = 0; i < values.size(); ++i)
+                {
+                        if (values[i] != "*" && values[i].find('/') == std::string::npos)
+                        {
+                                throwValidationError(directive, values[i], "gzip_types values must be MIME types or '*'");
+                        }
+                }
+        }
+        else if (directive == "gzip_comp_level" || directive == "brotli_comp_level")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", directive + " directive must have exactly one value");
+                }
+                if (directive == "gzip_comp_level")
+                        validateNumber(directive, values[0], 1, 9);
+                else
+                        validateNumber(directive, values[0], 0, 11);
+        }
+        else if (directive == "gzip_min_length")
+        {
+                if (values.size() != 1)
+                {
+                        throwValidationError(directive, "", directive + " directive must have exactly one value");
+                }
+                validateNumber(directive, values[0], 0, 1073741824);
+        }
+        else if (directive == "open_file_cache")
+        {
+                validateOpenFileCache(values);
+        }
         else if (directive == "error_page")
         {
                 if (values.size() % 2 != 0)
@@ -476,6 +862,127 @@ void Config::validateCgiPath(const std::string &path)
         }
 }
 
+void Config::validateFastCgiAddress(const std::string &address)
+{
+        if (address.compare(0, 5, "unix:") == 0)
+        {
+                if (address.size() == 5)
+                {
+                        throwValidationError("fastcgi_pass", address, "socket path cannot be empty");
+                }
+                return;
+        }
+
+        size_t colonPos = address.rfind(':');
+        if (colonPos == std::string::npos || colonPos == 0)
+        {
+                throwValidationError("fastcgi_pass", address, "address must be 'unix:/path' or 'host:port'");
+        }
+        validateHostname(address.substr(0, colonPos));
+
+        std::istringstream iss(address.substr(colonPos + 1));
+        int port;
+        if (!(iss >> port) || !iss.eof())
+        {
+                throwValidationError("fastcgi_pass", address, "port must be a number");
+        }
+        validatePortNumber(port);
+}
+
+void Config::validateWorkerProcesses(const std::string &value)
+{
+        if (value == "auto")
+        {
+                return;
+        }
+
+        std::istringstream iss(value);
+        int count;
+        if (!(iss >> count) || !iss.eof())
+        {
+                throwValidationError("worker_processes", value, "worker_processes must be a number or 'auto'");
+        }
+        if (count < 1 || count > 1024)
+        {
+                throwValidationError("worker_processes", value, "worker_processes must be between 1 and 1024");
+        }
+}
+
+void Config::validateOpenFileCache(const std::vector<std::string> &values)
+{
+        if (values.size() == 1 && values[0] == "off")
+        {
+                return;
+        }
+        if (values.empty() || values.size() > 2)
+        {
+                throwValidationError("open_file_cache", "", "open_file_cache must be 'off' or 'max=N [valid=TIME]'");
+        }
+
+        bool hasMax = false;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+                if (values[i].compare(0, 4, "max=") == 0)
+                {
+                        std::istringstream iss(values[i].substr(4));
+                        long count;
+                        if (!(iss >> count) || !iss.eof() || count < 1 || count > 1000000)
+                        {
+                                throwValidationError("open_file_cache", values[i], "max must be between 1 and 1000000");
+                        }
+                        hasMax = true;
+                }
+                else if (values[i].compare(0, 6, "valid=") == 0)
+                {
+                        validateSeconds("open_file_cache", values[i].substr(6));
+                }
+                else
+                {
+                        throwValidationError("open_file_cache", values[i], "unknown open_file_cache parameter");
+                }
+        }
+        if (!hasMax)
+        {
+                throwValidationError("open_file_cache", "", "open_file_cache requires a max=N parameter");
+        }
+}
+
+void Config::validateSeconds(const std::string &directive, const std::string &value)
+{
+        std::string number = value;
+        if (!number.empty() && number[number.length() - 1] == 's')
+        {
+                number.erase(number.length() - 1);
+        }
+
+        std::istringstream iss(number);
+        int seconds;
+        if (!(iss >> seconds) || !iss.eof() || seconds < 0 || seconds > 86400)
+        {
+                throwValidationError(directive, value, directive + " must be a number of seconds between 0 and 86400");
+        }
+}
+
+void Config::validateNumber(const std::string &directive, const std::string &value, long min, long max)
+{
+        std::istringstream iss(value);
+        long number;
+        if (!(iss >> number) || !iss.eof() || number < min || number > max)
+        {
+                std::ostringstream range;
+                range << min << " and " << max;
+                throwValidationError(directive, value, directive + " must be a number between " + range.str());
+        }
+}
+
+void Config::validateOnOffValue(const std::string &directive, const std::string &value)
+{
+        if (value != "on" && value != "off")
+        {
+                throwValidationError(directive, value, directive + " must be 'on' or 'off'");
+        }
+}
+
 bool Config::isValidHttpMethod(const std::string &method)
 {
         return (method == "GET" || method == "POST" || method == "DELETE" ||
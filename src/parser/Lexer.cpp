@@ -21,10 +21,33 @@ static std::set<std::string> initDirectives()
         directives.insert("ssl_certificate");
         directives.insert("ssl_certificate_key");
         directives.insert("autoindex");
+        directives.insert("autoindex_format");
         directives.insert("alias");
         directives.insert("methods");
         directives.insert("client_size");
         directives.insert("cgi_pass");
+        directives.insert("cgi_worker");
+        directives.insert("cgi_pool");
+        directives.insert("fastcgi_pass");
+        directives.insert("cgi_cache");
+        directives.insert("fastcgi_keepalive");
+        directives.insert("worker_processes");
+        directives.insert("edge_triggered");
+        directives.insert("open_file_cache");
+        directives.insert("gzip");
+        directives.insert("gzip_types");
+        directives.insert("gzip_comp_level");
+        directives.insert("gzip_min_length");
+        directives.insert("gzip_static");
+        directives.insert("brotli");
+        directives.insert("brotli_comp_level");
+        directives.insert("client_header_timeout");
+        directives.insert("client_body_timeout");
+        directives.insert("send_timeout");
+        directives.insert("keepalive_timeout");
+        directives.insert("keepalive_requests");
+        directives.insert("cgi_timeout");
+        directives.insert("client_body_buffer_size");
         // Add other directives here
         return directives;
 }
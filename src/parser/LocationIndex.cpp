@@ -0,0 +1,96 @@
+#include "LocationIndex.hpp"
+
+LocationIndex::LocationIndex()
+{
+        clear();
+}
+
+void LocationIndex::clear()
+{
+        prefixNodes.assign(1, Node());
+        suffixNodes.assign(1, Node());
+}
+
+void LocationIndex::add(const std::string &locationPath, size_t locationIndex)
+{
+        if (!locationPath.empty() && locationPath[0] == '*')
+        {
+                insert(suffixNodes, locationPath.substr(1), true, locationIndex);
+        }
+        else
+        {
+                insert(prefixNodes, locationPath, false, locationIndex);
+        }
+}
+
+int LocationIndex::match(const std::string &uri) const
+{
+        int best = -1;
+        size_t bestScore = 0;
+
+        // Prefix locations score their own length; an empty path never matches
+        size_t node = 0;
+        for (size_t i = 0; i < uri.length(); ++i)
+        {
+                std::map<char, size_t>::const_iterator child = prefixNodes[node].children.find(uri[i]);
+                if (child == prefixNodes[node].children.end())
+                {
+                        break;
+                }
+                node = child->second;
+                consider(prefixNodes[node].location, i + 1, best, bestScore);
+        }
+
+        // Suffix locations score the suffix length plus the leading '*'
+        node = 0;
+        consider(suffixNodes[0].location, 1, best, bestScore);
+        for (size_t i = uri.length(); i > 0; --i)
+        {
+                std::map<char, size_t>::const_iterator child = suffixNodes[node].children.find(uri[i - 1]);
+                if (child == suffixNodes[node].children.end())
+                {
+                        break;
+                }
+                node = child->second;
+                consider(suffixNodes[node].location, uri.length() - i + 2, best, bestScore);
+        }
+
+        return best;
+}
+
+void LocationIndex::insert(std::vector<Node> &nodes, const std::string &key, bool reversed, size_t locationIndex)
+{
+        size_t node = 0;
+        for (size_t i = 0; i < key.length(); ++i)
+        {
+                char c = reversed ? key[key.length() - 1 - i] : key[i];
+                std::map<char, size_t>::iterator child = nodes[node].children.find(c);
+                if (child != nodes[node].children.end())
+                {
+                        node = child->second;
+                        continue;
+                }
+                nodes.push_back(Node());
+                nodes[node].children[c] = nodes.size() - 1;
+                node = nodes.size() - 1;
+        }
+
+        // A duplicate path keeps the location declared first
+        if (nodes[node].location < 0)
+        {
+                nodes[node].location = static_cast<int>(locationIndex);
+        }
+}
+
+void LocationIndex::consider(int candidate, size_t score, int &best, size_t &bestScore)
+{
+        if (candidate < 0 || score < bestScore)
+        {
+                return;
+        }
+        if (score > bestScore || candidate < best)
+        {
+                best = candidate;
+                bestScore = score;
+        }
+}
@@ -17,6 +17,10 @@ Config Parser::parseConfig()
                 {
                         config.servers.push_back(parseServer());
                 }
+                else if (check(TokenType::DIRECTIVE) && peek().lexeme != "location")
+                {
+                        parseDirective(config.directives);
+                }
                 else
                 {
                         error("Expected 'server' directive at top level");